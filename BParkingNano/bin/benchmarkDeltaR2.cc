@@ -0,0 +1,73 @@
+// Times kin::deltaR2, with each instruction set the CPU supports, against
+// the loop over reco::deltaR2 it replaces, for arrays of a few sizes:
+//   benchmarkDeltaR2 [calls per size]
+
+#include "DataFormats/Math/interface/deltaR.h"
+#include "PhysicsTools/BParkingNano/interface/DeltaR2.h"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+  template<typename F>
+  double nanoseconds(unsigned calls, F &&f) {
+    const auto start = std::chrono::steady_clock::now();
+    for(unsigned i = 0; i < calls; ++i) f(i);
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / calls;
+  }
+
+}
+
+int main(int argc, char **argv) {
+  if(argc > 2) {
+    std::cerr << "usage: " << argv[0] << " [calls per size]" << std::endl;
+    return 2;
+  }
+  const unsigned calls = argc > 1 ? std::stoul(argv[1]) : 200000;
+  const size_t sizes[] = {8, 32, 128, 512, 2048};
+  const char * isas[] = {"avx512", "avx2", "scalar"};
+
+  std::mt19937 rng(12345);
+  std::uniform_real_distribution<float> eta_dist(-2.5, 2.5);
+  std::uniform_real_distribution<float> phi_dist(-M_PI, M_PI);
+  // axes, changing at each call
+  std::vector<float> axis_eta(1024), axis_phi(1024);
+  for(size_t i = 0; i < axis_eta.size(); ++i) {
+    axis_eta[i] = eta_dist(rng);
+    axis_phi[i] = phi_dist(rng);
+  }
+
+  std::cout << "deltaR2 runs with " << kin::deltaR2_isa() << "; ns per call:" << std::endl;
+  for(size_t n : sizes) {
+    std::vector<float> etas(n), phis(n), dr2(n);
+    for(size_t i = 0; i < n; ++i) {
+      etas[i] = eta_dist(rng);
+      phis[i] = phi_dist(rng);
+    }
+    float sink = 0.;
+
+    std::cout << "  n = " << n << ": reco::deltaR2 loop "
+              << nanoseconds(calls, [&](unsigned call) {
+                  const size_t axis = call % axis_eta.size();
+                  for(size_t i = 0; i < n; ++i) dr2[i] = reco::deltaR2(axis_eta[axis], axis_phi[axis], etas[i], phis[i]);
+                  sink += dr2[call % n];
+                });
+    for(const char * isa : isas) {
+      if(!kin::deltaR2_with(isa, 0, 0, nullptr, nullptr, 0, nullptr)) continue;
+      std::cout << ", " << isa << " "
+                << nanoseconds(calls, [&](unsigned call) {
+                    const size_t axis = call % axis_eta.size();
+                    kin::deltaR2_with(isa, axis_eta[axis], axis_phi[axis], etas.data(), phis.data(), n, dr2.data());
+                    sink += dr2[call % n];
+                  });
+    }
+    // keeps the results alive
+    std::cout << (sink < 0 ? " " : "") << std::endl;
+  }
+  return 0;
+}
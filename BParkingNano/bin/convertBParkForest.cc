@@ -0,0 +1,183 @@
+// Converts a BDT weight file, as read by createGBRForest (.xml or .xml.gz),
+// to the binary format of bph::FlatForest:
+//   convertBParkForest <weights.xml.gz> <forest.bin>
+// With --benchmark the binary file is not written but read back: the start
+// up (parsing vs mapping) and the evaluation are timed with both formats and
+// the responses compared on random inputs around the cuts of the forest:
+//   convertBParkForest --benchmark <weights.xml.gz> <forest.bin> [evaluations]
+// The weight files are paths, or relative to CMSSW_SEARCH_PATH as in the
+// configurations.
+
+#include "CommonTools/MVAUtils/interface/GBRForestTools.h"
+#include "CondFormats/GBRForest/interface/GBRForest.h"
+#include "FWCore/Utilities/interface/Exception.h"
+#include "PhysicsTools/BParkingNano/interface/FlatForest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using bph::FlatForest;
+
+namespace {
+
+  std::unique_ptr<const GBRForest> parse(const std::string &path, std::vector<std::string> &variables) {
+    variables.clear();
+    // createGBRForest resolves the relative paths with edm::FileInPath
+    const std::string weights = std::filesystem::exists(path) ? std::filesystem::absolute(path).string() : path;
+    return createGBRForest(weights, variables);
+  }
+
+  // trees of the forest in the FlatForest layout
+  class Flattener {
+  public:
+    explicit Flattener(const GBRForest &forest) {
+      const std::vector<float> zeros(256, 0.);
+      // no accessor to the initial response: what the trees do not give
+      double initial = forest.GetResponse(zeros.data());
+      for(const GBRTree & tree : forest.Trees()) {
+        initial -= tree.GetResponse(zeros.data());
+        roots.push_back(tree.CutIndices().empty() ? leaf(tree, 0) : node(tree, 0));
+      }
+      initialResponse = initial;
+    }
+
+    double initialResponse;
+    std::vector<int32_t> roots;
+    std::vector<FlatForest::Node> nodes;
+    std::vector<double> leaves;
+
+  private:
+    // GBRTree children: > 0 node, <= 0 leaf -index
+    int32_t child(const GBRTree &tree, int index) { return index > 0 ? node(tree, index) : leaf(tree, -index); }
+
+    int32_t leaf(const GBRTree &tree, int index) {
+      leaves.push_back(tree.Responses()[index]);
+      return ~int32_t(leaves.size() - 1);
+    }
+
+    // pre-order, the left child is the next node
+    int32_t node(const GBRTree &tree, int index) {
+      const int32_t flat = nodes.size();
+      nodes.push_back({tree.CutVals()[index], tree.CutIndices()[index], 0, 0});
+      const int32_t left = child(tree, tree.LeftIndices()[index]);
+      const int32_t right = child(tree, tree.RightIndices()[index]);
+      nodes[flat].left = left;
+      nodes[flat].right = right;
+      return flat;
+    }
+  };
+
+  void write_block(std::ofstream &out, const void *data, size_t size) {
+    static const char zeros[8] = {};
+    out.write(static_cast<const char *>(data), size);
+    out.write(zeros, FlatForest::padded(size) - size);
+  }
+
+  void write(const GBRForest &forest, const std::vector<std::string> &variables, const std::string &path) {
+    const Flattener flat(forest);
+    std::string names;
+    for(const auto & name : variables) names.append(name).push_back('\0');
+
+    FlatForest::Header header;
+    std::memcpy(header.magic, FlatForest::MAGIC, sizeof(header.magic));
+    header.version = FlatForest::VERSION;
+    header.nVariables = variables.size();
+    header.nTrees = flat.roots.size();
+    header.nNodes = flat.nodes.size();
+    header.nLeaves = flat.leaves.size();
+    header.namesSize = names.size();
+    header.reserved = 0;
+    header.initialResponse = flat.initialResponse;
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    write_block(out, &header, sizeof(header));
+    write_block(out, names.data(), names.size());
+    write_block(out, flat.roots.data(), sizeof(int32_t) * flat.roots.size());
+    write_block(out, flat.nodes.data(), sizeof(FlatForest::Node) * flat.nodes.size());
+    out.write(reinterpret_cast<const char *>(flat.leaves.data()), sizeof(double) * flat.leaves.size());
+    if(!out) throw cms::Exception("FlatForest") << "cannot write " << path;
+
+    std::cout << path << ": " << header.nTrees << " trees, " << header.nNodes << " nodes, "
+              << header.nLeaves << " leaves, " << FlatForest::Layout(header).size << " bytes" << std::endl;
+  }
+
+  template<typename F>
+  double seconds(unsigned repetitions, F &&f) {
+    const auto start = std::chrono::steady_clock::now();
+    for(unsigned i = 0; i < repetitions; ++i) f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repetitions;
+  }
+
+  int benchmark(const std::string &weights, const std::string &path, unsigned evaluations) {
+    std::vector<std::string> variables;
+    std::unique_ptr<const GBRForest> forest;
+    const double t_parse = seconds(3, [&]() { forest = parse(weights, variables); });
+    std::unique_ptr<FlatForest> flat;
+    const double t_map = seconds(100, [&]() { flat = std::make_unique<FlatForest>(path); });
+    if(flat->variableNames() != variables || flat->nTrees() != forest->Trees().size()) {
+      std::cerr << path << " is not the conversion of " << weights << std::endl;
+      return 1;
+    }
+
+    // inputs around the cuts, to go both ways in the nodes
+    std::vector<std::vector<float> > cuts(variables.size());
+    for(const GBRTree & tree : forest->Trees()) {
+      for(size_t i = 0; i < tree.CutIndices().size(); ++i)
+        cuts[tree.CutIndices()[i]].push_back(tree.CutVals()[i]);
+    }
+    std::mt19937 rng(12345);
+    std::vector<float> inputs(evaluations * variables.size());
+    for(size_t i = 0; i < inputs.size(); ++i) {
+      const auto & values = cuts[i % variables.size()];
+      if(values.empty()) continue;
+      const float cut = values[std::uniform_int_distribution<size_t>(0, values.size() - 1)(rng)];
+      inputs[i] = cut * std::uniform_real_distribution<float>(0.99, 1.01)(rng);
+    }
+
+    std::vector<double> gbr(evaluations), mapped(evaluations);
+    const double t_gbr = seconds(1, [&]() {
+        for(unsigned i = 0; i < evaluations; ++i) gbr[i] = forest->GetResponse(&inputs[i * variables.size()]);
+      }) / evaluations;
+    const double t_flat = seconds(1, [&]() {
+        for(unsigned i = 0; i < evaluations; ++i) mapped[i] = flat->response(&inputs[i * variables.size()]);
+      }) / evaluations;
+    double max_diff = 0.;
+    for(unsigned i = 0; i < evaluations; ++i) max_diff = std::max(max_diff, std::abs(gbr[i] - mapped[i]));
+
+    std::cout << "start up:   " << weights << " parsed in " << t_parse * 1e3 << " ms, "
+              << path << " mapped in " << t_map * 1e3 << " ms\n"
+              << "evaluation: GBRForest " << t_gbr * 1e6 << " us, FlatForest " << t_flat * 1e6 << " us\n"
+              << "largest response difference on " << evaluations << " inputs: " << max_diff << std::endl;
+    return max_diff < 1e-6 ? 0 : 1;
+  }
+}
+
+int main(int argc, char **argv) {
+  std::vector<std::string> args(argv + 1, argv + argc);
+  const bool run_benchmark = !args.empty() && args.front() == "--benchmark";
+  if(run_benchmark) args.erase(args.begin());
+  if(args.size() < 2 || args.size() > (run_benchmark ? 3 : 2)) {
+    std::cerr << "usage: " << argv[0] << " [--benchmark] <weights.xml[.gz]> <forest.bin> [evaluations]" << std::endl;
+    return 2;
+  }
+
+  try {
+    if(run_benchmark) return benchmark(args[0], args[1], args.size() > 2 ? std::stoul(args[2]) : 100000);
+    std::vector<std::string> variables;
+    const auto forest = parse(args[0], variables);
+    write(*forest, variables, args[1]);
+  } catch(const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
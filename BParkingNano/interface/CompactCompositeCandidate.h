@@ -0,0 +1,149 @@
+#ifndef PhysicsTools_BParkingNano_CompactCompositeCandidate
+#define PhysicsTools_BParkingNano_CompactCompositeCandidate
+
+#include "DataFormats/Candidate/interface/LeafCandidate.h"
+#include "DataFormats/Candidate/interface/CandidateFwd.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace bph {
+
+  // The user data keys of the candidates of a collection. A schema is
+  // registered once per process and the candidates only keep its id, which
+  // is a hash of the keys: the same schema has the same id in every job.
+  // The schemas registered in a job are written as a run product by
+  // CompactSchemaProducer, which registers them again in the jobs reading
+  // the file, so that the candidates are readable there as well.
+  class CompactSchema {
+  public:
+    typedef uint32_t Id;
+    static constexpr int NONE = -1;
+
+    CompactSchema() {}
+    CompactSchema(std::vector<std::string> floats, std::vector<std::string> ints, std::vector<std::string> cands);
+
+    Id id() const { return id_; }
+    const std::vector<std::string> & floatKeys() const { return floats_; }
+    const std::vector<std::string> & intKeys() const { return ints_; }
+    const std::vector<std::string> & candKeys() const { return cands_; }
+
+    // slot of the key in the value arrays, NONE if not in the schema
+    int floatIndex(const std::string &key) const { return slot(float_slots_, key); }
+    int intIndex(const std::string &key) const { return slot(int_slots_, key); }
+    int candIndex(const std::string &key) const { return slot(cand_slots_, key); }
+
+    // Registers the schema, or returns the one already registered with the
+    // same keys. The returned schema lives until the end of the process
+    static const CompactSchema & registerSchema(const CompactSchema &schema);
+    // nullptr if no schema with this id was registered in this process
+    static const CompactSchema * find(Id id);
+    // copies of the schemas registered so far, in order of registration
+    static std::vector<CompactSchema> registered();
+
+  private:
+    typedef std::unordered_map<std::string, int> Slots;
+    static int slot(const Slots &slots, const std::string &key) {
+      auto found = slots.find(key);
+      return found == slots.end() ? NONE : found->second;
+    }
+    bool sameKeys(const CompactSchema &other) const {
+      return floats_ == other.floats_ && ints_ == other.ints_ && cands_ == other.cands_;
+    }
+
+    Id id_ = 0;
+    std::vector<std::string> floats_, ints_, cands_;
+    // transient, only filled by the constructor from the keys
+    Slots float_slots_, int_slots_, cand_slots_;
+  };
+
+  typedef std::vector<CompactSchema> CompactSchemaCollection;
+
+  // Composite candidate whose user data keys are stored once per collection,
+  // in its schema, while the values sit in contiguous arrays. The user data
+  // accessors are the ones of pat::CompositeCandidate, so string cuts and
+  // table producers work unchanged. A key of the schema that was never set
+  // reads as 0 (null for the candidates), but hasUserFloat and co. are false
+  // for it, as for pat::CompositeCandidate; keys outside of the schema, e.g.
+  // added by a downstream module, are stored per candidate.
+  // The candidate has no daughters: the decay products are user candidates
+  // ("l1", "k", ...). numberOfDaughters() is 0 and daughter() throws, so that
+  // a cut or a table reading daughters fails instead of reading nothing.
+  class CompactCompositeCandidate : public reco::LeafCandidate {
+  public:
+    CompactCompositeCandidate() {}
+    // the schema has to be one returned by CompactSchema::registerSchema
+    explicit CompactCompositeCandidate(const CompactSchema &schema);
+    ~CompactCompositeCandidate() override {}
+
+    CompactCompositeCandidate * clone() const override { return new CompactCompositeCandidate(*this); }
+
+    using reco::LeafCandidate::daughter;
+    const reco::Candidate * daughter(size_type i) const override;
+    reco::Candidate * daughter(size_type i) override;
+
+    float userFloat(const std::string &key) const;
+    int32_t userInt(const std::string &key) const;
+    reco::CandidatePtr userCand(const std::string &key) const;
+    bool hasUserFloat(const std::string &key) const;
+    bool hasUserInt(const std::string &key) const;
+    bool hasUserCand(const std::string &key) const;
+
+    void addUserFloat(const std::string &key, float value);
+    void addUserInt(const std::string &key, int32_t value);
+    void addUserCand(const std::string &key, const reco::CandidatePtr &value);
+
+    // direct access by schema slot, as returned by CompactSchema::floatIndex etc.
+    float userFloatAt(int slot) const { return floats_[slot]; }
+    int32_t userIntAt(int slot) const { return ints_[slot]; }
+    const reco::CandidatePtr & userCandAt(int slot) const { return cands_[slot]; }
+
+    CompactSchema::Id schemaId() const { return schemaId_; }
+    // nullptr if the schema is not known to this process
+    const CompactSchema * schema() const {
+      const CompactSchema * known = schema_.get();
+      return known ? known : findSchema();
+    }
+
+  private:
+    // Schema of the candidate: set when the candidate is created in this
+    // process, or at the first lookup for a candidate read from a file
+    class SchemaCache {
+    public:
+      SchemaCache(const CompactSchema *schema = nullptr): schema_{schema} {}
+      SchemaCache(const SchemaCache &other): schema_{other.get()} {}
+      SchemaCache & operator=(const SchemaCache &other) { set(other.get()); return *this; }
+      const CompactSchema * get() const { return schema_.load(std::memory_order_acquire); }
+      void set(const CompactSchema *schema) const { schema_.store(schema, std::memory_order_release); }
+    private:
+      mutable std::atomic<const CompactSchema *> schema_;
+    };
+
+    const CompactSchema * findSchema() const;
+    // one bit per slot of the schema, set by addUserFloat and addUserInt
+    static bool isSet(const std::vector<uint64_t> &bits, int slot) {
+      return size_t(slot / 64) < bits.size() && ((bits[slot / 64] >> (slot % 64)) & 1);
+    }
+    static void markSet(std::vector<uint64_t> &bits, int slot) { bits[slot / 64] |= uint64_t(1) << (slot % 64); }
+
+    CompactSchema::Id schemaId_ = 0;
+    std::vector<float> floats_;
+    std::vector<int32_t> ints_;
+    std::vector<reco::CandidatePtr> cands_;
+    std::vector<uint64_t> floatsSet_, intsSet_;
+    // keys outside of the schema, sorted, with the values in the same order
+    std::vector<std::string> extraFloatKeys_, extraIntKeys_, extraCandKeys_;
+    std::vector<float> extraFloats_;
+    std::vector<int32_t> extraInts_;
+    std::vector<reco::CandidatePtr> extraCands_;
+    // transient
+    SchemaCache schema_;
+  };
+
+  typedef std::vector<CompactCompositeCandidate> CompactCompositeCandidateCollection;
+}
+
+#endif
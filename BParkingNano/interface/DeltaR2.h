@@ -0,0 +1,24 @@
+#ifndef PhysicsTools_BParkingNano_DeltaR2
+#define PhysicsTools_BParkingNano_DeltaR2
+
+#include <cstddef>
+
+// deltaR^2 between one axis and a contiguous array of (eta, phi), the inner
+// operation of the isolation and cleaning loops. The AVX-512 or AVX2 code
+// is chosen at the first call from the CPU the job runs on, with a scalar
+// fallback, so the library itself needs no special compilation flags.
+// Same values as reco::deltaR2 for phi in [-pi, pi], up to float rounding.
+namespace kin {
+
+  void deltaR2(float eta, float phi, const float *etas, const float *phis, size_t n, float *dr2);
+
+  // instruction set picked by deltaR2: "avx512", "avx2" or "scalar"
+  const char * deltaR2_isa();
+
+  // deltaR2 with the code of the given instruction set, whatever the one
+  // picked; false, and dr2 left untouched, if the CPU does not support it
+  bool deltaR2_with(const char *isa, float eta, float phi, const float *etas, const float *phis, size_t n, float *dr2);
+
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef PhysicsTools_BParkingNano_ElectronOverlay
+#define PhysicsTools_BParkingNano_ElectronOverlay
+
+#include "DataFormats/Common/interface/Ptr.h"
+#include "DataFormats/PatCandidates/interface/Electron.h"
+#include "PhysicsTools/BParkingNano/interface/CompactCompositeCandidate.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bph {
+
+  // Selected electron written instead of a copy of the pat::Electron: a Ptr
+  // to the electron of the input collection (slimmedElectrons or
+  // slimmedLowPtElectrons) plus what the selection changes or adds, i.e. the
+  // four-momentum, the impact parameters and the user data, the latter
+  // stored as in CompactCompositeCandidate. The pat::Electron methods used by
+  // the builders and the tables are forwarded to the input electron, the
+  // others are reached through electron(), in string cuts as well:
+  // "electron().hadronicOverEm()".
+  class ElectronOverlay : public CompactCompositeCandidate {
+  public:
+    typedef pat::Electron::IPTYPE IPTYPE;
+
+    ElectronOverlay() {}
+    // four-momentum, charge, vertex and impact parameters of the input electron;
+    // the schema has to be one returned by CompactSchema::registerSchema
+    ElectronOverlay(const CompactSchema &schema, const edm::Ptr<pat::Electron> &electron);
+    ~ElectronOverlay() override {}
+
+    ElectronOverlay * clone() const override { return new ElectronOverlay(*this); }
+
+    const pat::Electron & electron() const { return *electron_; }
+    const edm::Ptr<pat::Electron> & electronPtr() const { return electron_; }
+
+    // forwarded to the input electron
+    reco::GsfTrackRef gsfTrack() const { return electron_->gsfTrack(); }
+    reco::SuperClusterRef superCluster() const { return electron_->superCluster(); }
+    const reco::Track * bestTrack() const override { return electron_->bestTrack(); }
+    bool passConversionVeto() const { return electron_->passConversionVeto(); }
+    float fbrem() const { return electron_->fbrem(); }
+    float trackIso() const { return electron_->trackIso(); }
+    float correctedEcalEnergy() const { return electron_->correctedEcalEnergy(); }
+    const reco::GsfElectron::PflowIsolationVariables & pfIsolationVariables() const {
+      return electron_->pfIsolationVariables();
+    }
+    const reco::GsfElectron::Corrections & corrections() const { return electron_->corrections(); }
+    const std::vector<pat::Electron::IdPair> & electronIDs() const { return electron_->electronIDs(); }
+    float electronID(const std::string &name) const { return electron_->electronID(name); }
+    size_t numberOfSourceCandidatePtrs() const override { return electron_->numberOfSourceCandidatePtrs(); }
+    reco::CandidatePtr sourceCandidatePtr(size_type i) const override { return electron_->sourceCandidatePtr(i); }
+
+    // impact parameters, as pat::Electron::dB and edB
+    double dB(IPTYPE type) const { return ip_[type]; }
+    double edB(IPTYPE type) const { return eip_[type]; }
+    void setDB(double dB, double edB, IPTYPE type) {
+      ip_[type] = dB;
+      eip_[type] = edB;
+    }
+
+    // signature of pat::Electron, the value is always overwritten
+    using CompactCompositeCandidate::addUserInt;
+    void addUserInt(const std::string &key, int32_t value, bool /*overwrite*/) { addUserInt(key, value); }
+
+  private:
+    edm::Ptr<pat::Electron> electron_;
+    double ip_[pat::Electron::IpTypeSize] = {};
+    double eip_[pat::Electron::IpTypeSize] = {};
+  };
+
+  typedef std::vector<ElectronOverlay> ElectronOverlayCollection;
+}
+
+#endif
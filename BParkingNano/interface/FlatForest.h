@@ -0,0 +1,89 @@
+#ifndef PhysicsTools_BParkingNano_FlatForest
+#define PhysicsTools_BParkingNano_FlatForest
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bph {
+
+  // Read-only boosted decision tree forest, memory-mapped from the binary
+  // file written by convertBParkForest and evaluated in place, without
+  // parsing. The response is the one of the GBRForest converted.
+  //
+  // File layout, all the blocks aligned to 8 bytes:
+  //   Header
+  //   variable names, '\0' terminated, in input order   (Header::namesSize bytes)
+  //   int32_t roots[nTrees]
+  //   Node nodes[nNodes]
+  //   double leaves[nLeaves]
+  // The nodes of each tree are contiguous and in pre-order, a node is
+  // followed by its left child. A child index >= 0 is a node, < 0 the leaf
+  // ~index; so is a root, for a tree made of a single leaf.
+  class FlatForest {
+  public:
+    static constexpr char MAGIC[4] = {'B', 'P', 'F', 'F'};
+    static constexpr uint32_t VERSION = 1;
+
+    struct Header {
+      char magic[4];
+      uint32_t version;
+      uint32_t nVariables;
+      uint32_t nTrees;
+      uint32_t nNodes;
+      uint32_t nLeaves;
+      uint32_t namesSize;
+      uint32_t reserved;
+      double initialResponse;
+    };
+
+    struct Node {
+      float cut;          // goes right if variable > cut
+      uint32_t variable;
+      int32_t left;
+      int32_t right;
+    };
+
+    // offsets of the blocks in the file
+    struct Layout {
+      size_t names, roots, nodes, leaves, size;
+      explicit Layout(const Header &header);
+    };
+    static size_t padded(size_t bytes) { return (bytes + 7) & ~size_t(7); }
+
+    // throws cms::Exception("FlatForest") if the file is not a valid forest
+    explicit FlatForest(const std::string &path);
+    ~FlatForest();
+    FlatForest(const FlatForest &) = delete;
+    FlatForest & operator=(const FlatForest &) = delete;
+
+    // variables in the order of variableNames()
+    double response(const float *variables) const {
+      double sum = header_->initialResponse;
+      for(uint32_t tree = 0; tree < header_->nTrees; ++tree) {
+        int32_t index = roots_[tree];
+        while(index >= 0) {
+          const Node & node = nodes_[index];
+          index = variables[node.variable] > node.cut ? node.right : node.left;
+        }
+        sum += leaves_[~index];
+      }
+      return sum;
+    }
+
+    const std::vector<std::string> & variableNames() const { return variables_; }
+    size_t nTrees() const { return header_->nTrees; }
+
+  private:
+    void * map_ = nullptr;
+    size_t size_ = 0;
+    const Header * header_ = nullptr;
+    const int32_t * roots_ = nullptr;
+    const Node * nodes_ = nullptr;
+    const double * leaves_ = nullptr;
+    std::vector<std::string> variables_;
+  };
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef PhysicsTools_BParkingNano_LazyTransientTrack
+#define PhysicsTools_BParkingNano_LazyTransientTrack
+
+#include "DataFormats/GsfTrackReco/interface/GsfTrackFwd.h"
+#include "DataFormats/Math/interface/Vector3D.h"
+#include "DataFormats/TrackReco/interface/Track.h"
+#include "FWCore/Utilities/interface/AtomicPtrCache.h"
+#include "TrackingTools/TransientTrack/interface/TransientTrack.h"
+
+#include <utility>
+#include <vector>
+
+class MagneticField;
+class TransientTrackBuilder;
+
+namespace bph {
+
+  // Transient track of a selected object, in a collection index-aligned with
+  // the objects. The reco::TransientTrack is built by the first get() and
+  // cached for the rest of the event, so that only the objects entering a
+  // fit pay for it. The entry points to the track, the magnetic field or the
+  // builder of the event: it is only valid within the event and is never
+  // written out.
+  class LazyTransientTrack {
+  public:
+    LazyTransientTrack() {}
+    // from a track of an event product, e.g. bestTrack() of an input object
+    LazyTransientTrack(const reco::Track *track, const MagneticField *field):
+      track_{track}, field_{field} {}
+    // from a GSF track, as TransientTrackBuilder::buildfromGSF
+    LazyTransientTrack(const TransientTrackBuilder *builder, const reco::GsfTrackRef &gsf):
+      builder_{builder}, gsf_{gsf} {}
+    // from a GSF track with the regressed momentum, as TransientTrackBuilder::buildfromReg
+    LazyTransientTrack(const TransientTrackBuilder *builder, const reco::GsfTrackRef &gsf,
+                       const math::XYZVector &momentum, float errorRatio):
+      builder_{builder}, gsf_{gsf}, momentum_{momentum}, error_ratio_{errorRatio}, regression_{true} {}
+    // already built, e.g. for a cut in the producer: kept in place, not
+    // copied to the heap
+    explicit LazyTransientTrack(reco::TransientTrack ttrack):
+      built_{std::move(ttrack)}, prebuilt_{true} {}
+
+    // thread safe, concurrent first calls may both build but one is kept
+    const reco::TransientTrack & get() const;
+    bool isBuilt() const { return prebuilt_ || cache_.isSet(); }
+
+  private:
+    const reco::Track * track_ = nullptr;
+    const MagneticField * field_ = nullptr;
+    const TransientTrackBuilder * builder_ = nullptr;
+    reco::GsfTrackRef gsf_;
+    math::XYZVector momentum_;
+    float error_ratio_ = 0.;
+    bool regression_ = false;
+    edm::AtomicPtrCache<reco::TransientTrack> cache_;
+    reco::TransientTrack built_;
+    bool prebuilt_ = false;
+  };
+
+  typedef std::vector<LazyTransientTrack> LazyTransientTrackCollection;
+}
+
+#endif
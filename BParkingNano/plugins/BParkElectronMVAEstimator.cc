@@ -0,0 +1,97 @@
+// Electron MVA estimator as ElectronMVAEstimatorRun2, with the same
+// configuration (categoryCuts, weightFileNames, variableDefinition), but
+// reading the forests in the binary format of bph::FlatForest: the weight
+// files are memory-mapped instead of parsed at the start of the job. The
+// binary files are made from the xml ones with convertBParkForest.
+
+#include "CommonTools/Utils/interface/StringCutObjectSelector.h"
+#include "DataFormats/EgammaCandidates/interface/GsfElectron.h"
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+#include "FWCore/ParameterSet/interface/FileInPath.h"
+#include "FWCore/ParameterSet/interface/ParameterSet.h"
+#include "FWCore/Utilities/interface/Exception.h"
+#include "PhysicsTools/BParkingNano/interface/FlatForest.h"
+#include "RecoEgamma/EgammaTools/interface/AnyMVAEstimatorRun2Base.h"
+#include "RecoEgamma/EgammaTools/interface/MVAVariableHelper.h"
+#include "RecoEgamma/EgammaTools/interface/MVAVariableManager.h"
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+class BParkElectronMVAEstimator : public AnyMVAEstimatorRun2Base {
+public:
+  explicit BParkElectronMVAEstimator(const edm::ParameterSet &conf);
+  ~BParkElectronMVAEstimator() override {}
+
+  float mvaValue(const reco::Candidate *candidate, std::vector<float> const &auxVariables, int &iCategory) const override;
+  int findCategory(const reco::Candidate *candidate) const override;
+
+private:
+  // bound on the forest inputs, for the per-call buffer on the stack
+  static constexpr size_t MAX_VARIABLES = 64;
+
+  const reco::GsfElectron & electron(const reco::Candidate *candidate) const {
+    const auto * ele = dynamic_cast<const reco::GsfElectron *>(candidate);
+    if(ele == nullptr)
+      throw cms::Exception("MVA failure") << "given candidate is not an electron";
+    return *ele;
+  }
+
+  MVAVariableManager<reco::GsfElectron> variables_;
+  std::vector<StringCutObjectSelector<reco::GsfElectron> > categories_;
+  std::vector<std::unique_ptr<const bph::FlatForest> > forests_;
+  // per category, indices in variables_ of the forest inputs
+  std::vector<std::vector<int> > indices_;
+};
+
+BParkElectronMVAEstimator::BParkElectronMVAEstimator(const edm::ParameterSet &conf):
+  AnyMVAEstimatorRun2Base(conf),
+  variables_(conf.getParameter<std::string>("variableDefinition"), MVAVariableHelper::indexMap()) {
+  const auto cuts = conf.getParameter<std::vector<std::string> >("categoryCuts");
+  const auto weights = conf.getParameter<std::vector<std::string> >("weightFileNames");
+  if(int(cuts.size()) != getNCategories() || int(weights.size()) != getNCategories())
+    throw cms::Exception("MVA config failure") << getTag() << ": " << getNCategories() << " categories, but "
+                                               << cuts.size() << " cuts and " << weights.size() << " weight files";
+
+  for(int icat = 0; icat < getNCategories(); ++icat) {
+    categories_.emplace_back(cuts[icat]);
+    forests_.emplace_back(new bph::FlatForest(edm::FileInPath(weights[icat]).fullPath()));
+    if(forests_.back()->variableNames().size() > MAX_VARIABLES)
+      throw cms::Exception("MVA config failure") << getTag() << ": " << weights[icat] << " has "
+                                                 << forests_.back()->variableNames().size() << " variables, at most "
+                                                 << MAX_VARIABLES << " are supported";
+    indices_.emplace_back();
+    for(const auto & name : forests_.back()->variableNames()) {
+      const int index = variables_.getVarIndex(name);
+      if(index < 0)
+        throw cms::Exception("MVA config failure") << getTag() << ": variable " << name << " of "
+                                                   << weights[icat] << " not defined";
+      indices_.back().push_back(index);
+    }
+  }
+}
+
+int BParkElectronMVAEstimator::findCategory(const reco::Candidate *candidate) const {
+  const reco::GsfElectron & ele = electron(candidate);
+  for(int icat = 0; icat < getNCategories(); ++icat) {
+    if(categories_[icat](ele)) return icat;
+  }
+  edm::LogWarning("MVA warning") << getTag() << ": electron not in any category";
+  return -1;
+}
+
+float BParkElectronMVAEstimator::mvaValue(const reco::Candidate *candidate, std::vector<float> const &auxVariables,
+                                          int &iCategory) const {
+  const reco::GsfElectron & ele = electron(candidate);
+  iCategory = findCategory(candidate);
+  if(iCategory < 0) return -999;
+
+  std::array<float, MAX_VARIABLES> vars;
+  const std::vector<int> & indices = indices_[iCategory];
+  for(size_t i = 0; i < indices.size(); ++i) vars[i] = variables_.getValue(indices[i], ele, auxVariables);
+  return forests_[iCategory]->response(vars.data());
+}
+
+DEFINE_EDM_PLUGIN(AnyMVAEstimatorRun2Factory, BParkElectronMVAEstimator, "BParkElectronMVAEstimator");
@@ -0,0 +1,133 @@
+// MVA value maps of the PF electrons, as ElectronMVAValueMapProducer, but
+// evaluated only for the electrons that can pass the preselection of
+// ElectronMerger: the same pT, eta and conversion veto cuts and, if the
+// merger filters the electrons, the dz window around the trigger leptons.
+// The pT cut is on the input electrons: it is disabled (mvaPtCut) when the
+// merger cuts on the regressed pT.
+// The dR cleaning wrt the trigger leptons is left out, the merger computes
+// it with its own electron direction (e.g. from the GSF track mode), so the
+// preselection can only be looser than the merger one.
+// The other electrons are skipped: SKIPPED as (raw) value, -1 as category.
+
+#include "FWCore/Framework/interface/global/EDProducer.h"
+#include "FWCore/Framework/interface/Event.h"
+#include "FWCore/ParameterSet/interface/ParameterSet.h"
+#include "FWCore/ParameterSet/interface/ConfigurationDescriptions.h"
+#include "FWCore/ParameterSet/interface/ParameterSetDescription.h"
+#include "FWCore/Utilities/interface/InputTag.h"
+#include "DataFormats/Common/interface/View.h"
+#include "DataFormats/Common/interface/ValueMap.h"
+#include "DataFormats/PatCandidates/interface/Electron.h"
+#include "RecoEgamma/EgammaTools/interface/AnyMVAEstimatorRun2Base.h"
+#include "RecoEgamma/EgammaTools/interface/MVAVariableHelper.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+class BParkElectronMVAValueMapProducer : public edm::global::EDProducer<> {
+
+public:
+  static constexpr float SKIPPED = -999.;
+
+  explicit BParkElectronMVAValueMapProducer(const edm::ParameterSet &cfg):
+    src_{consumes<edm::View<pat::Electron> >( cfg.getParameter<edm::InputTag>("src") )},
+    triggerLeptons_{consumes<edm::View<reco::Candidate> >( preselection(cfg).getParameter<edm::InputTag>("trgLepton") )},
+    ptMin_{preselection(cfg).getParameter<bool>("mvaPtCut") ?
+           std::max(preselection(cfg).getParameter<double>("ptMin"), preselection(cfg).getParameter<double>("pf_ptMin")) : -1.},
+    etaMax_{preselection(cfg).getParameter<double>("etaMax")},
+    dzTrg_cleaning_{preselection(cfg).getParameter<double>("dzForCleaning_wrtTrgLepton")},
+    filterEle_{preselection(cfg).getParameter<bool>("filterEle")},
+    variableHelper_{consumesCollector()} {
+      for(const auto & mva : cfg.getParameterSetVector("mvaConfigurations")) {
+        const std::string & name = mva.getParameter<std::string>("mvaName");
+        mvaEstimators_.emplace_back(AnyMVAEstimatorRun2Factory::get()->create(name, mva));
+        // same labels as ElectronMVAValueMapProducer
+        mvaNames_.push_back(name + mva.getParameter<std::string>("mvaTag"));
+        produces<edm::ValueMap<float> >(mvaNames_.back() + "Values");
+        produces<edm::ValueMap<float> >(mvaNames_.back() + "RawValues");
+        produces<edm::ValueMap<int> >(mvaNames_.back() + "Categories");
+      }
+    }
+
+  ~BParkElectronMVAValueMapProducer() override {}
+
+  void produce(edm::StreamID, edm::Event&, const edm::EventSetup&) const override;
+
+  static void fillDescriptions(edm::ConfigurationDescriptions &descriptions) {}
+
+private:
+  // the PSet of the merger preselection
+  static const edm::ParameterSet & preselection(const edm::ParameterSet &cfg) {
+    return cfg.getParameterSet("preselection");
+  }
+
+  // false if the electron is certainly dropped by the merger
+  bool preselected(const pat::Electron &ele, const edm::View<reco::Candidate> &trgLeptons) const {
+    if (ele.pt() < ptMin_ || std::abs(ele.eta()) > etaMax_ || !ele.passConversionVeto()) return false;
+    if (!filterEle_) return true;
+    // the merger needs at least one trigger lepton within dz
+    return std::any_of(trgLeptons.begin(), trgLeptons.end(), [&](const reco::Candidate &trg) {
+        return dzTrg_cleaning_ <= 0 || std::abs(ele.vz() - trg.vz()) <= dzTrg_cleaning_;
+      });
+  }
+
+  template<typename T>
+  static void put(edm::Event &evt, const edm::Handle<edm::View<pat::Electron> > &src,
+                  const std::vector<T> &values, const std::string &label) {
+    std::unique_ptr<edm::ValueMap<T> > map(new edm::ValueMap<T>());
+    typename edm::ValueMap<T>::Filler filler(*map);
+    filler.insert(src, values.begin(), values.end());
+    filler.fill();
+    evt.put(std::move(map), label);
+  }
+
+  const edm::EDGetTokenT<edm::View<pat::Electron> > src_;
+  const edm::EDGetTokenT<edm::View<reco::Candidate> > triggerLeptons_;
+  const double ptMin_;
+  const double etaMax_;
+  const double dzTrg_cleaning_;
+  const bool filterEle_;
+  const MVAVariableHelper variableHelper_;
+  std::vector<std::unique_ptr<AnyMVAEstimatorRun2Base> > mvaEstimators_;
+  std::vector<std::string> mvaNames_;
+};
+
+void BParkElectronMVAValueMapProducer::produce(edm::StreamID, edm::Event &evt, edm::EventSetup const &) const {
+
+  edm::Handle<edm::View<pat::Electron> > src;
+  evt.getByToken(src_, src);
+  edm::Handle<edm::View<reco::Candidate> > trgLeptons;
+  evt.getByToken(triggerLeptons_, trgLeptons);
+
+  const std::vector<float> auxVariables = variableHelper_.getAuxVariables(evt);
+
+  // decided once for all the MVAs
+  std::vector<char> evaluate;
+  evaluate.reserve(src->size());
+  for (const auto & ele : *src) evaluate.push_back(preselected(ele, *trgLeptons));
+
+  for (size_t imva = 0; imva < mvaEstimators_.size(); ++imva) {
+    std::vector<float> values(src->size(), SKIPPED);
+    std::vector<float> rawValues(src->size(), SKIPPED);
+    std::vector<int> categories(src->size(), -1);
+
+    for (size_t iele = 0; iele < src->size(); ++iele) {
+      if (!evaluate[iele]) continue;
+      int category = -1;
+      const float response = mvaEstimators_[imva]->mvaValue(&src->at(iele), auxVariables, category);
+      rawValues[iele] = response;
+      values[iele] = 2.0 / (1.0 + std::exp(-2.0 * response)) - 1; // between -1 and 1
+      categories[iele] = category;
+    }
+
+    put(evt, src, values, mvaNames_[imva] + "Values");
+    put(evt, src, rawValues, mvaNames_[imva] + "RawValues");
+    put(evt, src, categories, mvaNames_[imva] + "Categories");
+  }
+}
+
+#include "FWCore/Framework/interface/MakerMacros.h"
+DEFINE_FWK_MODULE(BParkElectronMVAValueMapProducer);
@@ -0,0 +1,1014 @@
+#include "BToLLChannels.h"
+
+#include "DataFormats/Math/interface/deltaR.h"
+#include "CommonTools/Statistics/interface/ChiSquaredProbability.h"
+#include "FWCore/Utilities/interface/Exception.h"
+#include <map>
+#include <algorithm>
+#include <iterator>
+#include "Kinematics.h"
+
+template<typename Composite>
+BToLLTrackSide<Composite>::BToLLTrackSide(const edm::ParameterSet &cfg, edm::ConsumesCollector iC, bool with_kaons):
+  with_kaons_{with_kaons},
+  beamspot_{iC.consumes<reco::BeamSpot>( cfg.getParameter<edm::InputTag>("beamSpot") )},
+  isotracksToken_{iC.consumes<pat::PackedCandidateCollection>(cfg.getParameter<edm::InputTag>("tracks"))},
+  isolostTracksToken_{iC.consumes<pat::PackedCandidateCollection>(cfg.getParameter<edm::InputTag>("lostTracks"))},
+  k_selection_{with_kaons ? cfg.getParameter<std::string>("kaonSelection") : std::string()},
+  isotrk_dca_selection_{with_kaons ? cfg.getParameter<std::string>("isoTracksDCASelection") : std::string()} {
+  if(with_kaons_) {
+    bFieldToken_ = iC.esConsumes<MagneticField, IdealMagneticFieldRecord>();
+    vertex_src_ = iC.consumes<reco::VertexCollection>( cfg.getParameter<edm::InputTag>("offlinePrimaryVertexSrc") );
+    kaons_ = iC.consumes<CompositeCollection>( cfg.getParameter<edm::InputTag>("kaons") );
+    kaons_ttracks_ = iC.consumes<TransientTrackCollection>( cfg.getParameter<edm::InputTag>("kaonsTransientTracks") );
+  }
+}
+
+template<typename Composite>
+size_t BToLLTrackSide<Composite>::registerIsolation(const std::string &selection) {
+  auto found = std::find(isotrk_cuts_.begin(), isotrk_cuts_.end(), selection);
+  if(found != isotrk_cuts_.end()) return found - isotrk_cuts_.begin();
+  isotrk_cuts_.push_back(selection);
+  isotrk_selections_.emplace_back(selection);
+  return isotrk_cuts_.size() - 1;
+}
+
+template<typename Composite>
+void BToLLTrackSide<Composite>::prepare(const edm::Event &evt, const edm::EventSetup &iSetup, Data &data) const {
+  evt.getByToken(beamspot_, data.beamspot);
+
+  //for isolation
+  evt.getByToken(isotracksToken_, data.iso_tracks);
+  evt.getByToken(isolostTracksToken_, data.iso_lostTracks);
+  data.isotrks.resize(isotrk_selections_.size());
+  for(size_t i = 0; i < isotrk_selections_.size(); ++i) {
+    data.isotrks[i].fill(*data.iso_tracks, *data.iso_lostTracks, isotrk_selections_[i]);
+  }
+
+  if(with_kaons_) {
+    evt.getByToken(vertex_src_, data.pvtxs);
+    data.bField = &iSetup.getData(bFieldToken_);
+
+    edm::Handle<CompositeCollection> kaons;
+    evt.getByToken(kaons_, kaons);
+    edm::Handle<TransientTrackCollection> kaons_ttracks;
+    evt.getByToken(kaons_ttracks_, kaons_ttracks);
+
+    KaonArrays & ks = data.ks;
+    ks.clear();
+    ks.reserve(kaons->size());
+    for(size_t k_idx = 0; k_idx < kaons->size(); ++k_idx) {
+      edm::Ptr<Composite> k_ptr(kaons, k_idx);
+      const edm::Ptr<reco::Candidate> k_cand = k_cand_.userCand(*k_ptr);
+      ks.ptr.push_back(k_ptr);
+      ks.selected.push_back(k_selection_(*k_ptr));
+      ks.dca_iso.push_back(isotrk_dca_selection_(*k_ptr));
+      ks.p4.emplace_back(k_ptr->pt(), k_ptr->eta(), k_ptr->phi(), K_MASS);
+      ks.charge.push_back(k_ptr->charge());
+      ks.pt.push_back(k_ptr->pt());
+      ks.eta.push_back(k_ptr->eta());
+      ks.phi.push_back(k_ptr->phi());
+      // only a kaon coming from the packed candidates can coincide with an isolation track
+      ks.cand_key.push_back(k_cand.id() == data.iso_tracks.id() ? k_cand.key() : KaonArrays::NO_KEY);
+      ks.key_packed.push_back(k_key_packed_.userInt(*k_ptr));
+      ks.ttrack.push_back(&kaons_ttracks->at(k_idx).get());
+    }
+  }
+}
+
+template class BToLLTrackSide<pat::CompositeCandidate>;
+template class BToLLTrackSide<bph::CompactCompositeCandidate>;
+
+namespace {
+  // One B -> K ll candidate in table mode, with the columns of BToKeeTable
+  struct BToKLLRow {
+    float pt, eta, phi, mass;
+    int pdgId, charge;
+    int l1Idx, l2Idx, kIdx;
+    float minDR, maxDR;
+    bool pre_vtx_sel, post_vtx_sel;
+    float svprob, l_xy, l_xy_unc;
+    float vtx_x, vtx_y, vtx_z, vtx_ex, vtx_ey, vtx_ez;
+    float mll_raw, mll_llfit, mllErr_llfit, mll_fullfit;
+    float cos2D, fit_cos2D;
+    float fit_mass, fit_massErr, fit_pt, fit_eta, fit_phi;
+    std::array<float, 3> fit_d_pt, fit_d_eta, fit_d_phi; // l1, l2, k
+    float D0_mass_LepToK_KToPi, D0_mass_LepToPi_KToK;
+    float k_svip2d, k_svip2d_err, k_svip3d, k_svip3d_err;
+    // isolation around l1, l2, k and b: all tracks, dca and tight dca
+    std::array<float, 4> iso03[3], iso04[3];
+    std::array<int, 4> n_isotrk[3];
+    int n_k_used, n_l1_used, n_l2_used;
+    int wp_mask;
+  };
+
+  template<typename T, typename Get>
+  void add_column_from(nanoaod::FlatTable &tab, const std::vector<BToKLLRow> &rows, const std::string &name,
+                       Get get, const std::string &doc = "", int precision = -1) {
+    std::vector<T> values;
+    values.reserve(rows.size());
+    for(const auto & row : rows) values.push_back(get(row));
+    tab.addColumn<T>(name, values, doc, precision);
+  }
+
+  template<typename T>
+  void add_column(nanoaod::FlatTable &tab, const std::vector<BToKLLRow> &rows, const std::string &name,
+                  T BToKLLRow::*member, const std::string &doc = "", int precision = -1) {
+    add_column_from<T>(tab, rows, name, [member](const BToKLLRow &row) { return row.*member; }, doc, precision);
+  }
+
+  std::unique_ptr<nanoaod::FlatTable> make_table(const std::vector<BToKLLRow> &rows,
+                                                 const std::string &name, const std::string &doc,
+                                                 const std::vector<edm::ParameterSet> &working_points) {
+    auto tab = std::make_unique<nanoaod::FlatTable>(rows.size(), name, false, false);
+    tab->setDoc(doc);
+    // pre-fit quantities
+    add_column(*tab, rows, "pt", &BToKLLRow::pt, "pt");
+    add_column(*tab, rows, "phi", &BToKLLRow::phi, "phi", 12);
+    add_column(*tab, rows, "eta", &BToKLLRow::eta, "eta", 12);
+    add_column(*tab, rows, "mass", &BToKLLRow::mass, "mass", 10);
+    add_column(*tab, rows, "pdgId", &BToKLLRow::pdgId, "PDG code assigned by the event reconstruction (not by MC truth)");
+    add_column(*tab, rows, "charge", &BToKLLRow::charge, "electric charge");
+    add_column(*tab, rows, "l1Idx", &BToKLLRow::l1Idx);
+    add_column(*tab, rows, "l2Idx", &BToKLLRow::l2Idx);
+    add_column(*tab, rows, "kIdx", &BToKLLRow::kIdx);
+    add_column(*tab, rows, "minDR", &BToKLLRow::minDR);
+    add_column(*tab, rows, "maxDR", &BToKLLRow::maxDR);
+    // pre-selection
+    add_column(*tab, rows, "pre_vtx_sel", &BToKLLRow::pre_vtx_sel, "Satisfies pre-vertexing selections?");
+    add_column(*tab, rows, "post_vtx_sel", &BToKLLRow::post_vtx_sel, "Satisfies post-vertexing selections?");
+    if(!working_points.empty()) add_column(*tab, rows, "wp_mask", &BToKLLRow::wp_mask, working_points_doc(working_points));
+    // fit and vtx info
+    add_column(*tab, rows, "svprob", &BToKLLRow::svprob);
+    add_column(*tab, rows, "l_xy", &BToKLLRow::l_xy);
+    add_column(*tab, rows, "l_xy_unc", &BToKLLRow::l_xy_unc);
+    add_column(*tab, rows, "vtx_x", &BToKLLRow::vtx_x);
+    add_column(*tab, rows, "vtx_y", &BToKLLRow::vtx_y);
+    add_column(*tab, rows, "vtx_z", &BToKLLRow::vtx_z);
+    add_column(*tab, rows, "vtx_ex", &BToKLLRow::vtx_ex);
+    add_column(*tab, rows, "vtx_ey", &BToKLLRow::vtx_ey);
+    add_column(*tab, rows, "vtx_ez", &BToKLLRow::vtx_ez);
+    // Mll
+    add_column(*tab, rows, "mll_raw", &BToKLLRow::mll_raw);
+    add_column(*tab, rows, "mll_llfit", &BToKLLRow::mll_llfit);
+    add_column(*tab, rows, "mllErr_llfit", &BToKLLRow::mllErr_llfit);
+    add_column(*tab, rows, "mll_fullfit", &BToKLLRow::mll_fullfit);
+    // Cos(theta)
+    add_column(*tab, rows, "cos2D", &BToKLLRow::cos2D);
+    add_column(*tab, rows, "fit_cos2D", &BToKLLRow::fit_cos2D);
+    // post-fit momentum
+    add_column(*tab, rows, "fit_mass", &BToKLLRow::fit_mass);
+    add_column(*tab, rows, "fit_massErr", &BToKLLRow::fit_massErr);
+    add_column(*tab, rows, "fit_pt", &BToKLLRow::fit_pt);
+    add_column(*tab, rows, "fit_eta", &BToKLLRow::fit_eta);
+    add_column(*tab, rows, "fit_phi", &BToKLLRow::fit_phi);
+    add_column(*tab, rows, "D0_mass_LepToK_KToPi", &BToKLLRow::D0_mass_LepToK_KToPi);
+    add_column(*tab, rows, "D0_mass_LepToPi_KToK", &BToKLLRow::D0_mass_LepToPi_KToK);
+    add_column(*tab, rows, "k_svip2d", &BToKLLRow::k_svip2d);
+    add_column(*tab, rows, "k_svip2d_err", &BToKLLRow::k_svip2d_err);
+    add_column(*tab, rows, "k_svip3d", &BToKLLRow::k_svip3d);
+    add_column(*tab, rows, "k_svip3d_err", &BToKLLRow::k_svip3d_err);
+    add_column(*tab, rows, "n_k_used", &BToKLLRow::n_k_used);
+    add_column(*tab, rows, "n_l1_used", &BToKLLRow::n_l1_used);
+    add_column(*tab, rows, "n_l2_used", &BToKLLRow::n_l2_used);
+
+    const char * daughters[3] = {"l1", "l2", "k"};
+    for(size_t d = 0; d < 3; ++d) {
+      const std::string prefix = std::string("fit_") + daughters[d];
+      add_column_from<float>(*tab, rows, prefix + "_pt" , [d](const BToKLLRow &r) { return r.fit_d_pt[d]; });
+      add_column_from<float>(*tab, rows, prefix + "_eta", [d](const BToKLLRow &r) { return r.fit_d_eta[d]; });
+      add_column_from<float>(*tab, rows, prefix + "_phi", [d](const BToKLLRow &r) { return r.fit_d_phi[d]; });
+    }
+
+    const char * axes[4] = {"l1", "l2", "k", "b"};
+    const char * cones[3] = {"", "_dca", "_dca_tight"};
+    for(size_t c = 0; c < 3; ++c) {
+      for(size_t a = 0; a < 4; ++a) {
+        const std::string axis = axes[a];
+        add_column_from<float>(*tab, rows, axis + "_iso03" + cones[c], [c, a](const BToKLLRow &r) { return r.iso03[c][a]; });
+        add_column_from<float>(*tab, rows, axis + "_iso04" + cones[c], [c, a](const BToKLLRow &r) { return r.iso04[c][a]; });
+        add_column_from<int>(*tab, rows, axis + "_n_isotrk" + cones[c], [c, a](const BToKLLRow &r) { return r.n_isotrk[c][a]; });
+      }
+    }
+    return tab;
+  }
+
+  // user data of the B -> K ll candidates
+  bph::CompactSchema kll_schema() {
+    std::vector<std::string> floats{
+      "min_dr", "max_dr", "sv_chi2", "sv_ndof", "sv_prob", "fitted_mll",
+      "fitted_pt", "fitted_eta", "fitted_phi", "fitted_mass", "fitted_massErr",
+      "cos_theta_2D", "fitted_cos_theta_2D", "l_xy", "l_xy_unc",
+      "vtx_x", "vtx_y", "vtx_z", "vtx_ex", "vtx_ey", "vtx_ez",
+      "fitted_l1_pt", "fitted_l1_eta", "fitted_l1_phi",
+      "fitted_l2_pt", "fitted_l2_eta", "fitted_l2_phi",
+      "fitted_k_pt", "fitted_k_eta", "fitted_k_phi",
+      "D0_mass_LepToK_KToPi", "D0_mass_LepToPi_KToK",
+      "k_svip2d", "k_svip2d_err", "k_svip3d", "k_svip3d_err",
+      "score"}; // set by the builder, if scoring is configured
+    std::vector<std::string> ints{
+      "l1_idx", "l2_idx", "k_idx", "pre_vtx_sel", "sv_OK", "post_vtx_sel", "wp_mask",
+      "n_k_used", "n_l1_used", "n_l2_used"};
+    const char * axes[4] = {"l1", "l2", "k", "b"};
+    const char * cones[3] = {"", "_dca", "_dca_tight"};
+    for(size_t c = 0; c < 3; ++c) {
+      for(size_t a = 0; a < 4; ++a) {
+        const std::string axis = axes[a];
+        floats.push_back(axis + "_iso03" + cones[c]);
+        floats.push_back(axis + "_iso04" + cones[c]);
+        ints.push_back(axis + "_n_isotrk" + cones[c]);
+      }
+    }
+    return bph::CompactSchema(floats, ints, {"l1", "l2", "K", "dilepton"});
+  }
+
+  // candidates kept along with the table
+  bph::CompactSchema kll_thin_schema() {
+    return bph::CompactSchema({}, {"l1_idx", "l2_idx", "k_idx"}, {"l1", "l2", "K", "dilepton"});
+  }
+
+  // user data read by the selections, the main ones and the working points
+  CutVariables kll_cut_variables(const edm::ParameterSet &cfg) {
+    CutVariables vars;
+    for(const char * name : {"preVtxSelection", "postVtxSelection"}) {
+      vars.add(cfg.getParameter<std::string>(name));
+      for(const auto & wp : working_points(cfg)) {
+        if(wp.existsAs<std::string>(name)) vars.add(wp.getParameter<std::string>(name));
+      }
+    }
+    return vars;
+  }
+
+  // user data of the B -> K* ll candidates
+  // fitted_<daughter>_pt/eta/phi of the K* ll daughters, in the fit order;
+  // built once instead of once per candidate
+  typedef std::array<std::array<std::string, 3>, 4> KstarLLFittedNames;
+  const KstarLLFittedNames & kstarll_fitted_names() {
+    static const KstarLLFittedNames names = [] {
+      KstarLLFittedNames names;
+      const char * daughters[4] = {"trk1", "trk2", "l1", "l2"};
+      for(size_t i = 0; i < 4; ++i) {
+        const std::string prefix = std::string("fitted_") + daughters[i];
+        names[i] = {{prefix + "_pt", prefix + "_eta", prefix + "_phi"}};
+      }
+      return names;
+    }();
+    return names;
+  }
+
+  bph::CompactSchema kstarll_schema() {
+    std::vector<std::string> floats{
+      "barMass", "min_dr", "max_dr", "sv_chi2", "sv_ndof", "sv_prob",
+      "fitted_kstar_mass", "fitted_kstar_pt", "fitted_kstar_eta", "fitted_kstar_phi", "fitted_mll",
+      "fitted_pt", "fitted_eta", "fitted_phi", "fitted_mass", "fitted_massErr",
+      "cos_theta_2D", "fitted_cos_theta_2D", "l_xy", "l_xy_unc",
+      "barMasskstar_fullfit", "fitted_barMass"};
+    for(const auto & names : kstarll_fitted_names()) floats.insert(floats.end(), names.begin(), names.end());
+    for(const char * axis : {"l1", "l2", "tk1", "tk2", "b"}) {
+      floats.push_back(std::string(axis) + "_iso03");
+      floats.push_back(std::string(axis) + "_iso04");
+    }
+    return bph::CompactSchema(floats,
+                              {"l1_idx", "l2_idx", "trk1_idx", "trk2_idx", "kstar_idx"},
+                              {"l1", "l2", "trk1", "trk2", "kstar", "dilepton"});
+  }
+}
+
+template<typename Lepton, typename Composite>
+BToKLLChannel<Lepton, Composite>::BToKLLChannel(const edm::ParameterSet &cfg, edm::ConsumesCollector iC,
+                                                BToLLTrackSide<Composite> &tracks, bool parallel):
+  filter_by_selection_{cfg.getParameter<bool>("filterBySelection")},
+  pre_vtx_selection_{cfg.getParameter<std::string>("preVtxSelection")},
+  post_vtx_selection_{cfg.getParameter<std::string>("postVtxSelection")},
+  working_points_{working_points(cfg)},
+  wp_pre_vtx_selection_{working_points_, "preVtxSelection"},
+  wp_post_vtx_selection_{working_points_, "postVtxSelection"},
+  dileptons_{iC.consumes<CompositeCollection>( cfg.getParameter<edm::InputTag>("dileptons") )},
+  dileptons_kinVtxs_{iC.consumes<std::vector<KinVtxFitter> >( cfg.getParameter<edm::InputTag>("dileptonKinVtxs") )},
+  leptons_{iC.consumes<LeptonCollection>( cfg.getParameter<edm::InputTag>("leptons") )},
+  leptons_ttracks_{iC.consumes<TransientTrackCollection>( cfg.getParameter<edm::InputTag>("leptonTransientTracks") )},
+  iso_index_{tracks.registerIsolation(cfg.getParameter<std::string>("isoTracksSelection"))},
+  isotrkDCACut_(cfg.getParameter<double>("isotrkDCACut")),
+  isotrkDCATightCut_(cfg.getParameter<double>("isotrkDCATightCut")),
+  drIso_cleaning_(cfg.getParameter<double>("drIso_cleaning")),
+  parallel_{parallel},
+  table_name_{cfg.existsAs<std::string>("tableName") ? cfg.getParameter<std::string>("tableName") : ""},
+  table_doc_{cfg.existsAs<std::string>("tableDoc") ? cfg.getParameter<std::string>("tableDoc") : ""},
+  factory_{kll_schema()},
+  thin_factory_{kll_thin_schema()},
+  cut_variables_{kll_cut_variables(cfg)} {}
+
+template<typename Lepton, typename Composite>
+std::unique_ptr<std::vector<Composite> >
+BToKLLChannel<Lepton, Composite>::build(const edm::Event &evt, const BToLLTrackData &shared,
+                                        BToKLLScratch &scratch,
+                                        std::unique_ptr<nanoaod::FlatTable> *table) const {
+
+  //input
+  edm::Handle<CompositeCollection> dileptons;
+  evt.getByToken(dileptons_, dileptons);
+  
+  edm::Handle<std::vector<KinVtxFitter> > dileptons_kinVtxs;
+  evt.getByToken(dileptons_kinVtxs_, dileptons_kinVtxs);
+
+  edm::Handle<LeptonCollection> leptons;
+  evt.getByToken(leptons_, leptons);
+
+  edm::Handle<TransientTrackCollection> leptons_ttracks;
+  evt.getByToken(leptons_ttracks_, leptons_ttracks);
+
+  // shared with the other channels
+  const auto & beamspot = shared.beamspot;
+  const auto & pvtxs = shared.pvtxs;
+  const MagneticField & bField = *shared.bField;
+  const KaonArrays & ks = shared.ks;
+  const nbody::IsoTracks & isotrks = shared.isotrks[iso_index_];
+  const edm::ProductIndex iso_tracks_id = shared.iso_tracks.id().id();
+
+  // preparation: everything the combinatorics needs from the inputs is
+  // extracted once per event into flat arrays, so that the loops below
+  // run without string-keyed user data lookups or edm::Ptr dereferencing
+
+  DileptonArrays & lls = scratch.lls;
+  lls.clear();
+  lls.reserve(dileptons->size());
+  for(size_t ll_idx = 0; ll_idx < dileptons->size(); ++ll_idx) {
+    edm::Ptr<Composite> ll_ptr(dileptons, ll_idx);
+    int l1_idx = ll_l1_idx_.userInt(*ll_ptr);
+    int l2_idx = ll_l2_idx_.userInt(*ll_ptr);
+    // same Ptrs as the dilepton l1/l2 user candidates, but typed
+    edm::Ptr<Lepton> l1_ptr(leptons, l1_idx);
+    edm::Ptr<Lepton> l2_ptr(leptons, l2_idx);
+    lls.ptr.push_back(ll_ptr);
+    lls.l1_ptr.push_back(l1_ptr);
+    lls.l2_ptr.push_back(l2_ptr);
+    lls.p4.push_back(ll_ptr->p4());
+    lls.mass.push_back(ll_ptr->mass());
+    lls.fitted_mass.push_back(ll_fitted_mass_.userFloat(*ll_ptr));
+    lls.fitted_massErr.push_back(ll_fitted_massErr_.userFloat(*ll_ptr));
+    lls.charge.push_back(ll_ptr->charge());
+    lls.l1_idx.push_back(l1_idx);
+    lls.l2_idx.push_back(l2_idx);
+    lls.l1_eta.push_back(l1_ptr->eta());
+    lls.l1_phi.push_back(l1_ptr->phi());
+    lls.l2_eta.push_back(l2_ptr->eta());
+    lls.l2_phi.push_back(l2_ptr->phi());
+    lls.l1_src_keys.push_back(lepton_source_keys(*l1_ptr, iso_tracks_id));
+    lls.l2_src_keys.push_back(lepton_source_keys(*l2_ptr, iso_tracks_id));
+    lls.l1_ttrack.push_back(&leptons_ttracks->at(l1_idx).get());
+    lls.l2_ttrack.push_back(&leptons_ttracks->at(l2_idx).get());
+    lls.kinVtx.push_back(&dileptons_kinVtxs->at(ll_idx));
+  }
+
+  // candidates, with the isolation buffers of the task; when the kaons are
+  // processed concurrently, one per kaon, appended back in order
+  struct KaonOutput {
+    CompositeCollection cands;
+    std::vector<BToKLLRow> rows; // table mode only
+    std::vector<int> used_lep1_id, used_lep2_id, used_trk_id;
+    std::vector<std::array<int, 3> > cand_idx; // l1, l2, k of the candidates
+    nbody::ConeBuffers cones;
+
+    void append(KaonOutput && other) {
+      cands.insert(cands.end(), std::make_move_iterator(other.cands.begin()), std::make_move_iterator(other.cands.end()));
+      rows.insert(rows.end(), other.rows.begin(), other.rows.end());
+      used_lep1_id.insert(used_lep1_id.end(), other.used_lep1_id.begin(), other.used_lep1_id.end());
+      used_lep2_id.insert(used_lep2_id.end(), other.used_lep2_id.begin(), other.used_lep2_id.end());
+      used_trk_id.insert(used_trk_id.end(), other.used_trk_id.begin(), other.used_trk_id.end());
+      cand_idx.insert(cand_idx.end(), other.cand_idx.begin(), other.cand_idx.end());
+    }
+  };
+  const bool write_table = table != nullptr;
+
+  const nbody::Combinatorics<2> combinatorics({{
+        {ks.size(), &ks.selected}, // kaon
+        {lls.size()}               // dilepton
+      }});
+
+  // the bookkeeping arrays keep their capacity in the scratch of the stream
+  KaonOutput all;
+  all.used_lep1_id.swap(scratch.used_lep1_id);
+  all.used_lep2_id.swap(scratch.used_lep2_id);
+  all.used_trk_id.swap(scratch.used_trk_id);
+  all.cand_idx.swap(scratch.cand_idx);
+  all.used_lep1_id.clear();
+  all.used_lep2_id.clear();
+  all.used_trk_id.clear();
+  all.cand_idx.clear();
+
+  combinatorics.run(parallel_, all, [&](const nbody::Indices<2> &idx, KaonOutput &out) {
+      const size_t k_idx  = idx[0];
+      const size_t ll_idx = idx[1];
+      int l1_idx = lls.l1_idx[ll_idx];
+      int l2_idx = lls.l2_idx[ll_idx];
+    
+      Composite cand = factory_.make();
+      // in table mode the variables go to the row, the candidate only gets
+      // the ones the selections read
+      auto set_float = [&](const char *name, float value) {
+        if(!write_table || cut_variables_.uses(name)) cand.addUserFloat(name, value);
+      };
+      auto set_int = [&](const char *name, int value) {
+        if(!write_table || cut_variables_.uses(name)) cand.addUserInt(name, value);
+      };
+      cand.setP4(lls.p4[ll_idx] + ks.p4[k_idx]);
+      cand.setCharge(lls.charge[ll_idx] + ks.charge[k_idx]);
+      // Use UserCands as they should not use memory but keep the Ptr itself
+      // Put the lepton passing the corresponding selection
+      cand.addUserCand("l1", lls.l1_ptr[ll_idx]);
+      cand.addUserCand("l2", lls.l2_ptr[ll_idx]);
+      cand.addUserCand("K", ks.ptr[k_idx]);
+      cand.addUserCand("dilepton", lls.ptr[ll_idx]);
+
+      set_int("l1_idx", l1_idx);
+      set_int("l2_idx", l2_idx);
+      set_int("k_idx", k_idx);
+    
+      auto dr_info = min_max_dr<3>({{
+            {lls.l1_eta[ll_idx], lls.l1_phi[ll_idx]},
+            {lls.l2_eta[ll_idx], lls.l2_phi[ll_idx]},
+            {ks.eta[k_idx], ks.phi[k_idx]}
+          }});
+      set_float("min_dr", dr_info.first);
+      set_float("max_dr", dr_info.second);
+      
+      bool pre_vtx_sel = pre_vtx_selection_(cand);
+      set_int("pre_vtx_sel",pre_vtx_sel);
+      if( filter_by_selection_ && !pre_vtx_sel ) return;
+      const size_t n_wps = working_points_.size();
+      uint32_t wp_failed = n_wps > 0 ? wp_pre_vtx_selection_.failed(cand, pre_vtx_sel) : 0;
+    
+      KinVtxFitter fitter = nbody::fit<3>(
+        {{lls.l1_ttrack[ll_idx], lls.l2_ttrack[ll_idx], ks.ttrack[k_idx]}},
+        {{LEPTON_MASS, LEPTON_MASS, K_MASS}},
+        {{LEP_SIGMA, LEP_SIGMA, K_SIGMA}} //some small sigma for the lepton mass
+        );
+      if(!fitter.success()) return; // hardcoded, but do we need otherwise?
+      cand.setVertex( 
+        reco::Candidate::Point( 
+          fitter.fitted_vtx().x(),
+          fitter.fitted_vtx().y(),
+          fitter.fitted_vtx().z()
+          )  
+        );
+      out.used_lep1_id.emplace_back(l1_idx);
+      out.used_lep2_id.emplace_back(l2_idx);
+      out.used_trk_id.emplace_back(k_idx);
+      set_int("sv_OK" , fitter.success());
+      set_float("sv_chi2", fitter.chi2());
+      set_float("sv_ndof", fitter.dof()); // float??
+      set_float("sv_prob", fitter.prob());
+      const float fitted_mll = (fitter.daughter_p4(0) + fitter.daughter_p4(1)).mass();
+      set_float("fitted_mll" , fitted_mll);
+      auto fit_p4 = fitter.fitted_p4();
+      set_float("fitted_pt"  , fit_p4.pt()); 
+      set_float("fitted_eta" , fit_p4.eta());
+      set_float("fitted_phi" , fit_p4.phi());
+      const float fitted_mass = fitter.fitted_candidate().mass();
+      const float fitted_massErr = sqrt(fitter.fitted_candidate().kinematicParametersError().matrix()(6,6));
+      set_float("fitted_mass", fitted_mass);      
+      set_float("fitted_massErr", fitted_massErr);      
+      const float cos2D = cos_theta_2D(fitter, *beamspot, cand.p4());
+      const float fit_cos2D = cos_theta_2D(fitter, *beamspot, fit_p4);
+      set_float("cos_theta_2D", cos2D);
+      set_float("fitted_cos_theta_2D", fit_cos2D);
+      auto lxy = l_xy(fitter, *beamspot);
+      set_float("l_xy", lxy.value());
+      set_float("l_xy_unc", lxy.error());
+      set_float("vtx_x", cand.vx());
+      set_float("vtx_y", cand.vy());
+      set_float("vtx_z", cand.vz());
+      const float vtx_ex = sqrt(fitter.fitted_vtx_uncertainty().cxx());
+      const float vtx_ey = sqrt(fitter.fitted_vtx_uncertainty().cyy());
+      const float vtx_ez = sqrt(fitter.fitted_vtx_uncertainty().czz());
+      set_float("vtx_ex", vtx_ex);
+      set_float("vtx_ey", vtx_ey);
+      set_float("vtx_ez", vtx_ez);
+
+      const nbody::FittedDaughters<3> fitted(fitter); // l1, l2, k
+      set_float("fitted_l1_pt" , fitted.pt[0]); 
+      set_float("fitted_l1_eta", fitted.eta[0]);
+      set_float("fitted_l1_phi", fitted.phi[0]);
+      set_float("fitted_l2_pt" , fitted.pt[1]); 
+      set_float("fitted_l2_eta", fitted.eta[1]);
+      set_float("fitted_l2_phi", fitted.phi[1]);
+      set_float("fitted_k_pt"  , fitted.pt[2]); 
+      set_float("fitted_k_eta" , fitted.eta[2]);
+      set_float("fitted_k_phi" , fitted.phi[2]);
+
+      // Anti-Do variables
+      // From: https://github.com/gkaratha/cmgtools-lite/blob/1d02c82/RKAnalysis/python/tools/nanoAOD/UserFunctions.py#L382-L395
+      // the lepton of charge opposite to the kaon takes the kaon mass; for
+      // same-sign leptons, the subleading one
+      typedef kin::P4<double> P4;
+      const size_t lep_idx = fitter.fitted_daughter(0).particleCharge() != fitter.fitted_daughter(2).particleCharge() ? 0 : 1;
+      const GlobalVector lep_p = fitter.daughter_momentum(lep_idx);
+      const GlobalVector kaon_p = fitter.daughter_momentum(2);
+      float mass1 = (P4::from_momentum(lep_p, kin::ANTI_D0_K_MASS) + P4::from_momentum(kaon_p, kin::ANTI_D0_PI_MASS)).mass(); // mass(K-->pi,e-->K)
+      float mass2 = (P4::from_momentum(lep_p, kin::ANTI_D0_PI_MASS) + P4::from_momentum(kaon_p, kin::ANTI_D0_K_MASS)).mass(); // mass(K-->K,e-->pi)
+      set_float("D0_mass_LepToK_KToPi",mass1);
+      set_float("D0_mass_LepToPi_KToK",mass2);
+
+      // one extrapolator per candidate, the propagator is not meant to be shared across tasks
+      AnalyticalImpactPointExtrapolator extrapolator(&bField);
+
+      // kaon 3D impact parameter from dilepton SV
+      TrajectoryStateOnSurface tsos = extrapolator.extrapolate(ks.ttrack[k_idx]->impactPointState(), lls.kinVtx[ll_idx]->fitted_vtx());
+      std::pair<bool,Measurement1D> cur2DIP = signedTransverseImpactParameter(tsos, lls.kinVtx[ll_idx]->fitted_refvtx(), *beamspot);
+      std::pair<bool,Measurement1D> cur3DIP = signedImpactParameter3D(tsos, lls.kinVtx[ll_idx]->fitted_refvtx(), *beamspot, (*pvtxs)[0].position().z());
+
+      set_float("k_svip2d" , cur2DIP.second.value());
+      set_float("k_svip2d_err" , cur2DIP.second.error());
+      set_float("k_svip3d" , cur3DIP.second.value());
+      set_float("k_svip3d_err" , cur3DIP.second.error());
+
+      bool post_vtx_sel = post_vtx_selection_(cand);
+      set_int("post_vtx_sel",post_vtx_sel);
+      if( filter_by_selection_ && !post_vtx_sel ) return;
+      int wp_mask = 0;
+      if(n_wps > 0) {
+        wp_failed |= wp_post_vtx_selection_.failed(cand, post_vtx_sel);
+        wp_mask = working_point_mask(n_wps, wp_failed);
+        set_int("wp_mask", wp_mask);
+      }
+
+      const std::vector<unsigned int> & l1_src_keys = lls.l1_src_keys[ll_idx];
+      const std::vector<unsigned int> & l2_src_keys = lls.l2_src_keys[ll_idx];
+      auto is_lepton_source = [&](unsigned int key) {
+        return std::find(l1_src_keys.begin(), l1_src_keys.end(), key) != l1_src_keys.end() ||
+               std::find(l2_src_keys.begin(), l2_src_keys.end(), key) != l2_src_keys.end();
+      };
+      // cross clean leptons
+      // hard to trace the source particles of low-pT electron in B builder
+      // use simple dR cut instead
+      const double l1_eta = lls.l1_eta[ll_idx], l1_phi = lls.l1_phi[ll_idx];
+      const double l2_eta = lls.l2_eta[ll_idx], l2_phi = lls.l2_phi[ll_idx];
+      const bool dr_cleaning = drIso_cleaning_ > 0.;
+      auto is_close_to_leptons = [&](double trk_eta, double trk_phi) {
+        if(!dr_cleaning) return false;
+        float dr_to_l1_prefit = deltaR(l1_eta, l1_phi, trk_eta, trk_phi);
+        float dr_to_l2_prefit = deltaR(l2_eta, l2_phi, trk_eta, trk_phi);
+        return (dr_to_l1_prefit < drIso_cleaning_) || (dr_to_l2_prefit < drIso_cleaning_);
+      };
+
+      // isolation cones around l1, l2, k and b
+      const std::array<float, 4> axes_eta{{fitted.eta[0], fitted.eta[1], fitted.eta[2], float(fit_p4.eta())}};
+      const std::array<float, 4> axes_phi{{fitted.phi[0], fitted.phi[1], fitted.phi[2], float(fit_p4.phi())}};
+
+      //compute isolation
+      const size_t n_isotrks = isotrks.size();
+      nbody::ConeBuffers & cones = out.cones;
+      cones.resize(n_isotrks);
+      if(dr_cleaning) {
+        // tracks close to the leptons, one lepton at a time over the array
+        const float dr2_cleaning = drIso_cleaning_*drIso_cleaning_;
+        const std::array<std::pair<float, float>, 2> lep_axes{{{l1_eta, l1_phi}, {l2_eta, l2_phi}}};
+        for(const auto & axis : lep_axes) {
+          kin::deltaR2(axis.first, axis.second, isotrks.eta.data(), isotrks.phi.data(), n_isotrks, cones.dr2.data());
+          for( size_t i = 0; i < n_isotrks; ++i ) cones.skip[i] |= cones.dr2[i] < dr2_cleaning;
+        }
+      }
+      for( size_t i = 0; i < n_isotrks; ++i ) {
+        const unsigned int iTrk = isotrks.key[i];
+        // check if the track is the kaon or one of the two leptons
+        if (ks.cand_key[k_idx] == iTrk || is_lepton_source(iTrk)) cones.skip[i] = 1;
+      }
+      nbody::ConeIsolation<4> iso(axes_eta, axes_phi);
+      iso.add(n_isotrks, isotrks.eta.data(), isotrks.phi.data(), isotrks.pt.data(), cones.skip.data(), cones.dr2.data());
+
+      //compute isolation from surrounding tracks only
+      nbody::ConeIsolation<4> iso_dca(axes_eta, axes_phi);
+      nbody::ConeIsolation<4> iso_dca_tight(axes_eta, axes_phi);
+      for(size_t trk_idx = 0; trk_idx < ks.size(); ++trk_idx) {
+        // corss clean kaon
+        if (trk_idx == k_idx) continue;
+        if( !ks.dca_iso[trk_idx] ) continue;
+        // cross clean PF (electron and muon)
+        if (is_lepton_source(ks.key_packed[trk_idx])) continue;
+        if (is_close_to_leptons(ks.eta[trk_idx], ks.phi[trk_idx])) continue;
+
+        TrajectoryStateOnSurface tsos_iso = extrapolator.extrapolate(ks.ttrack[trk_idx]->impactPointState(), fitter.fitted_vtx());
+        std::pair<bool,Measurement1D> cur3DIP_iso = absoluteImpactParameter3D(tsos_iso, fitter.fitted_refvtx());
+        float svip_iso = cur3DIP_iso.second.value();
+        if (cur3DIP_iso.first && svip_iso < isotrkDCACut_) {
+          // add to final particle iso if dR < cone
+          iso_dca.add(ks.pt[trk_idx], ks.eta[trk_idx], ks.phi[trk_idx]);
+          if (svip_iso < isotrkDCATightCut_) iso_dca_tight.add(ks.pt[trk_idx], ks.eta[trk_idx], ks.phi[trk_idx]);
+        }
+      }
+
+      if(write_table) {
+        // the table gets all the variables, the candidate only what is needed downstream
+        BToKLLRow row;
+        row.pt = cand.pt(); row.eta = cand.eta(); row.phi = cand.phi(); row.mass = cand.mass();
+        row.pdgId = cand.pdgId(); row.charge = cand.charge();
+        row.l1Idx = l1_idx; row.l2Idx = l2_idx; row.kIdx = k_idx;
+        row.minDR = dr_info.first; row.maxDR = dr_info.second;
+        row.pre_vtx_sel = pre_vtx_sel; row.post_vtx_sel = post_vtx_sel;
+        row.wp_mask = wp_mask;
+        row.svprob = fitter.prob();
+        row.l_xy = lxy.value(); row.l_xy_unc = lxy.error();
+        row.vtx_x = cand.vx(); row.vtx_y = cand.vy(); row.vtx_z = cand.vz();
+        row.vtx_ex = vtx_ex; row.vtx_ey = vtx_ey; row.vtx_ez = vtx_ez;
+        row.mll_raw = lls.mass[ll_idx];
+        row.mll_llfit = lls.fitted_mass[ll_idx];
+        row.mllErr_llfit = lls.fitted_massErr[ll_idx];
+        row.mll_fullfit = fitted_mll;
+        row.cos2D = cos2D; row.fit_cos2D = fit_cos2D;
+        row.fit_mass = fitted_mass; row.fit_massErr = fitted_massErr;
+        row.fit_pt = fit_p4.pt(); row.fit_eta = fit_p4.eta(); row.fit_phi = fit_p4.phi();
+        row.fit_d_pt = fitted.pt; row.fit_d_eta = fitted.eta; row.fit_d_phi = fitted.phi;
+        row.D0_mass_LepToK_KToPi = mass1; row.D0_mass_LepToPi_KToK = mass2;
+        row.k_svip2d = cur2DIP.second.value(); row.k_svip2d_err = cur2DIP.second.error();
+        row.k_svip3d = cur3DIP.second.value(); row.k_svip3d_err = cur3DIP.second.error();
+        const nbody::ConeIsolation<4> * cones[3] = {&iso, &iso_dca, &iso_dca_tight};
+        for(size_t i = 0; i < 3; ++i) {
+          row.iso03[i] = cones[i]->iso03;
+          row.iso04[i] = cones[i]->iso04;
+          row.n_isotrk[i] = cones[i]->n_isotrk;
+        }
+        out.rows.push_back(row);
+
+        Composite thin = thin_factory_.make();
+        thin.setP4(cand.p4());
+        thin.setCharge(cand.charge());
+        thin.setVertex(cand.vertex());
+        thin.addUserCand("l1", lls.l1_ptr[ll_idx]);
+        thin.addUserCand("l2", lls.l2_ptr[ll_idx]);
+        thin.addUserCand("K", ks.ptr[k_idx]);
+        thin.addUserCand("dilepton", lls.ptr[ll_idx]);
+        thin.addUserInt("l1_idx", l1_idx);
+        thin.addUserInt("l2_idx", l2_idx);
+        thin.addUserInt("k_idx", k_idx);
+        out.cands.push_back(std::move(thin));
+        out.cand_idx.push_back({{l1_idx, l2_idx, int(k_idx)}});
+        return;
+      }
+
+      cand.addUserFloat("l1_iso03", iso.iso03[0]);
+      cand.addUserFloat("l1_iso04", iso.iso04[0]);
+      cand.addUserFloat("l2_iso03", iso.iso03[1]);
+      cand.addUserFloat("l2_iso04", iso.iso04[1]);
+      cand.addUserFloat("k_iso03" , iso.iso03[2]);
+      cand.addUserFloat("k_iso04" , iso.iso04[2]);
+      cand.addUserFloat("b_iso03" , iso.iso03[3]);
+      cand.addUserFloat("b_iso04" , iso.iso04[3]);
+      cand.addUserInt("l1_n_isotrk", iso.n_isotrk[0]);
+      cand.addUserInt("l2_n_isotrk", iso.n_isotrk[1]);
+      cand.addUserInt("k_n_isotrk" , iso.n_isotrk[2]);
+      cand.addUserInt("b_n_isotrk" , iso.n_isotrk[3]);
+
+      cand.addUserFloat("l1_iso03_dca", iso_dca.iso03[0]);
+      cand.addUserFloat("l1_iso04_dca", iso_dca.iso04[0]);
+      cand.addUserFloat("l2_iso03_dca", iso_dca.iso03[1]);
+      cand.addUserFloat("l2_iso04_dca", iso_dca.iso04[1]);
+      cand.addUserFloat("k_iso03_dca" , iso_dca.iso03[2]);
+      cand.addUserFloat("k_iso04_dca" , iso_dca.iso04[2]);
+      cand.addUserFloat("b_iso03_dca" , iso_dca.iso03[3]);
+      cand.addUserFloat("b_iso04_dca" , iso_dca.iso04[3]);
+      cand.addUserInt("l1_n_isotrk_dca", iso_dca.n_isotrk[0]);
+      cand.addUserInt("l2_n_isotrk_dca", iso_dca.n_isotrk[1]);
+      cand.addUserInt("k_n_isotrk_dca" , iso_dca.n_isotrk[2]);
+      cand.addUserInt("b_n_isotrk_dca" , iso_dca.n_isotrk[3]);
+
+      cand.addUserFloat("l1_iso03_dca_tight", iso_dca_tight.iso03[0]);
+      cand.addUserFloat("l1_iso04_dca_tight", iso_dca_tight.iso04[0]);
+      cand.addUserFloat("l2_iso03_dca_tight", iso_dca_tight.iso03[1]);
+      cand.addUserFloat("l2_iso04_dca_tight", iso_dca_tight.iso04[1]);
+      cand.addUserFloat("k_iso03_dca_tight" , iso_dca_tight.iso03[2]);
+      cand.addUserFloat("k_iso04_dca_tight" , iso_dca_tight.iso04[2]);
+      cand.addUserFloat("b_iso03_dca_tight" , iso_dca_tight.iso03[3]);
+      cand.addUserFloat("b_iso04_dca_tight" , iso_dca_tight.iso04[3]);
+      cand.addUserInt("l1_n_isotrk_dca_tight", iso_dca_tight.n_isotrk[0]);
+      cand.addUserInt("l2_n_isotrk_dca_tight", iso_dca_tight.n_isotrk[1]);
+      cand.addUserInt("k_n_isotrk_dca_tight" , iso_dca_tight.n_isotrk[2]);
+      cand.addUserInt("b_n_isotrk_dca_tight" , iso_dca_tight.n_isotrk[3]);
+
+      out.cands.push_back(std::move(cand));
+      out.cand_idx.push_back({{l1_idx, l2_idx, int(k_idx)}});
+    });
+
+  // output
+  std::unique_ptr<CompositeCollection> ret_val(new CompositeCollection(std::move(all.cands)));
+  std::vector<BToKLLRow> & rows = all.rows;
+  const std::vector<int> & used_lep1_id = all.used_lep1_id;
+  const std::vector<int> & used_lep2_id = all.used_lep2_id;
+  const std::vector<int> & used_trk_id = all.used_trk_id;
+  const std::vector<std::array<int, 3> > & cand_idx = all.cand_idx;
+
+  for (size_t i = 0; i < ret_val->size(); ++i){
+    auto & cand = (*ret_val)[i];
+    const int l1_idx = cand_idx[i][0], l2_idx = cand_idx[i][1], k_idx = cand_idx[i][2];
+    int n_k_used = std::count(used_trk_id.begin(),used_trk_id.end(),k_idx);
+    int n_l1_used = std::count(used_lep1_id.begin(),used_lep1_id.end(),l1_idx)+std::count(used_lep2_id.begin(),used_lep2_id.end(),l1_idx);
+    int n_l2_used = std::count(used_lep1_id.begin(),used_lep1_id.end(),l2_idx)+std::count(used_lep2_id.begin(),used_lep2_id.end(),l2_idx);
+    if(write_table) {
+      rows[i].n_k_used = n_k_used;
+      rows[i].n_l1_used = n_l1_used;
+      rows[i].n_l2_used = n_l2_used;
+    } else {
+      cand.addUserInt("n_k_used", n_k_used);
+      cand.addUserInt("n_l1_used", n_l1_used);
+      cand.addUserInt("n_l2_used", n_l2_used);
+    }
+  }
+
+  if(write_table) *table = make_table(rows, table_name_, table_doc_, working_points_);
+
+  all.used_lep1_id.swap(scratch.used_lep1_id);
+  all.used_lep2_id.swap(scratch.used_lep2_id);
+  all.used_trk_id.swap(scratch.used_trk_id);
+  all.cand_idx.swap(scratch.cand_idx);
+  return ret_val;
+}
+
+template class BToKLLChannel<pat::Electron, pat::CompositeCandidate>;
+template class BToKLLChannel<pat::Muon, pat::CompositeCandidate>;
+template class BToKLLChannel<pat::Electron, bph::CompactCompositeCandidate>;
+template class BToKLLChannel<pat::Muon, bph::CompactCompositeCandidate>;
+template class BToKLLChannel<bph::ElectronOverlay, pat::CompositeCandidate>;
+template class BToKLLChannel<bph::ElectronOverlay, bph::CompactCompositeCandidate>;
+
+template<typename Composite>
+BToKstarLLChannel<Composite>::BToKstarLLChannel(const edm::ParameterSet &cfg, edm::ConsumesCollector iC,
+                                                BToLLTrackSide<Composite> &tracks, bool parallel):
+  // selections
+  pre_vtx_selection_{cfg.getParameter<std::string>("preVtxSelection")},
+  post_vtx_selection_{cfg.getParameter<std::string>("postVtxSelection")},
+  //inputs
+  dileptons_{iC.consumes<CompositeCollection>( cfg.getParameter<edm::InputTag>("dileptons") )},
+  kstars_{iC.consumes<CompositeCollection>( cfg.getParameter<edm::InputTag>("kstars") )},
+  leptons_ttracks_{iC.consumes<TransientTrackCollection>( cfg.getParameter<edm::InputTag>("leptonTransientTracks") )},
+  kstars_ttracks_{iC.consumes<TransientTrackCollection>( cfg.getParameter<edm::InputTag>("kstarsTransientTracks") )},
+  iso_index_{tracks.registerIsolation(cfg.getParameter<std::string>("isoTracksSelection"))},
+  parallel_{parallel},
+  factory_{kstarll_schema()} {
+  if(cfg.existsAs<edm::InputTag>("compatibleDileptons"))
+    compatible_lls_ = iC.consumes<std::vector<std::vector<int> > >( cfg.getParameter<edm::InputTag>("compatibleDileptons") );
+}
+
+template<typename Composite>
+std::unique_ptr<std::vector<Composite> >
+BToKstarLLChannel<Composite>::build(const edm::Event &evt, const BToLLTrackData &shared) const {
+
+  //input
+  edm::Handle<CompositeCollection> dileptons;
+  evt.getByToken(dileptons_, dileptons);  
+  edm::Handle<TransientTrackCollection> leptons_ttracks;
+  evt.getByToken(leptons_ttracks_, leptons_ttracks);
+
+  edm::Handle<CompositeCollection> kstars;
+  evt.getByToken(kstars_, kstars);  
+  edm::Handle<TransientTrackCollection> kstars_ttracks;
+  evt.getByToken(kstars_ttracks_, kstars_ttracks);   
+
+  // shared with the other channels
+  const auto & beamspot = shared.beamspot;
+  const auto & iso_tracks = shared.iso_tracks;
+  const nbody::IsoTracks & isotrks = shared.isotrks[iso_index_];
+  const edm::ProductIndex iso_tracks_id = iso_tracks.id().id();
+  // a daughter coincides with an isolation track only if it is a packed candidate
+  auto packed_key = [&](const edm::Ptr<reco::Candidate> &ptr) {
+    return ptr.id() == iso_tracks.id() ? ptr.key() : std::numeric_limits<size_t>::max();
+  };
+
+  // per-K* and per-dilepton inputs, read once instead of once per combination
+  struct KstarInfo {
+    edm::Ptr<Composite> ptr;
+    edm::Ptr<reco::Candidate> trk1_ptr, trk2_ptr;
+    int trk1_idx, trk2_idx;
+    size_t trk1_key, trk2_key;
+    // K* four-momentum under the second mass hypothesis
+    kin::P4<double> barP4;
+  };
+  std::vector<KstarInfo> kstar_infos;
+  kstar_infos.reserve(kstars->size());
+  for(size_t kstar_idx = 0; kstar_idx < kstars->size(); ++kstar_idx) {
+    KstarInfo info;
+    info.ptr = edm::Ptr<Composite>(kstars, kstar_idx);
+    info.trk1_ptr = kstar_trk1_.userCand(*info.ptr);
+    info.trk2_ptr = kstar_trk2_.userCand(*info.ptr);
+    info.trk1_idx = kstar_trk1_idx_.userInt(*info.ptr);
+    info.trk2_idx = kstar_trk2_idx_.userInt(*info.ptr);
+    info.trk1_key = packed_key(info.trk1_ptr);
+    info.trk2_key = packed_key(info.trk2_ptr);
+    info.barP4 = kin::P4<double>::with_mass(info.ptr->p4(), kstar_barMass_.userFloat(*info.ptr));
+    kstar_infos.push_back(info);
+  }
+
+  struct DileptonInfo {
+    edm::Ptr<Composite> ptr;
+    edm::Ptr<reco::Candidate> l1_ptr, l2_ptr;
+    int l1_idx, l2_idx;
+    std::vector<unsigned int> src_keys; // packed candidates keys of the lepton sources
+  };
+  std::vector<DileptonInfo> ll_infos;
+  ll_infos.reserve(dileptons->size());
+  for(size_t ll_idx = 0; ll_idx < dileptons->size(); ++ll_idx) {
+    DileptonInfo info;
+    info.ptr = edm::Ptr<Composite>(dileptons, ll_idx);
+    info.l1_ptr = ll_l1_.userCand(*info.ptr);
+    info.l2_ptr = ll_l2_.userCand(*info.ptr);
+    info.l1_idx = ll_l1_idx_.userInt(*info.ptr);
+    info.l2_idx = ll_l2_idx_.userInt(*info.ptr);
+    info.src_keys = lepton_source_keys(*info.l1_ptr, iso_tracks_id);
+    auto l2_keys = lepton_source_keys(*info.l2_ptr, iso_tracks_id);
+    info.src_keys.insert(info.src_keys.end(), l2_keys.begin(), l2_keys.end());
+    ll_infos.push_back(info);
+  }
+  const KstarLLFittedNames & fitted_names = kstarll_fitted_names();
+
+  // lepton-seeded K*: each one only with the dileptons it was built around
+  nbody::Slot ll_slot{ll_infos.size()};
+  edm::Handle<std::vector<std::vector<int> > > compatible_lls;
+  if(!compatible_lls_.isUninitialized()) {
+    evt.getByToken(compatible_lls_, compatible_lls);
+    if(compatible_lls->size() != kstar_infos.size())
+      throw cms::Exception("Configuration") << "compatibleDileptons: " << compatible_lls->size()
+                                            << " entries for " << kstar_infos.size() << " K*";
+    for(const auto & lls : *compatible_lls) {
+      for(int ll_idx : lls) {
+        if(ll_idx < 0 || size_t(ll_idx) >= ll_infos.size())
+          throw cms::Exception("Configuration") << "compatibleDileptons: dilepton " << ll_idx << " for "
+                                                << ll_infos.size() << " dileptons, not the ones seeding the K*";
+      }
+    }
+    ll_slot.within = 0;
+    ll_slot.compatible = compatible_lls.product();
+  }
+
+  // both k* and lep pair already passed cuts; no need for more preselection
+  const nbody::Combinatorics<2> combinatorics({{
+        {kstar_infos.size()}, // K*, one buffer per K*
+        ll_slot               // dilepton
+      }});
+
+  // candidates, with the isolation buffers of the task; when the K* are
+  // processed concurrently, one per K*, appended back in order
+  struct KstarOutput {
+    CompositeCollection cands;
+    nbody::ConeBuffers cones;
+
+    void append(KstarOutput && other) {
+      cands.insert(cands.end(), std::make_move_iterator(other.cands.begin()), std::make_move_iterator(other.cands.end()));
+    }
+  };
+
+  KstarOutput all;
+  combinatorics.run(
+    parallel_, all, [&](const nbody::Indices<2> &idx, KstarOutput &out) {
+      const size_t kstar_idx = idx[0];
+      const KstarInfo & kstar = kstar_infos[kstar_idx];
+      const DileptonInfo & ll = ll_infos[idx[1]];
+      const edm::Ptr<Composite> & kstar_ptr = kstar.ptr;
+      const edm::Ptr<Composite> & ll_ptr = ll.ptr;
+      const edm::Ptr<reco::Candidate> & trk1_ptr = kstar.trk1_ptr;
+      const edm::Ptr<reco::Candidate> & trk2_ptr = kstar.trk2_ptr;
+      const edm::Ptr<reco::Candidate> & l1_ptr = ll.l1_ptr;
+      const edm::Ptr<reco::Candidate> & l2_ptr = ll.l2_ptr;
+      int trk1_idx = kstar.trk1_idx;
+      int trk2_idx = kstar.trk2_idx;
+      int l1_idx = ll.l1_idx;
+      int l2_idx = ll.l2_idx;
+
+      // B0 candidate
+      Composite cand = factory_.make();
+      cand.setP4(ll_ptr->p4() + kstar_ptr->p4());
+      cand.setCharge( 0 ); //B0 has 0 charge
+
+      //second mass hypothesis
+      cand.addUserFloat("barMass",(kin::P4<double>::from(ll_ptr->p4()) + kstar.barP4).mass() );
+
+      // save daughters - unfitted
+      cand.addUserCand("l1", l1_ptr);
+      cand.addUserCand("l2", l2_ptr);
+      cand.addUserCand("trk1", trk1_ptr);
+      cand.addUserCand("trk2", trk2_ptr);
+      cand.addUserCand("kstar", kstar_ptr);
+      cand.addUserCand("dilepton", ll_ptr);
+
+      // save indices
+      cand.addUserInt("l1_idx", l1_idx);
+      cand.addUserInt("l2_idx", l2_idx);
+      cand.addUserInt("trk1_idx", trk1_idx);
+      cand.addUserInt("trk2_idx", trk2_idx);
+      cand.addUserInt("kstar_idx" ,kstar_idx);
+
+
+      auto dr_info = min_max_dr<4>({{l1_ptr.get(), l2_ptr.get(), trk1_ptr.get(), trk2_ptr.get()}});
+      cand.addUserFloat("min_dr", dr_info.first);
+      cand.addUserFloat("max_dr", dr_info.second);
+
+
+      // check if pass pre vertex cut
+      if( !pre_vtx_selection_(cand) ) return;
+        
+      KinVtxFitter fitter = nbody::fit<4>(
+        {{&kstars_ttracks->at(trk1_idx).get(), &kstars_ttracks->at(trk2_idx).get(), 
+          &leptons_ttracks->at(l1_idx).get(), &leptons_ttracks->at(l2_idx).get()}},
+        {{K_MASS, PI_MASS, l1_ptr->mass(), l2_ptr->mass()}},
+        {{K_SIGMA, K_SIGMA, LEP_SIGMA, LEP_SIGMA}}  //K_SIGMA==PI_SIGMA
+        );
+
+      if(!fitter.success()) return; 
+
+      // B0 position
+      cand.setVertex( 
+        reco::Candidate::Point( 
+          fitter.fitted_vtx().x(),
+          fitter.fitted_vtx().y(),
+          fitter.fitted_vtx().z()
+          )  
+        );
+
+      // vertex vars
+      cand.addUserFloat("sv_chi2", fitter.chi2());
+      cand.addUserFloat("sv_ndof", fitter.dof());
+      cand.addUserFloat("sv_prob", fitter.prob());
+
+      // refitted kinematic vars
+      const auto fitted_kstar_p4 = fitter.daughter_p4(0) + fitter.daughter_p4(1);
+      cand.addUserFloat("fitted_kstar_mass", fitted_kstar_p4.mass() );
+      cand.addUserFloat("fitted_kstar_pt"  , fitted_kstar_p4.pt());
+      cand.addUserFloat("fitted_kstar_eta" , fitted_kstar_p4.eta());
+      cand.addUserFloat("fitted_kstar_phi" , fitted_kstar_p4.phi());
+      cand.addUserFloat("fitted_mll"       ,(fitter.daughter_p4(2) + fitter.daughter_p4(3)).mass());
+
+      auto fit_p4 = fitter.fitted_p4();
+      cand.addUserFloat("fitted_pt"  , fit_p4.pt()); 
+      cand.addUserFloat("fitted_eta" , fit_p4.eta());
+      cand.addUserFloat("fitted_phi" , fit_p4.phi());
+      cand.addUserFloat("fitted_mass", fit_p4.mass());      
+      cand.addUserFloat("fitted_massErr", sqrt(fitter.fitted_candidate().kinematicParametersError().matrix()(6,6))); 
+
+      // refitted daughters (leptons/tracks)     
+      for (size_t idaughter=0; idaughter<fitted_names.size(); idaughter++){
+	cand.addUserFloat(fitted_names[idaughter][0], fitter.daughter_p4(idaughter).pt() );
+        cand.addUserFloat(fitted_names[idaughter][1], fitter.daughter_p4(idaughter).eta() );
+        cand.addUserFloat(fitted_names[idaughter][2], fitter.daughter_p4(idaughter).phi() );
+      }
+      
+      // other vars
+      cand.addUserFloat(
+        "cos_theta_2D", 
+        cos_theta_2D(fitter, *beamspot, cand.p4())
+        );
+      cand.addUserFloat(
+        "fitted_cos_theta_2D", 
+        cos_theta_2D(fitter, *beamspot, fit_p4)
+        );
+
+      auto lxy = l_xy(fitter, *beamspot);
+      cand.addUserFloat("l_xy", lxy.value());
+      cand.addUserFloat("l_xy_unc", lxy.error());
+
+      // second mass hypothesis
+      typedef kin::P4<double> P4;
+      const P4 fitted_bar_kstar = P4::from_momentum(fitter.daughter_momentum(0), PI_MASS) +
+                                  P4::from_momentum(fitter.daughter_momentum(1), K_MASS);
+      const P4 fitted_ll = P4::from_momentum(fitter.daughter_momentum(2), fitter.daughter_mass(2)) +
+                           P4::from_momentum(fitter.daughter_momentum(3), fitter.daughter_mass(3));
+      cand.addUserFloat("barMasskstar_fullfit", fitted_bar_kstar.mass());
+      cand.addUserFloat("fitted_barMass", (fitted_bar_kstar + fitted_ll).mass());
+
+      // post fit selection
+      if( !post_vtx_selection_(cand) ) return;        
+      
+      //compute isolation
+      const nbody::FittedDaughters<4> fitted(fitter); // trk1, trk2, l1, l2
+      nbody::ConeIsolation<5> iso(
+        {{fitted.eta[2], fitted.eta[3], fitted.eta[0], fitted.eta[1], float(fit_p4.eta())}},
+        {{fitted.phi[2], fitted.phi[3], fitted.phi[0], fitted.phi[1], float(fit_p4.phi())}}
+        );
+
+      const size_t n_isotrks = isotrks.size();
+      nbody::ConeBuffers & cones = out.cones;
+      cones.resize(n_isotrks);
+      for( size_t i = 0; i < n_isotrks; ++i ) {
+        const unsigned int iTrk = isotrks.key[i];
+        // check if the track is the kaon or the pion
+        if (kstar.trk1_key == iTrk || kstar.trk2_key == iTrk) cones.skip[i] = 1;
+        // check if the track is one of the two leptons
+        else if (std::find(ll.src_keys.begin(), ll.src_keys.end(), iTrk) != ll.src_keys.end()) cones.skip[i] = 1;
+      }
+      // add to final particle iso if dR < cone
+      iso.add(n_isotrks, isotrks.eta.data(), isotrks.phi.data(), isotrks.pt.data(), cones.skip.data(), cones.dr2.data());
+      cand.addUserFloat("l1_iso03" , iso.iso03[0]);
+      cand.addUserFloat("l1_iso04" , iso.iso04[0]);
+      cand.addUserFloat("l2_iso03" , iso.iso03[1]);
+      cand.addUserFloat("l2_iso04" , iso.iso04[1]);
+      cand.addUserFloat("tk1_iso03", iso.iso03[2]);
+      cand.addUserFloat("tk1_iso04", iso.iso04[2]);
+      cand.addUserFloat("tk2_iso03", iso.iso03[3]);
+      cand.addUserFloat("tk2_iso04", iso.iso04[3]);
+      cand.addUserFloat("b_iso03"  , iso.iso03[4]);
+      cand.addUserFloat("b_iso04"  , iso.iso04[4]);
+            
+      out.cands.push_back(std::move(cand));
+    });
+
+  return std::unique_ptr<CompositeCollection>(new CompositeCollection(std::move(all.cands)));
+}
+
+template class BToKstarLLChannel<pat::CompositeCandidate>;
+template class BToKstarLLChannel<bph::CompactCompositeCandidate>;
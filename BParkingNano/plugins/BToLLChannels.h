@@ -0,0 +1,262 @@
+#ifndef PhysicsTools_BParkingNano_BToLLChannels
+#define PhysicsTools_BParkingNano_BToLLChannels
+
+#include "FWCore/Framework/interface/Event.h"
+#include "FWCore/Framework/interface/EventSetup.h"
+#include "FWCore/Framework/interface/ConsumesCollector.h"
+#include "FWCore/ParameterSet/interface/ParameterSet.h"
+#include "FWCore/Utilities/interface/InputTag.h"
+#include "FWCore/Utilities/interface/ESGetToken.h"
+#include "DataFormats/BeamSpot/interface/BeamSpot.h"
+#include "DataFormats/VertexReco/interface/Vertex.h"
+#include "DataFormats/PatCandidates/interface/PackedCandidate.h"
+#include "DataFormats/PatCandidates/interface/CompositeCandidate.h"
+#include "DataFormats/PatCandidates/interface/Muon.h"
+#include "DataFormats/PatCandidates/interface/Electron.h"
+#include "DataFormats/NanoAOD/interface/FlatTable.h"
+#include "PhysicsTools/BParkingNano/interface/ElectronOverlay.h"
+#include "CommonTools/Utils/interface/StringCutObjectSelector.h"
+#include "TrackingTools/TransientTrack/interface/TransientTrack.h"
+#include "MagneticField/Engine/interface/MagneticField.h"
+#include "MagneticField/Records/interface/IdealMagneticFieldRecord.h"
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <limits>
+#include <array>
+#include "helper.h"
+#include "KinVtxFitter.h"
+#include "NBodyBuilder.h"
+#include "CompositeFactory.h"
+#include "UserKey.h"
+#include "ScratchBuffers.h"
+#include "WorkingPoints.h"
+#include "CutVariables.h"
+
+// The B -> K ll and B -> K* ll channels, independent of the module running
+// them. The single-channel builders run one channel each; the multi-channel
+// builder runs all of them on top of one shared track-side preparation.
+// All of them are templated on the composite candidates they read (tracks,
+// dileptons, K*) and write: pat::CompositeCandidate or
+// bph::CompactCompositeCandidate.
+
+// compile-time properties of the leptons the K ll channel is instantiated for
+template<typename Lepton> struct LeptonTraits;
+template<> struct LeptonTraits<pat::Electron> {
+  static constexpr double mass = ELECTRON_MASS;
+};
+template<> struct LeptonTraits<bph::ElectronOverlay> : LeptonTraits<pat::Electron> {};
+template<> struct LeptonTraits<pat::Muon> {
+  static constexpr double mass = MUON_MASS;
+};
+
+// Flat, per-event copies of the builder inputs. They are filled once before
+// the combinatorics, which then only reads plain arrays indexed by the
+// position of the object in its input collection.
+
+struct DileptonArrays {
+  std::vector<edm::Ptr<reco::Candidate> > ptr;
+  std::vector<edm::Ptr<reco::Candidate> > l1_ptr, l2_ptr; // only stored in the output
+  std::vector<math::XYZTLorentzVector> p4;
+  std::vector<float> mass, fitted_mass, fitted_massErr; // table only
+  std::vector<int> charge;
+  std::vector<int> l1_idx, l2_idx;
+  std::vector<double> l1_eta, l1_phi, l2_eta, l2_phi;
+  std::vector<std::vector<unsigned int> > l1_src_keys, l2_src_keys; // packed candidates keys of the lepton sources
+  std::vector<const reco::TransientTrack *> l1_ttrack, l2_ttrack;
+  std::vector<const KinVtxFitter *> kinVtx;
+
+  size_t size() const { return ptr.size(); }
+  void clear() {
+    ptr.clear(); l1_ptr.clear(); l2_ptr.clear(); p4.clear(); charge.clear();
+    mass.clear(); fitted_mass.clear(); fitted_massErr.clear();
+    l1_idx.clear(); l2_idx.clear();
+    l1_eta.clear(); l1_phi.clear(); l2_eta.clear(); l2_phi.clear();
+    l1_src_keys.clear(); l2_src_keys.clear(); l1_ttrack.clear(); l2_ttrack.clear();
+    kinVtx.clear();
+  }
+  void reserve(size_t n) {
+    ptr.reserve(n); l1_ptr.reserve(n); l2_ptr.reserve(n); p4.reserve(n); charge.reserve(n);
+    mass.reserve(n); fitted_mass.reserve(n); fitted_massErr.reserve(n);
+    l1_idx.reserve(n); l2_idx.reserve(n);
+    l1_eta.reserve(n); l1_phi.reserve(n); l2_eta.reserve(n); l2_phi.reserve(n);
+    l1_src_keys.reserve(n); l2_src_keys.reserve(n); l1_ttrack.reserve(n); l2_ttrack.reserve(n);
+    kinVtx.reserve(n);
+  }
+};
+
+struct KaonArrays {
+  static constexpr unsigned int NO_KEY = std::numeric_limits<unsigned int>::max();
+
+  std::vector<edm::Ptr<reco::Candidate> > ptr;
+  std::vector<char> selected; // kaonSelection
+  std::vector<char> dca_iso;  // isoTracksDCASelection
+  std::vector<math::PtEtaPhiMLorentzVector> p4;
+  std::vector<int> charge;
+  std::vector<double> pt, eta, phi;
+  std::vector<unsigned int> cand_key;   // key in the packed candidates, NO_KEY for lost tracks
+  std::vector<unsigned int> key_packed; // keyPacked
+  std::vector<const reco::TransientTrack *> ttrack;
+
+  size_t size() const { return ptr.size(); }
+  void clear() {
+    ptr.clear(); selected.clear(); dca_iso.clear(); p4.clear(); charge.clear();
+    pt.clear(); eta.clear(); phi.clear(); cand_key.clear(); key_packed.clear();
+    ttrack.clear();
+  }
+  void reserve(size_t n) {
+    ptr.reserve(n); selected.reserve(n); dca_iso.reserve(n); p4.reserve(n); charge.reserve(n);
+    pt.reserve(n); eta.reserve(n); phi.reserve(n); cand_key.reserve(n); key_packed.reserve(n);
+    ttrack.reserve(n);
+  }
+};
+
+// Per-event inputs common to all the channels: beam spot, isolation tracks
+// and, when a K ll channel runs, the kaons with their selection bits and
+// transient tracks. The builders keep one per stream (see ScratchBuffers.h):
+// prepare() clears it, keeping the capacity of the arrays.
+struct BToLLTrackData {
+  edm::Handle<reco::BeamSpot> beamspot;
+  edm::Handle<reco::VertexCollection> pvtxs;         // kaons only
+  const MagneticField *bField = nullptr;             // kaons only
+  edm::Handle<pat::PackedCandidateCollection> iso_tracks;
+  edm::Handle<pat::PackedCandidateCollection> iso_lostTracks;
+  std::vector<nbody::IsoTracks> isotrks;             // one per registered isolation selection
+  KaonArrays ks;                                     // kaons only
+
+  void mark(ScratchMarks &marks) const {
+    marks.mark("kaons", ks.size());
+    for(const auto & iso : isotrks) marks.mark("isolation tracks", iso.size());
+  }
+};
+
+// Per-stream scratch of a K ll channel
+struct BToKLLScratch {
+  DileptonArrays lls;
+  std::vector<int> used_lep1_id, used_lep2_id, used_trk_id;
+  std::vector<std::array<int, 3> > cand_idx; // l1, l2, k of the candidates
+
+  void mark(ScratchMarks &marks, const std::string &channel) const {
+    marks.mark(channel + " dileptons", lls.size());
+    marks.mark(channel + " used_trk_id", used_trk_id.size());
+    marks.mark(channel + " candidates", cand_idx.size());
+  }
+};
+
+// Fills the data above once per event. Channels register their isolation
+// selection; identical selections share one isolation index.
+template<typename Composite>
+class BToLLTrackSide {
+public:
+  typedef bph::LazyTransientTrackCollection TransientTrackCollection;
+  typedef std::vector<Composite> CompositeCollection;
+  typedef BToLLTrackData Data;
+
+  BToLLTrackSide(const edm::ParameterSet &cfg, edm::ConsumesCollector iC, bool with_kaons);
+
+  size_t registerIsolation(const std::string &selection);
+  void prepare(const edm::Event &evt, const edm::EventSetup &iSetup, Data &data) const;
+
+private:
+  const bool with_kaons_;
+  const edm::EDGetTokenT<reco::BeamSpot> beamspot_;
+  const edm::EDGetTokenT<pat::PackedCandidateCollection> isotracksToken_;
+  const edm::EDGetTokenT<pat::PackedCandidateCollection> isolostTracksToken_;
+  std::vector<std::string> isotrk_cuts_;
+  std::vector<StringCutObjectSelector<pat::PackedCandidate> > isotrk_selections_;
+
+  edm::ESGetToken<MagneticField, IdealMagneticFieldRecord> bFieldToken_;
+  edm::EDGetTokenT<reco::VertexCollection> vertex_src_;
+  edm::EDGetTokenT<CompositeCollection> kaons_;
+  edm::EDGetTokenT<TransientTrackCollection> kaons_ttracks_;
+  const StringCutObjectSelector<Composite> k_selection_;
+  const StringCutObjectSelector<Composite> isotrk_dca_selection_;
+  const UserKey k_cand_{"cand"};
+  const UserKey k_key_packed_{"keyPacked"};
+};
+
+template<typename Lepton, typename Composite>
+class BToKLLChannel {
+public:
+  typedef std::vector<Lepton> LeptonCollection;
+  typedef bph::LazyTransientTrackCollection TransientTrackCollection;
+  typedef std::vector<Composite> CompositeCollection;
+  static constexpr double LEPTON_MASS = LeptonTraits<Lepton>::mass;
+
+  BToKLLChannel(const edm::ParameterSet &cfg, edm::ConsumesCollector iC, BToLLTrackSide<Composite> &tracks, bool parallel);
+
+  // With a 'tableName' configured the channel writes its own flat table
+  // (same columns as BToKeeTable) and only keeps the candidate kinematics,
+  // daughters and indices in the collection
+  bool writesTable() const { return !table_name_.empty(); }
+
+  std::unique_ptr<CompositeCollection> build(const edm::Event &evt, const BToLLTrackData &shared,
+                                             BToKLLScratch &scratch,
+                                             std::unique_ptr<nanoaod::FlatTable> *table = nullptr) const;
+
+private:
+  const bool filter_by_selection_;
+  const StringCutObjectSelector<Composite> pre_vtx_selection_; // cut on the di-lepton before the SV fit
+  const StringCutObjectSelector<Composite> post_vtx_selection_; // cut on the di-lepton after the SV fit
+  const std::vector<edm::ParameterSet> working_points_; // see WorkingPoints.h
+  const WorkingPointCut<Composite> wp_pre_vtx_selection_;
+  const WorkingPointCut<Composite> wp_post_vtx_selection_;
+
+  const edm::EDGetTokenT<CompositeCollection> dileptons_;
+  const edm::EDGetTokenT<std::vector<KinVtxFitter> > dileptons_kinVtxs_;
+  const edm::EDGetTokenT<LeptonCollection> leptons_; // the collection the dileptons were built from
+  const edm::EDGetTokenT<TransientTrackCollection> leptons_ttracks_;
+
+  const size_t iso_index_;
+  const double isotrkDCACut_;
+  const double isotrkDCATightCut_;
+  const double drIso_cleaning_; // isolation tracks within it of a lepton are vetoed, 0 to disable
+  const bool parallel_; // split the kaon loop across TBB tasks
+  const std::string table_name_;
+  const std::string table_doc_;
+  const CompositeFactory<Composite> factory_;
+  const CompositeFactory<Composite> thin_factory_; // table mode
+  const CutVariables cut_variables_; // table mode, the user data the cuts read
+  const UserKey ll_l1_idx_{"l1_idx"};
+  const UserKey ll_l2_idx_{"l2_idx"};
+  const UserKey ll_fitted_mass_{"fitted_mass"};
+  const UserKey ll_fitted_massErr_{"fitted_massErr"};
+};
+
+template<typename Composite>
+class BToKstarLLChannel {
+public:
+  typedef bph::LazyTransientTrackCollection TransientTrackCollection;
+  typedef std::vector<Composite> CompositeCollection;
+
+  BToKstarLLChannel(const edm::ParameterSet &cfg, edm::ConsumesCollector iC, BToLLTrackSide<Composite> &tracks, bool parallel);
+
+  std::unique_ptr<CompositeCollection> build(const edm::Event &evt, const BToLLTrackData &shared) const;
+
+private:
+  // selections
+  const StringCutObjectSelector<Composite> pre_vtx_selection_; // cut on the di-lepton before the SV fit
+  const StringCutObjectSelector<Composite> post_vtx_selection_; // cut on the di-lepton after the SV fit
+
+  const edm::EDGetTokenT<CompositeCollection> dileptons_;
+  const edm::EDGetTokenT<CompositeCollection> kstars_;
+  const edm::EDGetTokenT<TransientTrackCollection> leptons_ttracks_;
+  const edm::EDGetTokenT<TransientTrackCollection> kstars_ttracks_;
+  // with lepton-seeded K*, the dileptons each K* is paired with (optional)
+  edm::EDGetTokenT<std::vector<std::vector<int> > > compatible_lls_;
+  const size_t iso_index_;
+  const bool parallel_; // split the K* loop across TBB tasks
+  const CompositeFactory<Composite> factory_;
+  const UserKey kstar_trk1_{"trk1"};
+  const UserKey kstar_trk2_{"trk2"};
+  const UserKey kstar_trk1_idx_{"trk1_idx"};
+  const UserKey kstar_trk2_idx_{"trk2_idx"};
+  const UserKey kstar_barMass_{"barMass"};
+  const UserKey ll_l1_{"l1"};
+  const UserKey ll_l2_{"l2"};
+  const UserKey ll_l1_idx_{"l1_idx"};
+  const UserKey ll_l2_idx_{"l2_idx"};
+};
+
+#endif
@@ -0,0 +1,123 @@
+////////////// Code to produce all the B -> (K, K*) ll candidates //////////////
+
+#include "FWCore/Framework/interface/global/EDProducer.h"
+#include "FWCore/Framework/interface/Event.h"
+#include "FWCore/ParameterSet/interface/ParameterSet.h"
+#include "FWCore/ParameterSet/interface/ConfigurationDescriptions.h"
+#include "FWCore/ParameterSet/interface/ParameterSetDescription.h"
+#include "FWCore/Utilities/interface/InputTag.h"
+
+#include <vector>
+#include <memory>
+#include <string>
+#include "BToLLChannels.h"
+
+// Runs the B -> K ee, K mumu, K* ee and K* mumu channels in one module. The
+// kaons (selection bits, transient tracks), the isolation track indices and
+// the beam spot are prepared once per event and shared by all the channels;
+// each channel writes its own collection, labelled as its PSet. A channel
+// without a PSet in the configuration is not run. The electrons of the Kee
+// channel are pat::Electron or bph::ElectronOverlay.
+
+// per-stream scratch, see ScratchBuffers.h
+struct BToLLMultiChannelScratch {
+  BToLLTrackData tracks;
+  BToKLLScratch kee, kmumu;
+  ScratchMarks marks;
+};
+
+template<typename Composite, typename Electron = pat::Electron>
+class BToLLMultiChannelBuilderT : public edm::global::EDProducer<edm::StreamCache<BToLLMultiChannelScratch> > {
+
+public:
+  typedef std::vector<Composite> CompositeCollection;
+
+  explicit BToLLMultiChannelBuilderT(const edm::ParameterSet &cfg):
+    tracks_{cfg, consumesCollector(),
+        cfg.existsAs<edm::ParameterSet>("Kee") || cfg.existsAs<edm::ParameterSet>("Kmumu")},
+    debug_scratch_{scratch_debug(cfg)} {
+      const bool parallel = cfg.getParameter<bool>("parallelCombinatorics");
+      if(cfg.existsAs<edm::ParameterSet>("Kee"))
+        kee_ = std::make_unique<BToKLLChannel<Electron, Composite> >(
+          cfg.getParameter<edm::ParameterSet>("Kee"), consumesCollector(), tracks_, parallel);
+      if(cfg.existsAs<edm::ParameterSet>("Kmumu"))
+        kmumu_ = std::make_unique<BToKLLChannel<pat::Muon, Composite> >(
+          cfg.getParameter<edm::ParameterSet>("Kmumu"), consumesCollector(), tracks_, parallel);
+      if(cfg.existsAs<edm::ParameterSet>("KstarEE"))
+        kstaree_ = std::make_unique<BToKstarLLChannel<Composite> >(
+          cfg.getParameter<edm::ParameterSet>("KstarEE"), consumesCollector(), tracks_, parallel);
+      if(cfg.existsAs<edm::ParameterSet>("KstarMuMu"))
+        kstarmumu_ = std::make_unique<BToKstarLLChannel<Composite> >(
+          cfg.getParameter<edm::ParameterSet>("KstarMuMu"), consumesCollector(), tracks_, parallel);
+
+      //output
+      if(kee_)       produces<CompositeCollection>("Kee");
+      if(kmumu_)     produces<CompositeCollection>("Kmumu");
+      if(kstaree_)   produces<CompositeCollection>("KstarEE");
+      if(kstarmumu_) produces<CompositeCollection>("KstarMuMu");
+      // tables written directly by the K ll channels
+      if(kee_ && kee_->writesTable())     produces<nanoaod::FlatTable>("Kee");
+      if(kmumu_ && kmumu_->writesTable()) produces<nanoaod::FlatTable>("Kmumu");
+    }
+
+  ~BToLLMultiChannelBuilderT() override {}
+
+  std::unique_ptr<BToLLMultiChannelScratch> beginStream(edm::StreamID) const override {
+    return std::make_unique<BToLLMultiChannelScratch>();
+  }
+  void produce(edm::StreamID, edm::Event&, const edm::EventSetup&) const override;
+  void endStream(edm::StreamID sid) const override {
+    if(debug_scratch_) streamCache(sid)->marks.report(moduleDescription().moduleLabel(), sid.value());
+  }
+
+  static void fillDescriptions(edm::ConfigurationDescriptions &descriptions) {}
+
+private:
+  template<typename Lepton>
+  void putKLL(edm::Event &evt, const BToKLLChannel<Lepton, Composite> &channel,
+              const BToLLTrackData &tracks, BToKLLScratch &scratch, const std::string &label) const {
+    if(channel.writesTable()) {
+      std::unique_ptr<nanoaod::FlatTable> table;
+      evt.put(channel.build(evt, tracks, scratch, &table), label);
+      evt.put(std::move(table), label);
+    } else {
+      evt.put(channel.build(evt, tracks, scratch), label);
+    }
+  }
+
+  BToLLTrackSide<Composite> tracks_; // shared by all the channels
+  std::unique_ptr<const BToKLLChannel<Electron, Composite> > kee_;
+  std::unique_ptr<const BToKLLChannel<pat::Muon, Composite> > kmumu_;
+  std::unique_ptr<const BToKstarLLChannel<Composite> > kstaree_;
+  std::unique_ptr<const BToKstarLLChannel<Composite> > kstarmumu_;
+  const bool debug_scratch_;
+};
+
+template<typename Composite, typename Electron>
+void BToLLMultiChannelBuilderT<Composite, Electron>::produce(edm::StreamID sid, edm::Event &evt, edm::EventSetup const &iSetup) const {
+  BToLLMultiChannelScratch & scratch = *streamCache(sid);
+  BToLLTrackData & tracks = scratch.tracks;
+  tracks_.prepare(evt, iSetup, tracks);
+
+  if(kee_)       putKLL(evt, *kee_, tracks, scratch.kee, "Kee");
+  if(kmumu_)     putKLL(evt, *kmumu_, tracks, scratch.kmumu, "Kmumu");
+  if(kstaree_)   evt.put(kstaree_->build(evt, tracks), "KstarEE");
+  if(kstarmumu_) evt.put(kstarmumu_->build(evt, tracks), "KstarMuMu");
+
+  if(debug_scratch_) {
+    tracks.mark(scratch.marks);
+    if(kee_)   scratch.kee.mark(scratch.marks, "Kee");
+    if(kmumu_) scratch.kmumu.mark(scratch.marks, "Kmumu");
+  }
+}
+
+typedef BToLLMultiChannelBuilderT<pat::CompositeCandidate> BToLLMultiChannelBuilder;
+typedef BToLLMultiChannelBuilderT<bph::CompactCompositeCandidate> CompactBToLLMultiChannelBuilder;
+typedef BToLLMultiChannelBuilderT<pat::CompositeCandidate, bph::ElectronOverlay> OverlayBToLLMultiChannelBuilder;
+typedef BToLLMultiChannelBuilderT<bph::CompactCompositeCandidate, bph::ElectronOverlay> CompactOverlayBToLLMultiChannelBuilder;
+
+#include "FWCore/Framework/interface/MakerMacros.h"
+DEFINE_FWK_MODULE(BToLLMultiChannelBuilder);
+DEFINE_FWK_MODULE(CompactBToLLMultiChannelBuilder);
+DEFINE_FWK_MODULE(OverlayBToLLMultiChannelBuilder);
+DEFINE_FWK_MODULE(CompactOverlayBToLLMultiChannelBuilder);
@@ -0,0 +1,104 @@
+#ifndef PhysicsTools_BParkingNano_CandidateScorer
+#define PhysicsTools_BParkingNano_CandidateScorer
+
+#include "FWCore/ParameterSet/interface/ParameterSet.h"
+#include "FWCore/ParameterSet/interface/FileInPath.h"
+#include "FWCore/Utilities/interface/Exception.h"
+#include "CommonTools/Utils/interface/StringObjectFunction.h"
+#include "PhysicsTools/TensorFlow/interface/TensorFlow.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Optional scoring of the candidates of a builder with a frozen TensorFlow
+// graph, configured by a 'scoring' PSet:
+//   scoring = cms.PSet(
+//     graphPath = cms.FileInPath('PhysicsTools/BParkingNano/data/....pb'),
+//     inputName = cms.string('input'),    # [candidates, features] float
+//     outputName = cms.string('output'),  # [candidates, ...], first column read
+//     features = cms.vstring('userFloat("fitted_pt")', ...),
+//     threshold = cms.double(-1.),        # candidates below are dropped
+//   )
+// The graph is loaded once per job and its session shared by the streams.
+// All the candidates of an event are scored in a single batch and get the
+// 'score' user float.
+
+// global cache of the module; empty if no scoring is configured
+struct CandidateScorerCache {
+  std::unique_ptr<tensorflow::GraphDef> graph;
+  tensorflow::Session * session = nullptr;
+
+  static std::unique_ptr<CandidateScorerCache> load(const edm::ParameterSet &cfg) {
+    auto cache = std::make_unique<CandidateScorerCache>();
+    if(!cfg.existsAs<edm::ParameterSet>("scoring")) return cache;
+    const edm::ParameterSet & scoring = cfg.getParameter<edm::ParameterSet>("scoring");
+    tensorflow::setLogging("3");
+    cache->graph.reset(tensorflow::loadGraphDef(scoring.getParameter<edm::FileInPath>("graphPath").fullPath()));
+    cache->session = tensorflow::createSession(cache->graph.get());
+    return cache;
+  }
+
+  static void close(const CandidateScorerCache *cache) {
+    if(cache->session == nullptr) return;
+    // the session is owned by the cache, which is const to the module
+    tensorflow::Session * session = cache->session;
+    tensorflow::closeSession(session);
+  }
+};
+
+template<typename Composite>
+class CandidateScorer {
+public:
+  // cfg is the module configuration, the scorer is disabled without 'scoring'
+  explicit CandidateScorer(const edm::ParameterSet &cfg):
+    enabled_{cfg.existsAs<edm::ParameterSet>("scoring")} {
+    if(!enabled_) return;
+    const edm::ParameterSet & scoring = cfg.getParameter<edm::ParameterSet>("scoring");
+    input_name_ = scoring.getParameter<std::string>("inputName");
+    output_name_ = scoring.getParameter<std::string>("outputName");
+    threshold_ = scoring.getParameter<double>("threshold");
+    for(const auto & feature : scoring.getParameter<std::vector<std::string> >("features"))
+      features_.emplace_back(feature);
+    if(features_.empty())
+      throw cms::Exception("Configuration") << "candidate scoring configured without features";
+  }
+
+  bool enabled() const { return enabled_; }
+
+  // adds the score to all the candidates, then drops the ones below threshold
+  void score(std::vector<Composite> &cands, tensorflow::Session *session) const {
+    if(!enabled_ || cands.empty()) return;
+    const size_t n_cands = cands.size(), n_features = features_.size();
+    tensorflow::Tensor input(tensorflow::DT_FLOAT, {int64_t(n_cands), int64_t(n_features)});
+    float * values = input.flat<float>().data();
+    for(const auto & cand : cands) {
+      for(const auto & feature : features_) *values++ = feature(cand);
+    }
+
+    std::vector<tensorflow::Tensor> outputs;
+    tensorflow::run(session, {{input_name_, input}}, {output_name_}, &outputs);
+    const auto scores = outputs[0].flat<float>();
+    if(size_t(scores.size()) < n_cands)
+      throw cms::Exception("CandidateScorer") << "graph output " << output_name_ << " has " << scores.size()
+                                              << " values for " << n_cands << " candidates";
+    const size_t stride = scores.size() / n_cands;
+
+    size_t kept = 0;
+    for(size_t i = 0; i < n_cands; ++i) {
+      const float score = scores(i * stride);
+      if(score < threshold_) continue;
+      if(kept != i) cands[kept] = std::move(cands[i]);
+      cands[kept++].addUserFloat("score", score);
+    }
+    cands.resize(kept);
+  }
+
+private:
+  const bool enabled_;
+  std::string input_name_, output_name_;
+  double threshold_ = 0.;
+  std::vector<StringObjectFunction<Composite> > features_;
+};
+
+#endif
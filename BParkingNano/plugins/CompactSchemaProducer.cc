@@ -0,0 +1,63 @@
+// Makes the bph::CompactCompositeCandidate collections self-describing: the
+// user data keys of all the schemas registered in the job are written as a
+// run product. In a later job reading the file, the schemas written by the
+// previous processes ('src') are registered again at the beginning of the
+// run, so that the candidates read back find their keys; they are then
+// written out again with those of the job.
+
+#include "FWCore/Framework/interface/global/EDProducer.h"
+#include "FWCore/Framework/interface/Run.h"
+#include "FWCore/ParameterSet/interface/ParameterSet.h"
+#include "FWCore/ParameterSet/interface/ConfigurationDescriptions.h"
+#include "FWCore/ParameterSet/interface/ParameterSetDescription.h"
+#include "FWCore/Utilities/interface/InputTag.h"
+#include "FWCore/Utilities/interface/Exception.h"
+#include "PhysicsTools/BParkingNano/interface/CompactCompositeCandidate.h"
+
+#include <memory>
+
+class CompactSchemaProducer : public edm::global::EDProducer<edm::WatchRuns, edm::EndRunProducer> {
+
+public:
+  explicit CompactSchemaProducer(const edm::ParameterSet &cfg):
+    src_{consumes<bph::CompactSchemaCollection, edm::InRun>(cfg.getParameter<edm::InputTag>("src"))} {
+      produces<bph::CompactSchemaCollection, edm::Transition::EndRun>();
+    }
+
+  ~CompactSchemaProducer() override {}
+
+  void produce(edm::StreamID, edm::Event&, const edm::EventSetup&) const override {}
+  void globalBeginRun(const edm::Run&, const edm::EventSetup&) const override;
+  void globalEndRun(const edm::Run&, const edm::EventSetup&) const override {}
+  void globalEndRunProduce(edm::Run&, const edm::EventSetup&) const override;
+
+  static void fillDescriptions(edm::ConfigurationDescriptions &descriptions) {
+    edm::ParameterSetDescription desc;
+    desc.add<edm::InputTag>("src", edm::InputTag("compactSchemas", "", edm::InputTag::kSkipCurrentProcess));
+    descriptions.add("compactSchemas", desc);
+  }
+
+private:
+  const edm::EDGetTokenT<bph::CompactSchemaCollection> src_;
+};
+
+void CompactSchemaProducer::globalBeginRun(const edm::Run &run, const edm::EventSetup&) const {
+  edm::Handle<bph::CompactSchemaCollection> written;
+  run.getByToken(src_, written);
+  if(!written.isValid()) return;
+  // the slots are not written: rebuilt from the keys
+  for(const auto & schema : *written) {
+    const bph::CompactSchema & registered = bph::CompactSchema::registerSchema(
+      bph::CompactSchema(schema.floatKeys(), schema.intKeys(), schema.candKeys()));
+    if(registered.id() != schema.id())
+      throw cms::Exception("LogicError") << "CompactSchema: the schema written with id " << schema.id()
+                                         << " has the id " << registered.id() << " in this release";
+  }
+}
+
+void CompactSchemaProducer::globalEndRunProduce(edm::Run &run, const edm::EventSetup&) const {
+  run.put(std::make_unique<bph::CompactSchemaCollection>(bph::CompactSchema::registered()));
+}
+
+#include "FWCore/Framework/interface/MakerMacros.h"
+DEFINE_FWK_MODULE(CompactSchemaProducer);
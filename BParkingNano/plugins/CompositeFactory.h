@@ -0,0 +1,30 @@
+#ifndef PhysicsTools_BParkingNano_CompositeFactory
+#define PhysicsTools_BParkingNano_CompositeFactory
+
+#include "DataFormats/PatCandidates/interface/CompositeCandidate.h"
+#include "PhysicsTools/BParkingNano/interface/CompactCompositeCandidate.h"
+
+// Creates the candidates written by the builders, which are templated on
+// their output: pat::CompositeCandidate, or bph::CompactCompositeCandidate
+// sharing the schema of user data keys declared by the builder. Keys that
+// the builder sets but did not declare still work, they are just not compact.
+template<typename Composite> class CompositeFactory;
+
+template<>
+class CompositeFactory<pat::CompositeCandidate> {
+public:
+  explicit CompositeFactory(const bph::CompactSchema &) {}
+  pat::CompositeCandidate make() const { return pat::CompositeCandidate(); }
+};
+
+template<>
+class CompositeFactory<bph::CompactCompositeCandidate> {
+public:
+  explicit CompositeFactory(const bph::CompactSchema &schema):
+    schema_{&bph::CompactSchema::registerSchema(schema)} {}
+  bph::CompactCompositeCandidate make() const { return bph::CompactCompositeCandidate(*schema_); }
+private:
+  const bph::CompactSchema * schema_;
+};
+
+#endif
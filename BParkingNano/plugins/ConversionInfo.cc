@@ -1,5 +1,8 @@
 #include "ConversionInfo.h"
 #include "FWCore/MessageLogger/interface/MessageLogger.h"
+#include "helper.h"
+#include "Kinematics.h"
+#include "PhysicsTools/BParkingNano/interface/ElectronOverlay.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // Matched to any conversion (without selections)
@@ -39,7 +42,8 @@ bool ConversionInfo::wpTight() {
 
 ////////////////////////////////////////////////////////////////////////////////
 // adds minimal set of flags to electron userData
-void ConversionInfo::addUserVars(pat::Electron& ele) {
+template<typename Electron>
+void ConversionInfo::addUserVars(Electron& ele) {
   ele.addUserInt("convOpen", this->matched?1:0);
   ele.addUserInt("convLoose", this->wpLoose()?1:0);
   ele.addUserInt("convTight", this->wpTight()?1:0);
@@ -51,7 +55,8 @@ void ConversionInfo::addUserVars(pat::Electron& ele) {
 
 ////////////////////////////////////////////////////////////////////////////////
 // adds all variables to electron userData
-void ConversionInfo::addUserVarsExtra(pat::Electron& ele) {
+template<typename Electron>
+void ConversionInfo::addUserVarsExtra(Electron& ele) {
   
   // Flag that indicates if extra variables are added to electron userData
   ele.addUserInt("convExtra", 1, true); // overwrite
@@ -90,140 +95,180 @@ void ConversionInfo::addUserVarsExtra(pat::Electron& ele) {
 
 } 
 
+template void ConversionInfo::addUserVars(pat::Electron& ele);
+template void ConversionInfo::addUserVars(bph::ElectronOverlay& ele);
+template void ConversionInfo::addUserVarsExtra(pat::Electron& ele);
+template void ConversionInfo::addUserVarsExtra(bph::ElectronOverlay& ele);
+
 ////////////////////////////////////////////////////////////////////////////////
-//
-bool ConversionInfo::match(const edm::Handle<reco::BeamSpot>& beamSpot,
-			   const edm::Handle<edm::View<reco::Conversion> >& conversions,
-			   const pat::Electron& ele) {
+// Quantities of a conversion with two tracks (requirement from Nancy)
+ConversionInfo ConversionInfo::fromConversion(const reco::Conversion& conv,
+					      const reco::BeamSpot& beamSpot) {
+
   ConversionInfo info;
-  return ConversionInfo::match(beamSpot,conversions,ele,info);
-}
 
-////////////////////////////////////////////////////////////////////////////////
-//
-bool ConversionInfo::match(const edm::Handle<reco::BeamSpot>& beamSpot,
-			   const edm::Handle<edm::View<reco::Conversion> >& conversions,
-			   const pat::Electron& ele,
-			   ConversionInfo& info) {
-  
-  // Valid handles?
-  if ( !(beamSpot.isValid()) ) {
-    edm::LogError("ConversionInfo::match")
-      << " !(beamSpot.isValid())" << std::endl;
-    return false;
-  }
-  if ( !(conversions.isValid()) ) {
-    edm::LogError("ConversionInfo::match")
-      << " !(conversions.isValid())" << std::endl;
-    return false;
-  }
-  
-  // Iterate through conversions and calculate quantities (requirement from Nancy)
-  for ( const auto& conv : *conversions ) {
-
-    // Filter
-    if ( conv.tracks().size() != 2 ) { continue; }
-
-    // Quality
-    info.valid = conv.conversionVertex().isValid(); // (=true)
-    info.chi2prob = ChiSquaredProbability(conv.conversionVertex().chi2(),conv.conversionVertex().ndof()); // (<0.005)
-    info.quality_high_purity = conv.quality(reco::Conversion::highPurity); // (=true)
-    info.quality_high_efficiency = conv.quality(reco::Conversion::highEfficiency); // (none)
-
-    // Tracks
-    info.ntracks = conv.tracks().size(); // (=2)
-    info.min_trk_pt = -1.; // (>0.5)
-    for ( const auto& trk : conv.tracks() ) {
-      if ( trk.isNonnull() && trk.isAvailable() &&
+  // Quality
+  info.valid = conv.conversionVertex().isValid(); // (=true)
+  info.chi2prob = ChiSquaredProbability(conv.conversionVertex().chi2(),conv.conversionVertex().ndof()); // (<0.005)
+  info.quality_high_purity = conv.quality(reco::Conversion::highPurity); // (=true)
+  info.quality_high_efficiency = conv.quality(reco::Conversion::highEfficiency); // (none)
+
+  // Tracks
+  info.ntracks = conv.tracks().size(); // (=2)
+  info.min_trk_pt = -1.; // (>0.5)
+  for ( const auto& trk : conv.tracks() ) {
+    if ( trk.isNonnull() && trk.isAvailable() &&
 	   ( info.min_trk_pt < 0. || trk->pt() < info.min_trk_pt ) ) { info.min_trk_pt = trk->pt(); }
-    }
-    info.ilead = -1; info.itrail = -1;
-    if ( conv.tracks().size() == 2 ) {
-      edm::RefToBase<reco::Track> trk1 = conv.tracks().front();
-      edm::RefToBase<reco::Track> trk2 = conv.tracks().back();
-      if ( trk1.isNonnull() && trk1.isAvailable() &&
+  }
+  info.ilead = -1; info.itrail = -1;
+  if ( conv.tracks().size() == 2 ) {
+    edm::RefToBase<reco::Track> trk1 = conv.tracks().front();
+    edm::RefToBase<reco::Track> trk2 = conv.tracks().back();
+    if ( trk1.isNonnull() && trk1.isAvailable() &&
 	   trk2.isNonnull() && trk2.isAvailable() ) {
 	if ( trk1->pt() > trk2->pt() ) { info.ilead = 0; info.itrail = 1; }
 	else                           { info.ilead = 1; info.itrail = 0; }
-      }
     }
+  }
+
+  // Transverse displacement (with respect to beamspot) and vertex radius
+  math::XYZVectorF p_refitted =  conv.refittedPairMomentum();
+  float dx = conv.conversionVertex().x() - beamSpot.x0();
+  float dy = conv.conversionVertex().y() - beamSpot.y0();
+  info.l_xy = (p_refitted.x()*dx + p_refitted.y()*dy) / p_refitted.rho();
+  info.vtx_radius = sqrt(conv.conversionVertex().position().perp2()); // (1.5<r<4.)
 
-    // Transverse displacement (with respect to beamspot) and vertex radius
-    math::XYZVectorF p_refitted =  conv.refittedPairMomentum();
-    float dx = conv.conversionVertex().x() - beamSpot->x0();
-    float dy = conv.conversionVertex().y() - beamSpot->y0();
-    info.l_xy = (p_refitted.x()*dx + p_refitted.y()*dy) / p_refitted.rho();
-    info.vtx_radius = sqrt(conv.conversionVertex().position().perp2()); // (1.5<r<4.)
-
-    // invariant mass from track pair from conversion
-    info.mass_from_conv = conv.pairInvariantMass();
-    
-    // Invariant mass from Pin before fit to common vertex 
-    if ( conv.tracksPin().size() >= 2 &&
+  // invariant mass from track pair from conversion
+  info.mass_from_conv = conv.pairInvariantMass();
+  
+  // Invariant mass from Pin before fit to common vertex 
+  if ( conv.tracksPin().size() >= 2 &&
 	 info.ilead > -1 && info.itrail > -1 ) {
-      math::XYZVectorF lead_Pin = conv.tracksPin().at(info.ilead);
-      math::XYZVectorF trail_Pin = conv.tracksPin().at(info.itrail);
-      info.mass_from_Pin = mee( lead_Pin.x(), lead_Pin.y(), lead_Pin.z(),
+    math::XYZVectorF lead_Pin = conv.tracksPin().at(info.ilead);
+    math::XYZVectorF trail_Pin = conv.tracksPin().at(info.itrail);
+    info.mass_from_Pin = mee( lead_Pin.x(), lead_Pin.y(), lead_Pin.z(),
 				trail_Pin.x(), trail_Pin.y(), trail_Pin.z() );
-      // Opening angle
-      info.delta_cot_from_Pin = 1. / tan(trail_Pin.theta()) - 1. / tan(lead_Pin.theta());
-    }
+    // Opening angle
+    info.delta_cot_from_Pin = 1. / tan(trail_Pin.theta()) - 1. / tan(lead_Pin.theta());
+  }
 
-    // Invariant mass before fit to common vertex
-    if ( conv.tracks().size() >= 2 &&
+  // Invariant mass before fit to common vertex
+  if ( conv.tracks().size() >= 2 &&
 	 info.ilead > -1 && info.itrail > -1 ) {
-      edm::RefToBase<reco::Track> lead_before_vtx_fit = conv.tracks().at(info.ilead);
-      edm::RefToBase<reco::Track> trail_before_vtx_fit = conv.tracks().at(info.itrail);
-      info.mass_before_fit = mee( lead_before_vtx_fit->px(), lead_before_vtx_fit->py(), lead_before_vtx_fit->pz(),
+    edm::RefToBase<reco::Track> lead_before_vtx_fit = conv.tracks().at(info.ilead);
+    edm::RefToBase<reco::Track> trail_before_vtx_fit = conv.tracks().at(info.itrail);
+    info.mass_before_fit = mee( lead_before_vtx_fit->px(), lead_before_vtx_fit->py(), lead_before_vtx_fit->pz(),
 				  trail_before_vtx_fit->px(), trail_before_vtx_fit->py(), trail_before_vtx_fit->pz() );
-    }
+  }
 
-    // Invariant mass after the fit to common vertex
-    if ( conv.conversionVertex().refittedTracks().size() >=2 &&
+  // Invariant mass after the fit to common vertex
+  if ( conv.conversionVertex().refittedTracks().size() >=2 &&
 	 info.ilead > -1 && info.itrail > -1 ) {
-      const reco::Track lead_after_vtx_fit = conv.conversionVertex().refittedTracks().at(info.ilead);
-      const reco::Track trail_after_vtx_fit = conv.conversionVertex().refittedTracks().at(info.itrail);
-      info.mass_after_fit = mee( lead_after_vtx_fit.px(), lead_after_vtx_fit.py(), lead_after_vtx_fit.pz(),
+    const reco::Track lead_after_vtx_fit = conv.conversionVertex().refittedTracks().at(info.ilead);
+    const reco::Track trail_after_vtx_fit = conv.conversionVertex().refittedTracks().at(info.itrail);
+    info.mass_after_fit = mee( lead_after_vtx_fit.px(), lead_after_vtx_fit.py(), lead_after_vtx_fit.pz(),
 				 trail_after_vtx_fit.px(), trail_after_vtx_fit.py(), trail_after_vtx_fit.pz());
-      // Difference in expeted hits
-      info.delta_expected_nhits_inner =
+    // Difference in expeted hits
+    info.delta_expected_nhits_inner =
 	lead_after_vtx_fit.hitPattern().numberOfLostHits(reco::HitPattern::MISSING_INNER_HITS)
 	- trail_after_vtx_fit.hitPattern().numberOfLostHits(reco::HitPattern::MISSING_INNER_HITS);
-    }
-    
-    // Hits prior to vertex
-    if ( info.ilead > -1 && info.itrail > -1 ) {
-      info.lead_nhits_before_vtx  = conv.nHitsBeforeVtx().size() > 1 ? conv.nHitsBeforeVtx().at(info.ilead) : 0;
-      info.trail_nhits_before_vtx = conv.nHitsBeforeVtx().size() > 1 ? conv.nHitsBeforeVtx().at(info.itrail) : 0;
-      info.max_nhits_before_vtx = conv.nHitsBeforeVtx().size() > 1 ?
+  }
+  
+  // Hits prior to vertex
+  if ( info.ilead > -1 && info.itrail > -1 ) {
+    info.lead_nhits_before_vtx  = conv.nHitsBeforeVtx().size() > 1 ? conv.nHitsBeforeVtx().at(info.ilead) : 0;
+    info.trail_nhits_before_vtx = conv.nHitsBeforeVtx().size() > 1 ? conv.nHitsBeforeVtx().at(info.itrail) : 0;
+    info.max_nhits_before_vtx = conv.nHitsBeforeVtx().size() > 1 ?
 	( conv.nHitsBeforeVtx().at(0) > conv.nHitsBeforeVtx().at(1) ?
 	  conv.nHitsBeforeVtx().at(0) :
 	  conv.nHitsBeforeVtx().at(1) ) : 0;
-      info.sum_nhits_before_vtx = conv.nHitsBeforeVtx().size() > 1 ?
+    info.sum_nhits_before_vtx = conv.nHitsBeforeVtx().size() > 1 ?
 	conv.nHitsBeforeVtx().at(0) +
 	conv.nHitsBeforeVtx().at(1) : 0;
-    }
-    
-    // Attempt to match conversion track to electron
-    for ( uint itrk = 0; itrk < conv.tracks().size(); ++itrk ) {
-
-      edm::RefToBase<reco::Track> trk = conv.tracks()[itrk];
-      if ( trk.isNull() ) { continue; }
-      
-      reco::GsfTrackRef gsf = ele.gsfTrack();
-      if ( gsf.isNull() ) { continue; }
-
-      if ( gsf.id() == trk.id() && gsf.key() == trk.key() )  { 
-	info.matched = true;
-	if ( (int)itrk == info.ilead ) { info.matched_lead = trk; }
-	if ( (int)itrk == info.itrail ) { info.matched_trail = trk; }
-      }
-      
-    } // track loop
-    
-  } // conversions loop
-
-  return info.matched;
+  }
+
+  return info;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+bool ConversionIndex::fill(const edm::Handle<reco::BeamSpot>& beamSpot,
+			   const edm::Handle<edm::View<reco::Conversion> >& conversions) {
+
+  clear();
+
+  // Valid handles?
+  if ( !(beamSpot.isValid()) ) {
+    edm::LogError("ConversionIndex::fill")
+      << " !(beamSpot.isValid())" << std::endl;
+    return false;
+  }
+  if ( !(conversions.isValid()) ) {
+    edm::LogError("ConversionIndex::fill")
+      << " !(conversions.isValid())" << std::endl;
+    return false;
+  }
+
+  infos_.reserve(conversions->size());
+  for ( const auto& conv : *conversions ) { add(conv,*beamSpot); }
+
+  return true;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+void ConversionIndex::clear() {
+  infos_.clear();
+  tracks_.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+void ConversionIndex::add(const reco::Conversion& conv, const reco::BeamSpot& beamSpot) {
+
+  // Filter
+  if ( conv.tracks().size() != 2 ) { return; }
+  const size_t iconv = infos_.size();
+  infos_.push_back(ConversionInfo::fromConversion(conv,beamSpot));
+  const ConversionInfo& info = infos_.back();
+
+  // tracks shared by several conversions point to the last one, the lead
+  // and trail flags are kept from all of them
+  for ( uint itrk = 0; itrk < conv.tracks().size(); ++itrk ) {
+    edm::RefToBase<reco::Track> trk = conv.tracks()[itrk];
+    if ( trk.isNull() ) { continue; }
+    Track& entry = tracks_[ProductKey(trk.id(),trk.key())];
+    entry.conversion = iconv;
+    if ( (int)itrk == info.ilead ) { entry.lead = trk; }
+    if ( (int)itrk == info.itrail ) { entry.trail = trk; }
+  }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+bool ConversionIndex::match(const pat::Electron& ele, ConversionInfo& info) const {
+  return match(ele.gsfTrack(),info);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+bool ConversionIndex::match(const reco::GsfTrackRef& gsf, ConversionInfo& info) const {
+
+  info.reset();
+  if ( gsf.isNull() ) { return false; }
+
+  auto found = tracks_.find(ProductKey(gsf.id(),gsf.key()));
+  if ( found == tracks_.end() ) { return false; }
+
+  const Track& trk = found->second;
+  info = infos_[trk.conversion];
+  info.matched = true;
+  info.matched_lead = trk.lead;
+  info.matched_trail = trk.trail;
+  return true;
 
 }
 
@@ -231,13 +276,8 @@ bool ConversionInfo::match(const edm::Handle<reco::BeamSpot>& beamSpot,
 //
 float ConversionInfo::mee(float ipx1, float ipy1, float ipz1, 
 			  float ipx2, float ipy2, float ipz2) {
-  const float  m = 0.000511;
-  const float px = ipx1+ipx2;
-  const float py = ipy1+ipy2;
-  const float pz = ipz1+ipz2;
-  const float p1 = ipx1*ipx1 + ipy1*ipy1 + ipz1*ipz1;
-  const float p2 = ipx2*ipx2 + ipy2*ipy2 + ipz2*ipz2;
-  const float  e = sqrt( p1 + m*m ) + sqrt( p2 + m*m );
-  const float mass = ( e*e - px*px - py*py - pz*pz );
+  typedef kin::P4<float> P4;
+  const float mass = ( P4::from_momentum(ipx1, ipy1, ipz1, ELECTRON_MASS) +
+                       P4::from_momentum(ipx2, ipy2, ipz2, ELECTRON_MASS) ).m2();
   return mass > 0. ? sqrt(mass) : -1.;
 }
@@ -9,6 +9,10 @@
 #include "DataFormats/Common/interface/View.h"
 #include "DataFormats/PatCandidates/interface/Electron.h"
 #include "DataFormats/TrackReco/interface/Track.h"
+#include "helper.h"
+
+#include <unordered_map>
+#include <vector>
 
 class ConversionInfo {
   
@@ -23,18 +27,15 @@ class ConversionInfo {
   bool wpLoose(); // Nancy's baseline selections for conversions
   bool wpTight(); // Nancy's selection for analysis of conversions
   
-  void addUserVars(pat::Electron& ele); // adds minimal set of flags to electron userData
-  void addUserVarsExtra(pat::Electron& ele); // adds all variables to electron userData
-  
-  static bool match(const edm::Handle<reco::BeamSpot>& beamSpot,
-		    const edm::Handle<edm::View<reco::Conversion> >& conversions,
-		    const pat::Electron& ele);
-  
-  static bool match(const edm::Handle<reco::BeamSpot>& beamSpot,
-		    const edm::Handle<edm::View<reco::Conversion> >& conversions,
-		    const pat::Electron& ele,
-		    ConversionInfo& info);
+  // Electron is pat::Electron or bph::ElectronOverlay
+  template<typename Electron> void addUserVars(Electron& ele); // adds minimal set of flags to electron userData
+  template<typename Electron> void addUserVarsExtra(Electron& ele); // adds all variables to electron userData
   
+  // quantities of one conversion, the electrons are matched through a
+  // ConversionIndex filled once per event
+  static ConversionInfo fromConversion(const reco::Conversion& conv,
+				       const reco::BeamSpot& beamSpot);
+
   static float mee(float ipx1, float ipy1, float ipz1, 
 		   float ipx2, float ipy2, float ipz2);
 
@@ -79,4 +80,39 @@ public:
   
 };
 
+// Per-event index of the conversions: the quantities of each conversion are
+// computed once and its tracks are mapped to it by (ProductID, key), so that
+// matching an electron is a lookup of its GSF track. A track shared by
+// several conversions gets the quantities of the last one, and is the
+// matched lead (trail) track if it leads (trails) any of them
+class ConversionIndex {
+
+ public:
+
+  // replaces the content, false (and empty) if the inputs are not valid
+  bool fill(const edm::Handle<reco::BeamSpot>& beamSpot,
+	    const edm::Handle<edm::View<reco::Conversion> >& conversions);
+
+  // what fill does, one conversion at a time
+  void clear();
+  void add(const reco::Conversion& conv, const reco::BeamSpot& beamSpot);
+
+  // info of the conversion with the electron GSF track, if any
+  bool match(const pat::Electron& ele, ConversionInfo& info) const;
+  bool match(const reco::GsfTrackRef& gsf, ConversionInfo& info) const;
+
+  size_t size() const { return infos_.size(); }
+
+ private:
+
+  struct Track {
+    size_t conversion = 0; // last one with the track, in infos_
+    edm::RefToBase<reco::Track> lead, trail; // set if the track leads (trails) any of them
+  };
+
+  std::vector<ConversionInfo> infos_;
+  std::unordered_map<ProductKey, Track, ProductKeyHash> tracks_;
+
+};
+
 #endif // ConversionInfo_h
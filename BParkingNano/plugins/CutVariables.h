@@ -0,0 +1,38 @@
+#ifndef PhysicsTools_BParkingNano_CutVariables
+#define PhysicsTools_BParkingNano_CutVariables
+
+#include <algorithm>
+#include <regex>
+#include <string>
+#include <vector>
+
+// Names of the user data read by string cuts, e.g. sv_prob in
+// "userFloat('sv_prob') > 0.001". A builder writing its variables elsewhere
+// (its own flat table) only attaches to the candidates those the cuts need:
+//   CutVariables vars;
+//   vars.add(cfg.getParameter<std::string>("postVtxSelection"));
+//   if(vars.uses("sv_prob")) cand.addUserFloat("sv_prob", prob);
+// Floats and ints are not told apart, the cuts read each name as one or the
+// other.
+class CutVariables {
+public:
+  void add(const std::string &cut) {
+    static const std::regex user_data("[uU]ser(Float|Int)\\s*\\(\\s*[\"']([^\"']+)[\"']");
+    for(std::sregex_iterator match(cut.begin(), cut.end(), user_data), end; match != end; ++match) {
+      const std::string name = (*match)[2];
+      if(!uses(name.c_str())) names_.push_back(name);
+    }
+  }
+
+  // a handful of names at most: a scan is faster than any lookup structure
+  bool uses(const char *name) const {
+    return std::find(names_.begin(), names_.end(), name) != names_.end();
+  }
+
+  const std::vector<std::string> & names() const { return names_; }
+
+private:
+  std::vector<std::string> names_;
+};
+
+#endif
@@ -17,15 +17,20 @@
 #include "helper.h"
 #include <limits>
 #include <algorithm>
+#include <iterator>
 #include "KinVtxFitter.h"
+#include "NBodyBuilder.h"
+#include "CompositeFactory.h"
+#include "WorkingPoints.h"
 
-template<typename Lepton>
+template<typename Lepton, typename Composite = pat::CompositeCandidate>
 class DiLeptonBuilder : public edm::global::EDProducer<> {
 
   // perhaps we need better structure here (begin run etc)
 public:
   typedef std::vector<Lepton> LeptonCollection;
-  typedef std::vector<reco::TransientTrack> TransientTrackCollection;
+  typedef std::vector<Composite> CompositeCollection;
+  typedef bph::LazyTransientTrackCollection TransientTrackCollection;
 
   explicit DiLeptonBuilder(const edm::ParameterSet &cfg):
     l1_selection_{cfg.getParameter<std::string>("lep1Selection")},
@@ -33,9 +38,18 @@ public:
     filter_by_selection_{cfg.getParameter<bool>("filterBySelection")},
     pre_vtx_selection_{cfg.getParameter<std::string>("preVtxSelection")},
     post_vtx_selection_{cfg.getParameter<std::string>("postVtxSelection")},
+    working_points_{working_points(cfg)},
+    wp_l1_selection_{working_points_, "lep1Selection"},
+    wp_l2_selection_{working_points_, "lep2Selection"},
+    wp_pre_vtx_selection_{working_points_, "preVtxSelection"},
+    wp_post_vtx_selection_{working_points_, "postVtxSelection"},
     src_{consumes<LeptonCollection>( cfg.getParameter<edm::InputTag>("src") )},
-    ttracks_src_{consumes<TransientTrackCollection>( cfg.getParameter<edm::InputTag>("transientTracksSrc") )} {
-       produces<pat::CompositeCandidateCollection>("SelectedDiLeptons");
+    ttracks_src_{consumes<TransientTrackCollection>( cfg.getParameter<edm::InputTag>("transientTracksSrc") )},
+    factory_{bph::CompactSchema(
+        {"lep_deltaR", "sv_chi2", "sv_ndof", "sv_prob", "fitted_mass", "fitted_massErr"},
+        {"l1_idx", "l2_idx", "nlowpt", "pre_vtx_sel", "post_vtx_sel", "wp_mask"},
+        {"l1", "l2"})} {
+       produces<CompositeCollection>("SelectedDiLeptons");
        produces<std::vector<KinVtxFitter> >("SelectedDiLeptonKinVtxs");
     }
 
@@ -49,14 +63,20 @@ private:
   const StringCutObjectSelector<Lepton> l1_selection_; // cut on leading lepton
   const StringCutObjectSelector<Lepton> l2_selection_; // cut on sub-leading lepton
   const bool filter_by_selection_;
-  const StringCutObjectSelector<pat::CompositeCandidate> pre_vtx_selection_; // cut on the di-lepton before the SV fit
-  const StringCutObjectSelector<pat::CompositeCandidate> post_vtx_selection_; // cut on the di-lepton after the SV fit
+  const StringCutObjectSelector<Composite> pre_vtx_selection_; // cut on the di-lepton before the SV fit
+  const StringCutObjectSelector<Composite> post_vtx_selection_; // cut on the di-lepton after the SV fit
+  const std::vector<edm::ParameterSet> working_points_; // see WorkingPoints.h
+  const WorkingPointCut<Lepton> wp_l1_selection_;
+  const WorkingPointCut<Lepton> wp_l2_selection_;
+  const WorkingPointCut<Composite> wp_pre_vtx_selection_;
+  const WorkingPointCut<Composite> wp_post_vtx_selection_;
   const edm::EDGetTokenT<LeptonCollection> src_;
   const edm::EDGetTokenT<TransientTrackCollection> ttracks_src_;
+  const CompositeFactory<Composite> factory_;
 };
 
-template<typename Lepton>
-void DiLeptonBuilder<Lepton>::produce(edm::StreamID, edm::Event &evt, edm::EventSetup const &) const {
+template<typename Lepton, typename Composite>
+void DiLeptonBuilder<Lepton, Composite>::produce(edm::StreamID, edm::Event &evt, edm::EventSetup const &) const {
 
   //input
   edm::Handle<LeptonCollection> leptons;
@@ -65,25 +85,60 @@ void DiLeptonBuilder<Lepton>::produce(edm::StreamID, edm::Event &evt, edm::Event
   edm::Handle<TransientTrackCollection> ttracks;
   evt.getByToken(ttracks_src_, ttracks);
 
-  // output
-  std::unique_ptr<pat::CompositeCandidateCollection> ret_value(new pat::CompositeCandidateCollection());
-  std::unique_ptr<std::vector<KinVtxFitter> > kinVtx_out( new std::vector<KinVtxFitter> );
-  
-  for(size_t l1_idx = 0; l1_idx < leptons->size(); ++l1_idx) {
-    edm::Ptr<Lepton> l1_ptr(leptons, l1_idx);
-    if(!l1_selection_(*l1_ptr)) continue; 
-    
-    for(size_t l2_idx = l1_idx + 1; l2_idx < leptons->size(); ++l2_idx) {
+  // lepton preselections and PF flag, evaluated once per lepton
+  // (-1 when the lepton carries no isPF flag, e.g. muons)
+  std::vector<char> l1_sel, l2_sel;
+  std::vector<int> is_pf;
+  l1_sel.reserve(leptons->size());
+  l2_sel.reserve(leptons->size());
+  is_pf.reserve(leptons->size());
+  for(const auto & lep : *leptons) {
+    l1_sel.push_back(l1_selection_(lep));
+    l2_sel.push_back(l2_selection_(lep));
+    is_pf.push_back(lep.hasUserInt("isPF") ? lep.userInt("isPF") : -1);
+  }
+  // working points failed by each lepton as leading and sub-leading one
+  const size_t n_wps = working_points_.size();
+  std::vector<uint32_t> l1_wp_failed, l2_wp_failed;
+  if(n_wps > 0) {
+    l1_wp_failed.reserve(leptons->size());
+    l2_wp_failed.reserve(leptons->size());
+    for(size_t lep_idx = 0; lep_idx < leptons->size(); ++lep_idx) {
+      l1_wp_failed.push_back(wp_l1_selection_.failed(leptons->at(lep_idx), l1_sel[lep_idx]));
+      l2_wp_failed.push_back(wp_l2_selection_.failed(leptons->at(lep_idx), l2_sel[lep_idx]));
+    }
+  }
+
+  // the products themselves: the pairs are built serially, straight into them
+  struct Output {
+    std::unique_ptr<CompositeCollection> pairs{new CompositeCollection()};
+    std::unique_ptr<std::vector<KinVtxFitter> > kinVtxs{new std::vector<KinVtxFitter>()};
+
+    void append(Output && other) {
+      pairs->insert(pairs->end(), std::make_move_iterator(other.pairs->begin()), std::make_move_iterator(other.pairs->end()));
+      kinVtxs->insert(kinVtxs->end(), std::make_move_iterator(other.kinVtxs->begin()), std::make_move_iterator(other.kinVtxs->end()));
+    }
+  };
+
+  const nbody::Combinatorics<2> combinatorics({{
+        {leptons->size(), &l1_sel},    // leading lepton
+        {leptons->size(), &l2_sel, 0}  // sub-leading lepton, after the leading one
+      }});
+
+  Output output;
+  combinatorics.run(false, output, [&](const nbody::Indices<2> &idx, Output &out) {
+      const size_t l1_idx = idx[0];
+      const size_t l2_idx = idx[1];
+      edm::Ptr<Lepton> l1_ptr(leptons, l1_idx);
       edm::Ptr<Lepton> l2_ptr(leptons, l2_idx);
-      if(!l2_selection_(*l2_ptr)) continue;
 
-      pat::CompositeCandidate lepton_pair;
+      Composite lepton_pair = factory_.make();
       lepton_pair.setP4(l1_ptr->p4() + l2_ptr->p4());
       lepton_pair.setCharge(l1_ptr->charge() + l2_ptr->charge());
       lepton_pair.addUserFloat("lep_deltaR", reco::deltaR(*l1_ptr, *l2_ptr));
       int nlowpt=0;
-      if (l1_ptr->hasUserInt("isPF") && l2_ptr->hasUserInt("isPF"))
-         nlowpt= 2-l1_ptr->userInt("isPF")-l2_ptr->userInt("isPF");
+      if (is_pf[l1_idx] >= 0 && is_pf[l2_idx] >= 0)
+         nlowpt= 2-is_pf[l1_idx]-is_pf[l2_idx];
       
         // Put the lepton passing the corresponding selection
       lepton_pair.addUserInt("l1_idx", l1_idx );
@@ -95,12 +150,17 @@ void DiLeptonBuilder<Lepton>::produce(edm::StreamID, edm::Event &evt, edm::Event
 
       bool pre_vtx_sel = pre_vtx_selection_(lepton_pair); // before making the SV, cut on the info we have
       lepton_pair.addUserInt("pre_vtx_sel",pre_vtx_sel);
-      if( filter_by_selection_ && !pre_vtx_sel ) continue;
-
-      KinVtxFitter fitter(
-        {ttracks->at(l1_idx), ttracks->at(l2_idx)},
-        {l1_ptr->mass(), l2_ptr->mass()},
-        {LEP_SIGMA, LEP_SIGMA} //some small sigma for the particle mass
+      if( filter_by_selection_ && !pre_vtx_sel ) return;
+      uint32_t wp_failed = 0;
+      if(n_wps > 0) {
+        wp_failed = l1_wp_failed[l1_idx] | l2_wp_failed[l2_idx] |
+                    wp_pre_vtx_selection_.failed(lepton_pair, pre_vtx_sel);
+      }
+
+      KinVtxFitter fitter = nbody::fit<2>(
+        {{&ttracks->at(l1_idx).get(), &ttracks->at(l2_idx).get()}},
+        {{l1_ptr->mass(), l2_ptr->mass()}},
+        {{LEP_SIGMA, LEP_SIGMA}} //some small sigma for the particle mass
         );
       lepton_pair.addUserFloat("sv_chi2", fitter.chi2());
       lepton_pair.addUserFloat("sv_ndof", fitter.dof()); // float??
@@ -112,22 +172,35 @@ void DiLeptonBuilder<Lepton>::produce(edm::StreamID, edm::Event &evt, edm::Event
       // cut on the SV info
       bool post_vtx_sel = post_vtx_selection_(lepton_pair);
       lepton_pair.addUserInt("post_vtx_sel",post_vtx_sel);
-      if( filter_by_selection_ && !post_vtx_sel ) continue;
+      if( filter_by_selection_ && !post_vtx_sel ) return;
+      if(n_wps > 0) {
+        wp_failed |= wp_post_vtx_selection_.failed(lepton_pair, post_vtx_sel);
+        lepton_pair.addUserInt("wp_mask", working_point_mask(n_wps, wp_failed));
+      }
 
-      ret_value->push_back(lepton_pair);
-      kinVtx_out->push_back(fitter);
-    }
-  }
-  
-  evt.put(std::move(ret_value), "SelectedDiLeptons");
-  evt.put(std::move(kinVtx_out), "SelectedDiLeptonKinVtxs");
+      out.pairs->push_back(std::move(lepton_pair));
+      out.kinVtxs->push_back(std::move(fitter));
+    });
+
+  // output
+  evt.put(std::move(output.pairs), "SelectedDiLeptons");
+  evt.put(std::move(output.kinVtxs), "SelectedDiLeptonKinVtxs");
 }
 
 #include "DataFormats/PatCandidates/interface/Muon.h"
 #include "DataFormats/PatCandidates/interface/Electron.h"
 typedef DiLeptonBuilder<pat::Muon> DiMuonBuilder;
 typedef DiLeptonBuilder<pat::Electron> DiElectronBuilder;
+typedef DiLeptonBuilder<pat::Muon, bph::CompactCompositeCandidate> CompactDiMuonBuilder;
+typedef DiLeptonBuilder<pat::Electron, bph::CompactCompositeCandidate> CompactDiElectronBuilder;
+#include "PhysicsTools/BParkingNano/interface/ElectronOverlay.h"
+typedef DiLeptonBuilder<bph::ElectronOverlay> OverlayDiElectronBuilder;
+typedef DiLeptonBuilder<bph::ElectronOverlay, bph::CompactCompositeCandidate> CompactOverlayDiElectronBuilder;
 
 #include "FWCore/Framework/interface/MakerMacros.h"
 DEFINE_FWK_MODULE(DiMuonBuilder);
 DEFINE_FWK_MODULE(DiElectronBuilder);
+DEFINE_FWK_MODULE(CompactDiMuonBuilder);
+DEFINE_FWK_MODULE(CompactDiElectronBuilder);
+DEFINE_FWK_MODULE(OverlayDiElectronBuilder);
+DEFINE_FWK_MODULE(CompactOverlayDiElectronBuilder);
@@ -1,13 +1,23 @@
 // Merges the PF and LowPT collections, sets the isPF and isLowPt 
-// UserInt's accordingly
-
-#include "FWCore/Framework/interface/global/EDProducer.h"
+// UserInt's accordingly. The selected electrons are written as copies of the
+// input ones (ElectronMerger) or as overlays on them (ElectronOverlayMerger,
+// see ElectronOverlay.h)
+// Optionally, the energy regression (as ElectronRegresser) and the low pT
+// seeding and ID values (as PATLowPtElectronSeedingEmbedder) are applied in
+// the same pass, so that only the selected electrons are stored. The
+// regression modifiers keep per-event state (setEvent, setEventContent): the
+// merger is a stream module, so that each stream has its own
+
+#include "FWCore/Framework/interface/stream/EDProducer.h"
 #include "FWCore/Framework/interface/Event.h"
 #include "FWCore/ParameterSet/interface/ParameterSet.h"
 #include "FWCore/ParameterSet/interface/ConfigurationDescriptions.h"
 #include "FWCore/ParameterSet/interface/ParameterSetDescription.h"
 #include "FWCore/Utilities/interface/InputTag.h"
+#include "FWCore/Utilities/interface/Exception.h"
 #include "DataFormats/Common/interface/View.h"
+#include "DataFormats/Common/interface/ValueMap.h"
+#include "CommonTools/CandAlgos/interface/ModifyObjectValueBase.h"
 
 #include "DataFormats/Candidate/interface/Candidate.h"
 #include "DataFormats/PatCandidates/interface/PATObject.h"
@@ -23,13 +33,62 @@
 #include "DataFormats/VertexReco/interface/VertexFwd.h"
 #include "DataFormats/EgammaCandidates/interface/Conversion.h"
 #include "DataFormats/BeamSpot/interface/BeamSpot.h"
+#include "PhysicsTools/BParkingNano/interface/ElectronOverlay.h"
 #include "ConversionInfo.h"
+#include "UserKey.h"
+#include "ScratchBuffers.h"
 
 #include <limits>
 #include <algorithm>
+#include <type_traits>
 #include "helper.h"
+#include "PhysicsTools/BParkingNano/interface/DeltaR2.h"
+
+namespace {
+  // per-event scratch, see ScratchBuffers.h
+  template<typename Electron>
+  struct ElectronMergerScratch {
+    std::vector<float> pfEta, pfPhi, pfVz;
+    std::vector<float> pfDR2; // deltaR^2 of one low pT electron to the PF ones
+    ConversionIndex conversions;
+    // selected electrons and their pT, moved in pT order to the output
+    std::vector<Electron> electrons;
+    std::vector<double> pt;
+    std::vector<size_t> order;
+    ScratchMarks marks;
+  };
+
+  // Creates the selected electron from the input one, once it passed the
+  // selection: a copy (taking over the regressed one if any), or an overlay
+  // sharing the schema of the merger
+  template<typename Electron> class ElectronFactory;
+
+  template<>
+  class ElectronFactory<pat::Electron> {
+  public:
+    explicit ElectronFactory(const bph::CompactSchema &) {}
+    // moves out of *regressed: the caller reads what it needs from it before
+    pat::Electron make(const edm::Handle<pat::ElectronCollection> &src, size_t idx, pat::Electron *regressed) const {
+      return regressed ? std::move(*regressed) : (*src)[idx];
+    }
+  };
+
+  template<>
+  class ElectronFactory<bph::ElectronOverlay> {
+  public:
+    explicit ElectronFactory(const bph::CompactSchema &schema):
+      schema_{&bph::CompactSchema::registerSchema(schema)} {}
+    // overlays are never regressed, see the merger constructor
+    bph::ElectronOverlay make(const edm::Handle<pat::ElectronCollection> &src, size_t idx, pat::Electron *) const {
+      return bph::ElectronOverlay(*schema_, edm::Ptr<pat::Electron>(src, idx));
+    }
+  private:
+    const bph::CompactSchema * schema_;
+  };
+}
 
-class ElectronMerger : public edm::global::EDProducer<> {
+template<typename Electron>
+class ElectronMergerT : public edm::stream::EDProducer<> {
 
   // perhaps we need better structure here (begin run etc)
 
@@ -37,56 +96,134 @@ class ElectronMerger : public edm::global::EDProducer<> {
 public:
   bool debug=false; 
 
-  explicit ElectronMerger(const edm::ParameterSet &cfg):
-    ttbToken_(esConsumes(edm::ESInputTag{"","TransientTrackBuilder"})),
-    triggerLeptons_{ consumes<edm::View<reco::Candidate> >( cfg.getParameter<edm::InputTag>("trgLepton") )},
-    lowpt_src_{consumes<pat::ElectronCollection>( cfg.getParameter<edm::InputTag>("lowptSrc") )},
-    pf_src_{ consumes<pat::ElectronCollection>( cfg.getParameter<edm::InputTag>("pfSrc") )},
+  typedef std::vector<Electron> ElectronCollection;
+  typedef ElectronMergerScratch<Electron> Scratch;
+
+  explicit ElectronMergerT(const edm::ParameterSet &cfg):
+    ttbToken_(this->esConsumes(edm::ESInputTag{"","TransientTrackBuilder"})),
+    triggerLeptons_{ this->template consumes<edm::View<reco::Candidate> >( preselection(cfg).getParameter<edm::InputTag>("trgLepton") )},
+    lowpt_src_{this->template consumes<pat::ElectronCollection>( cfg.getParameter<edm::InputTag>("lowptSrc") )},
+    pf_src_{ this->template consumes<pat::ElectronCollection>( cfg.getParameter<edm::InputTag>("pfSrc") )},
     pf_mvaId_src_(),
     pf_mvaId_src_Tag_(cfg.getParameter<edm::InputTag>("pfmvaId")),
     pf_mvaId_src_run2_(),
     pf_mvaId_src_Tag_run2_(cfg.getParameter<edm::InputTag>("pfmvaId_Run2")),
     //pf_mvaId_src_run3_(),
     //pf_mvaId_src_Tag_run3_(cfg.getParameter<edm::InputTag>("pfmvaId_Run3")),
-    vertexSrc_{ consumes<reco::VertexCollection> ( cfg.getParameter<edm::InputTag>("vertexCollection") )},
-    conversions_{ consumes<edm::View<reco::Conversion> > ( cfg.getParameter<edm::InputTag>("conversions") )},
-    beamSpot_{ consumes<reco::BeamSpot> ( cfg.getParameter<edm::InputTag>("beamSpot") )},
+    vertexSrc_{ this->template consumes<reco::VertexCollection> ( cfg.getParameter<edm::InputTag>("vertexCollection") )},
+    conversions_{ this->template consumes<edm::View<reco::Conversion> > ( cfg.getParameter<edm::InputTag>("conversions") )},
+    beamSpot_{ this->template consumes<reco::BeamSpot> ( cfg.getParameter<edm::InputTag>("beamSpot") )},
     drTrg_cleaning_{cfg.getParameter<double>("drForCleaning_wrtTrgLepton")},
-    dzTrg_cleaning_{cfg.getParameter<double>("dzForCleaning_wrtTrgLepton")},
+    dzTrg_cleaning_{preselection(cfg).getParameter<double>("dzForCleaning_wrtTrgLepton")},
     dr_cleaning_{cfg.getParameter<double>("drForCleaning")},
     dz_cleaning_{cfg.getParameter<double>("dzForCleaning")},
     flagAndclean_{cfg.getParameter<bool>("flagAndclean")},
-    pf_ptMin_{cfg.getParameter<double>("pf_ptMin")},
-    ptMin_{cfg.getParameter<double>("ptMin")},
-    etaMax_{cfg.getParameter<double>("etaMax")},
+    pf_ptMin_{preselection(cfg).getParameter<double>("pf_ptMin")},
+    ptMin_{preselection(cfg).getParameter<double>("ptMin")},
+    etaMax_{preselection(cfg).getParameter<double>("etaMax")},
     bdtMin_{cfg.getParameter<double>("bdtMin")},
     use_gsf_mode_for_p4_{cfg.getParameter<bool>("useGsfModeForP4")},
     use_regression_for_p4_{cfg.getParameter<bool>("useRegressionModeForP4")},
     sortOutputCollections_{cfg.getParameter<bool>("sortOutputCollections")},
     saveLowPtE_{cfg.getParameter<bool>("saveLowPtE")},
-    filterEle_{cfg.getParameter<bool>("filterEle")},
-    addUserVarsExtra_{cfg.getParameter<bool>("addUserVarsExtra")}
+    filterEle_{preselection(cfg).getParameter<bool>("filterEle")},
+    addUserVarsExtra_{cfg.getParameter<bool>("addUserVarsExtra")},
+    debug_scratch_{scratch_debug(cfg)},
+    factory_{bph::CompactSchema(
+        {"LPEleSeed_Fall17PtBiasedV1RawValue", "LPEleSeed_Fall17UnBiasedV1RawValue", "LPEleMvaID_2020Sept15RawValue",
+         "PFEleMvaID_RetrainedRawValue", "PFEleMvaID_Fall17NoIsoV2RawValue", "chargeMode", "dzTrg"},
+        {"isPF", "isLowPt", "isPFoverlap", "skipEle",
+         "PFEleMvaID_Fall17NoIsoV1wpLoose", "PFEleMvaID_Fall17NoIsoV2wpLoose",
+         "PFEleMvaID_Fall17NoIsoV2wp90", "PFEleMvaID_Fall17NoIsoV2wp80",
+         "convOpen", "convLoose", "convTight", "convLead", "convTrail", "convExtra"},
+        {})}
     {
-       produces<pat::ElectronCollection>("SelectedElectrons");
-       produces<TransientTrackCollection>("SelectedTransientElectrons");  
+       this->template produces<ElectronCollection>("SelectedElectrons");
+       this->template produces<TransientTrackCollection>("SelectedTransientElectrons");  
        if ( !pf_mvaId_src_Tag_.label().empty() ) {
-	 pf_mvaId_src_ = consumes<edm::ValueMap<float> > ( cfg.getParameter<edm::InputTag>("pfmvaId") );
+	 pf_mvaId_src_ = this->template consumes<edm::ValueMap<float> > ( cfg.getParameter<edm::InputTag>("pfmvaId") );
        }
        if ( !pf_mvaId_src_Tag_run2_.label().empty() ) {
-	 pf_mvaId_src_run2_ = consumes<edm::ValueMap<float> > ( cfg.getParameter<edm::InputTag>("pfmvaId_Run2") );
+	 pf_mvaId_src_run2_ = this->template consumes<edm::ValueMap<float> > ( cfg.getParameter<edm::InputTag>("pfmvaId_Run2") );
        }
 //       if ( !pf_mvaId_src_Tag_run3_.label().empty() ) {
 //	 pf_mvaId_src_run3_ = consumes<edm::ValueMap<float> > ( cfg.getParameter<edm::InputTag>("pfmvaId_Run3") );
 //       }
+       // regression (optional), configured as in ElectronRegresser
+       regressionGsf_ = regression(cfg, "gsfRegressionConfig");
+       regression_ = regression(cfg, "lowPtRegressionConfig");
+       // the MVA maps would skip electrons passing the pT cut after the regression only
+       if ( regressionGsf_ && preselection(cfg).getParameter<bool>("mvaPtCut") ) {
+	 throw cms::Exception("Configuration") << "the PF electrons are cut on the regressed pT, while the MVA value maps "
+					       << "cut on the input pT: set mvaPtCut to False in the preselection";
+       }
+       if ( std::is_same<Electron, bph::ElectronOverlay>::value && (regressionGsf_ || regression_) ) {
+	 throw cms::Exception("Configuration") << "electron overlays refer to the input electrons, they cannot be regressed";
+       }
+       // low pT seeding and ID values (optional), instead of the ones embedded in the electrons
+       if ( cfg.existsAs<edm::ParameterSet>("lowPtSeeding") ) {
+	 const edm::ParameterSet & seeding = cfg.getParameterSet("lowPtSeeding");
+	 seeding_ = true;
+	 ptBiased_src_ = this->template consumes<edm::ValueMap<float> > ( seeding.getParameter<edm::InputTag>("ptbiasedSeeding") );
+	 unBiased_src_ = this->template consumes<edm::ValueMap<float> > ( seeding.getParameter<edm::InputTag>("unbiasedSeeding") );
+	 lowpt_mvaId_src_ = this->template consumes<edm::ValueMap<float> > ( seeding.getParameter<edm::InputTag>("mvaId") );
+	 minBdtUnbiased_ = seeding.getParameter<double>("minBdtUnbiased");
+       }
     }
 
-  ~ElectronMerger() override {}
+  ~ElectronMergerT() override {}
   
-  void produce(edm::StreamID, edm::Event&, const edm::EventSetup&) const override;
+  void produce(edm::Event&, const edm::EventSetup&) override;
+  void endStream() override {
+    if(debug_scratch_) scratch_.marks.report(this->moduleDescription().moduleLabel(), stream_);
+  }
 
   static void fillDescriptions(edm::ConfigurationDescriptions &descriptions) {}
   
 private:
+  // pT, eta, dz wrt the trigger leptons: the PSet is shared with the MVA
+  // value maps evaluated only for the electrons passing it
+  static const edm::ParameterSet & preselection(const edm::ParameterSet &cfg) {
+    return cfg.getParameterSet("preselection");
+  }
+
+  // null if the PSet is not in the configuration
+  std::unique_ptr<ModifyObjectValueBase> regression(const edm::ParameterSet &cfg, const std::string &name) {
+    if ( !cfg.existsAs<edm::ParameterSet>(name) ) return nullptr;
+    auto const& iconf = cfg.getParameterSet(name);
+    auto const& mname = iconf.getParameter<std::string>("modifierName");
+    auto cc = this->consumesCollector();
+    return ModifyObjectValueFactory::get()->create(mname,iconf,cc);
+  }
+
+  // the regressed copy of ele, stored in out
+  static const pat::Electron & regress(ModifyObjectValueBase &modifier, const pat::Electron &ele, pat::Electron &out) {
+    out = ele;
+    modifier.modifyObject(out);
+    return out;
+  }
+
+  // four-momentum of a selected electron, see useRegressionModeForP4 and useGsfModeForP4
+  reco::Candidate::PolarLorentzVector selectedP4(const pat::Electron &ele) const {
+    if (use_regression_for_p4_) {
+      // pt from regression, eta and phi from gsf track mode
+      return reco::Candidate::PolarLorentzVector(ele.pt(),
+						 ele.gsfTrack()->etaMode(),
+						 ele.gsfTrack()->phiMode(),
+						 ELECTRON_MASS);
+    } else if (use_gsf_mode_for_p4_) {
+      return reco::Candidate::PolarLorentzVector(ele.gsfTrack()->ptMode(),
+						 ele.gsfTrack()->etaMode(),
+						 ele.gsfTrack()->phiMode(),
+						 ELECTRON_MASS);
+    }
+    // Fix the mass to the proper one
+    return reco::Candidate::PolarLorentzVector(ele.pt(),
+					       ele.eta(),
+					       ele.phi(),
+					       ELECTRON_MASS);
+  }
+
   const edm::ESGetToken<TransientTrackBuilder, TransientTrackRecord> ttbToken_;
   const edm::EDGetTokenT<edm::View<reco::Candidate> > triggerLeptons_;
   const edm::EDGetTokenT<pat::ElectronCollection> lowpt_src_;
@@ -115,10 +252,33 @@ private:
   const bool saveLowPtE_;
   const bool filterEle_;
   const bool addUserVarsExtra_;
+  const bool debug_scratch_;
+  // electron IDs, resolved on the first electron
+  const UserKey pf_id_fall17_v1_wpLoose_{"mvaEleID-Fall17-noIso-V1-wpLoose"};
+  const UserKey pf_id_fall17_v2_wpLoose_{"mvaEleID-Fall17-noIso-V2-wpLoose"};
+  const UserKey pf_id_fall17_v2_wp90_{"mvaEleID-Fall17-noIso-V2-wp90"};
+  const UserKey pf_id_fall17_v2_wp80_{"mvaEleID-Fall17-noIso-V2-wp80"};
+  const UserKey lowpt_id_{"ID"};
+  const UserKey lowpt_unbiased_{"unbiased"};
+  const UserKey lowpt_ptbiased_{"ptbiased"};
+  const ElectronFactory<Electron> factory_;
+  // regression stuff, one modifier per stream
+  std::unique_ptr<ModifyObjectValueBase> regression_; // Low pt
+  std::unique_ptr<ModifyObjectValueBase> regressionGsf_; // Gsf
+  // low pT seeding stuff
+  bool seeding_ = false;
+  edm::EDGetTokenT<edm::ValueMap<float> > ptBiased_src_;
+  edm::EDGetTokenT<edm::ValueMap<float> > unBiased_src_;
+  edm::EDGetTokenT<edm::ValueMap<float> > lowpt_mvaId_src_;
+  double minBdtUnbiased_ = 0.;
+  // per-event scratch, see ScratchBuffers.h
+  Scratch scratch_;
+  unsigned int stream_ = 0;
 
 };
 
-void ElectronMerger::produce(edm::StreamID, edm::Event &evt, edm::EventSetup const & iSetup) const {
+template<typename Electron>
+void ElectronMergerT<Electron>::produce(edm::Event &evt, edm::EventSetup const & iSetup) {
 
   //input
   edm::Handle<edm::View<reco::Candidate> > trgLepton;
@@ -133,6 +293,20 @@ void ElectronMerger::produce(edm::StreamID, edm::Event &evt, edm::EventSetup con
   if ( !pf_mvaId_src_Tag_run2_.label().empty() ) { evt.getByToken(pf_mvaId_src_run2_, pfmvaId_run2); }
   //edm::Handle<edm::ValueMap<float> > pfmvaId_run3;
   //if ( !pf_mvaId_src_Tag_run3_.label().empty() ) { evt.getByToken(pf_mvaId_src_run3_, pfmvaId_run3); }
+  edm::Handle<edm::ValueMap<float> > ptBiased, unBiased, lowptMvaId;
+  if ( saveLowPtE_ && seeding_ ) {
+    evt.getByToken(ptBiased_src_, ptBiased);
+    evt.getByToken(unBiased_src_, unBiased);
+    evt.getByToken(lowpt_mvaId_src_, lowptMvaId);
+  }
+  if ( regressionGsf_ ) {
+    regressionGsf_->setEvent(evt);
+    regressionGsf_->setEventContent(iSetup);
+  }
+  if ( saveLowPtE_ && regression_ ) {
+    regression_->setEvent(evt);
+    regression_->setEventContent(iSetup);
+  }
 
   const auto& theB = iSetup.getData(ttbToken_);
   //
@@ -146,66 +320,69 @@ void ElectronMerger::produce(edm::StreamID, edm::Event &evt, edm::EventSetup con
   evt.getByToken(beamSpot_, beamSpot);
 
   // output
-  std::unique_ptr<pat::ElectronCollection>  ele_out      (new pat::ElectronCollection );
+  std::unique_ptr<ElectronCollection>       ele_out      (new ElectronCollection );
   std::unique_ptr<TransientTrackCollection> trans_ele_out(new TransientTrackCollection);
-  std::vector<std::pair<float, float>> pfEtaPhi;
-  std::vector<float> pfVz;
+  Scratch & scratch = scratch_;
+  stream_ = evt.streamID().value();
+  // conversion quantities computed once, electrons matched by GSF track
+  ConversionIndex & conv_index = scratch.conversions;
+  conv_index.fill(beamSpot, conversions);
+  if(debug_scratch_) scratch.marks.mark("conversions", conv_index.size());
+  std::vector<float> & pfEta = scratch.pfEta;
+  std::vector<float> & pfPhi = scratch.pfPhi;
+  std::vector<float> & pfVz = scratch.pfVz;
+  std::vector<float> & pfDR2 = scratch.pfDR2;
+  pfEta.clear();
+  pfPhi.clear();
+  pfVz.clear();
+  ElectronCollection & electrons = scratch.electrons;
+  std::vector<double> & electrons_pt = scratch.pt;
+  electrons.clear();
+  electrons_pt.clear();
   
   // -> changing order of loops ert Arabella's fix this without need for more vectors  
-  size_t ipfele=-1;
-  for(auto ele : *pf) {
-   ipfele++;
-
-   if (debug) std::cout << "ElectronMerger, Event " << (evt.id()).event() 
-			<< " => PF: ele.superCluster()->rawEnergy() = " << ele.superCluster()->rawEnergy()
-			<< ", ele.correctedEcalEnergy() = " << ele.correctedEcalEnergy()
-			<< ", ele gsf track chi2 = " << ele.gsfTrack()->normalizedChi2()
-			<< ", ele.p = " << ele.p() << std::endl;
+  // the selection reads the input electrons, only the selected ones are copied
+  // (or overlaid) to the output. The regression changes the energy only: the
+  // other cuts are applied to the input electron, and only the electrons
+  // passing them are regressed, in a copy reused by the output, for the pT cut
+  pat::Electron regressed;
+  for(size_t ipfele = 0; ipfele < pf->size(); ++ipfele) {
+   const pat::Electron & in = (*pf)[ipfele];
 
    //cuts
-   if (ele.pt()<ptMin_ || ele.pt() < pf_ptMin_) continue;
-   if (fabs(ele.eta())>etaMax_) continue;
+   if (fabs(in.eta())>etaMax_) continue;
    // apply conversion veto unless we want conversions
-   if (!ele.passConversionVeto()) continue;
+   if (!in.passConversionVeto()) continue;
 
    // take modes?
-   if (use_regression_for_p4_) {
-     // pt from regression, eta and phi from gsf track mode
-     reco::Candidate::PolarLorentzVector p4(ele.pt(),
-					    ele.gsfTrack()->etaMode(),
-					    ele.gsfTrack()->phiMode(),
-					    ELECTRON_MASS);
-     ele.setP4(p4);
-   }else if(use_gsf_mode_for_p4_) {
-     reco::Candidate::PolarLorentzVector p4(ele.gsfTrack()->ptMode(),
-					    ele.gsfTrack()->etaMode(),
-					    ele.gsfTrack()->phiMode(),
-					    ELECTRON_MASS);
-     ele.setP4(p4);
-   } else {
-     // Fix the mass to the proper one
-     reco::Candidate::PolarLorentzVector p4(ele.pt(),
-					    ele.eta(),
-					    ele.phi(),
-					    ELECTRON_MASS);
-     ele.setP4(p4);
-   }
+   reco::Candidate::PolarLorentzVector p4 = selectedP4(in);
 
    // skip electrons inside tag's jet or from different PV
    bool skipEle=true;
    float dzTrg = 0.0;
    for(const auto & trg : *trgLepton) {
-     if(reco::deltaR(ele, trg) < drTrg_cleaning_ && drTrg_cleaning_ > 0)
+     if(reco::deltaR(p4, trg) < drTrg_cleaning_ && drTrg_cleaning_ > 0)
         continue;
-     if(fabs(ele.vz() - trg.vz()) > dzTrg_cleaning_ && dzTrg_cleaning_ > 0)
+     if(fabs(in.vz() - trg.vz()) > dzTrg_cleaning_ && dzTrg_cleaning_ > 0)
         continue;
      skipEle=false;
-     dzTrg = ele.vz() - trg.vz();
+     dzTrg = in.vz() - trg.vz();
      break; // one trg muon to pass is enough :)
    }
    // we skip evts without trg muon
    if (filterEle_ && skipEle) continue;
 
+   const pat::Electron & src = regressionGsf_ ? regress(*regressionGsf_, in, regressed) : in;
+   if (regressionGsf_) p4 = selectedP4(src);
+
+   if (debug) std::cout << "ElectronMerger, Event " << (evt.id()).event() 
+			<< " => PF: ele.superCluster()->rawEnergy() = " << src.superCluster()->rawEnergy()
+			<< ", ele.correctedEcalEnergy() = " << src.correctedEcalEnergy()
+			<< ", ele gsf track chi2 = " << src.gsfTrack()->normalizedChi2()
+			<< ", ele.p = " << src.p() << std::endl;
+
+   if (src.pt()<ptMin_ || src.pt() < pf_ptMin_) continue;
+
    // for PF e we set BDT outputs to much higher number than the max
    edm::Ref<pat::ElectronCollection> ref(pf,ipfele);
    float pf_mva_id = 20.;
@@ -214,6 +391,15 @@ void ElectronMerger::produce(edm::StreamID, edm::Event &evt, edm::EventSetup con
    if ( !pf_mvaId_src_Tag_run2_.label().empty() ) { pf_mva_id_run2 = float((*pfmvaId_run2)[ref]); }
    //float pf_mva_id_run3 = 20.;
    //if ( !pf_mvaId_src_Tag_run3_.label().empty() ) { pf_mva_id_run3 = float((*pfmvaId_run3)[ref]); }
+
+   // Attempt to match electrons to conversions in "gsfTracksOpenConversions" collection (NO MATCHES EXPECTED)
+   // done before make(), which moves the regressed electron src refers to
+   ConversionInfo info;
+   conv_index.match(src,info);
+   const float vz = src.vz();
+
+   Electron ele = factory_.make(pf, ipfele, regressionGsf_ ? &regressed : nullptr);
+   ele.setP4(p4);
    ele.addUserInt("isPF", 1);
    ele.addUserInt("isLowPt", 0);
    // Custom IDs
@@ -223,10 +409,10 @@ void ElectronMerger::produce(edm::StreamID, edm::Event &evt, edm::EventSetup con
    ele.addUserFloat("PFEleMvaID_RetrainedRawValue", pf_mva_id); // was called "pfmvaId"
    // Run-2 PF ele ID
    ele.addUserFloat("PFEleMvaID_Fall17NoIsoV2RawValue", pf_mva_id_run2);
-   ele.addUserInt("PFEleMvaID_Fall17NoIsoV1wpLoose", ref->electronID("mvaEleID-Fall17-noIso-V1-wpLoose")); //@@ to be deprecated
-   ele.addUserInt("PFEleMvaID_Fall17NoIsoV2wpLoose", ref->electronID("mvaEleID-Fall17-noIso-V2-wpLoose"));
-   ele.addUserInt("PFEleMvaID_Fall17NoIsoV2wp90", ref->electronID("mvaEleID-Fall17-noIso-V2-wp90"));
-   ele.addUserInt("PFEleMvaID_Fall17NoIsoV2wp80", ref->electronID("mvaEleID-Fall17-noIso-V2-wp80"));
+   ele.addUserInt("PFEleMvaID_Fall17NoIsoV1wpLoose", pf_id_fall17_v1_wpLoose_.electronID(*ref)); //@@ to be deprecated
+   ele.addUserInt("PFEleMvaID_Fall17NoIsoV2wpLoose", pf_id_fall17_v2_wpLoose_.electronID(*ref));
+   ele.addUserInt("PFEleMvaID_Fall17NoIsoV2wp90", pf_id_fall17_v2_wp90_.electronID(*ref));
+   ele.addUserInt("PFEleMvaID_Fall17NoIsoV2wp80", pf_id_fall17_v2_wp80_.electronID(*ref));
    // Run-3 PF ele ID
    //ele.addUserFloat("PFEleMvaID_Winter22NoIsoV1RawValue", pf_mva_id_run3);
    //ele.addUserInt("PFEleMvaID_Winter22NoIsoV1wp90", ref->electronID("mvaEleID-RunIIIWinter22-noIso-V1-wp90"));
@@ -237,62 +423,48 @@ void ElectronMerger::produce(edm::StreamID, edm::Event &evt, edm::EventSetup con
    ele.addUserFloat("dzTrg", dzTrg);
    ele.addUserInt("skipEle",skipEle);
 
-   // Attempt to match electrons to conversions in "gsfTracksOpenConversions" collection (NO MATCHES EXPECTED)
-   ConversionInfo info;
-   ConversionInfo::match(beamSpot,conversions,ele,info);
    info.addUserVars(ele);
    if ( addUserVarsExtra_ ) { info.addUserVarsExtra(ele); }
 
-   pfEtaPhi.push_back(std::pair<float, float>(ele.eta(), ele.phi()));
-   pfVz.push_back(ele.vz());
-   ele_out       -> emplace_back(ele);
+   pfEta.push_back(p4.eta());
+   pfPhi.push_back(p4.phi());
+   pfVz.push_back(vz);
+   electrons_pt.push_back(p4.pt());
+   electrons.emplace_back(std::move(ele));
   }
 
-  unsigned int pfSelectedSize = pfEtaPhi.size();
+  unsigned int pfSelectedSize = pfEta.size();
+  if(debug_scratch_) scratch.marks.mark("pfEtaPhi", pfSelectedSize);
+  pfDR2.resize(pfSelectedSize);
+  const float dr2_cleaning = dr_cleaning_*dr_cleaning_;
 
   if ( saveLowPtE_ ) {
-  size_t iele=-1;
   /// add and clean low pT e
-  for(auto ele : *lowpt) {
-    iele++;
-
-    if (debug) std::cout << "ElectronMerger, Event " << (evt.id()).event() 
-			 << " => LPT: ele.superCluster()->rawEnergy() = " << ele.superCluster()->rawEnergy()
-			 << ", ele.correctedEcalEnergy() = " << ele.correctedEcalEnergy()
-			 << ", ele gsf track chi2 = " << ele.gsfTrack()->normalizedChi2()
-			 << ", ele.p = " << ele.p() << std::endl;
+  for(size_t iele = 0; iele < lowpt->size(); ++iele) {
+   const pat::Electron & in = (*lowpt)[iele];
    
    // take modes?
-   if (use_regression_for_p4_) {
-     // pt from regression, eta and phi from gsf track mode
-     reco::Candidate::PolarLorentzVector p4(ele.pt(),
-					    ele.gsfTrack()->etaMode(),
-					    ele.gsfTrack()->phiMode(),
-					    ELECTRON_MASS);
-     ele.setP4(p4);
-   }else if(use_gsf_mode_for_p4_) {
-     reco::Candidate::PolarLorentzVector p4(ele.gsfTrack()->ptMode(),
-					    ele.gsfTrack()->etaMode(),
-					    ele.gsfTrack()->phiMode(),
-					    ELECTRON_MASS);
-     ele.setP4(p4);
-   } else {
-     // Fix the mass to the proper one
-     reco::Candidate::PolarLorentzVector p4(ele.pt(),
-					    ele.eta(),
-					    ele.phi(),
-					    ELECTRON_MASS);
-     ele.setP4(p4);
-   }
+   reco::Candidate::PolarLorentzVector p4 = selectedP4(in);
 
-   //same cuts as in PF
-   if (ele.pt()<ptMin_) continue;
-   if (fabs(ele.eta())>etaMax_) continue;
+   //same cuts as in PF, the pT one after the regression
+   if (fabs(p4.eta())>etaMax_) continue;
    // apply conversion veto?
-   if (!ele.passConversionVeto()) continue;
+   if (!in.passConversionVeto()) continue;
 
    //assigning BDT values
-   float mva_id = ( ele.isElectronIDAvailable("ID") ? ele.electronID("ID") : -100. );
+   float mva_id, unbiased_seedBDT, ptbiased_seedBDT;
+   if ( seeding_ ) {
+     // as PATLowPtElectronSeedingEmbedder
+     edm::Ref<pat::ElectronCollection> ref(lowpt,iele);
+     mva_id = float((*lowptMvaId)[ref]);
+     unbiased_seedBDT = float((*unBiased)[in.gsfTrack()]);
+     ptbiased_seedBDT = float((*ptBiased)[in.gsfTrack()]);
+     if ( unbiased_seedBDT < minBdtUnbiased_ ) continue;
+   } else {
+     mva_id = lowpt_id_.electronID(in, -100.);
+     unbiased_seedBDT = lowpt_unbiased_.electronID(in, -100.);
+     ptbiased_seedBDT = lowpt_ptbiased_.electronID(in, -100.);
+   }
  //  if ( unbiased_seedBDT <bdtMin_) continue; //extra cut for low pT e on BDT
    if ( mva_id <bdtMin_) continue; //extra cut for low pT e on BDT
 
@@ -300,32 +472,50 @@ void ElectronMerger::produce(edm::StreamID, edm::Event &evt, edm::EventSetup con
    bool skipEle=true;
    float dzTrg = 0.0;
    for(const auto & trg : *trgLepton) {
-     if(reco::deltaR(ele, trg) < drTrg_cleaning_ && drTrg_cleaning_ > 0)
+     if(reco::deltaR(p4, trg) < drTrg_cleaning_ && drTrg_cleaning_ > 0)
         continue;
-     if(fabs(ele.vz() - trg.vz()) > dzTrg_cleaning_ && dzTrg_cleaning_ > 0)
+     if(fabs(in.vz() - trg.vz()) > dzTrg_cleaning_ && dzTrg_cleaning_ > 0)
         continue;
      skipEle=false;
-     dzTrg = ele.vz() - trg.vz();
+     dzTrg = in.vz() - trg.vz();
      break;  // one trg muon is enough 
    }
    // same here Do we need evts without trg muon? now we skip them
    if (filterEle_ && skipEle) continue;
 
+   const pat::Electron & src = regression_ ? regress(*regression_, in, regressed) : in;
+   if (regression_) p4 = selectedP4(src);
+
+   if (debug) std::cout << "ElectronMerger, Event " << (evt.id()).event() 
+			<< " => LPT: ele.superCluster()->rawEnergy() = " << src.superCluster()->rawEnergy()
+			<< ", ele.correctedEcalEnergy() = " << src.correctedEcalEnergy()
+			<< ", ele gsf track chi2 = " << src.gsfTrack()->normalizedChi2()
+			<< ", ele.p = " << src.p() << std::endl;
+
+   if (p4.pt()<ptMin_) continue;
+
    //pf cleaning    
    bool clean_out = false;
+   kin::deltaR2(p4.eta(), p4.phi(), pfEta.data(), pfPhi.data(), pfSelectedSize, pfDR2.data());
    for(unsigned int iEle=0; iEle<pfSelectedSize; ++iEle) {
 
       clean_out |= (
-	           fabs(pfVz[iEle] - ele.vz()) < dz_cleaning_ &&
-                   reco::deltaR(ele.eta(), ele.phi(), pfEtaPhi[iEle].first, pfEtaPhi[iEle].second) < dr_cleaning_   );
+	           fabs(pfVz[iEle] - src.vz()) < dz_cleaning_ &&
+                   pfDR2[iEle] < dr2_cleaning   );
 
    }
    if(clean_out && flagAndclean_) continue;
-   else if(clean_out) ele.addUserInt("isPFoverlap", 1);
-   else ele.addUserInt("isPFoverlap", 0);
 
-   float unbiased_seedBDT = ( ele.isElectronIDAvailable("unbiased") ? ele.electronID("unbiased") : -100. );
-   float ptbiased_seedBDT = ( ele.isElectronIDAvailable("ptbiased") ? ele.electronID("ptbiased") : -100. );
+   // Attempt to match electrons to conversions in "gsfTracksOpenConversions" collection
+   // done before make(), which moves the regressed electron src refers to
+   ConversionInfo info;
+   conv_index.match(src,info);
+   const float chargeMode = src.gsfTrack()->chargeMode();
+
+   Electron ele = factory_.make(lowpt, iele, regression_ ? &regressed : nullptr);
+   ele.setP4(p4);
+   ele.addUserInt("isPFoverlap", clean_out ? 1 : 0);
+
    ele.addUserInt("isPF", 0);
    ele.addUserInt("isLowPt", 1);
    // Custom IDs
@@ -337,13 +527,10 @@ void ElectronMerger::produce(edm::StreamID, edm::Event &evt, edm::EventSetup con
    ele.addUserFloat("PFEleMvaID_Fall17NoIsoV2RawValue", 20.); // Run 2 ID
    // Run-3 PF ele ID
    //ele.addUserFloat("PFEleMvaID_Winter22NoIsoV1RawValue", 20.); // Run 3 ID
-   ele.addUserFloat("chargeMode", ele.gsfTrack()->chargeMode());
+   ele.addUserFloat("chargeMode", chargeMode);
    ele.addUserFloat("dzTrg", dzTrg);
    ele.addUserInt("skipEle",skipEle);
 
-   // Attempt to match electrons to conversions in "gsfTracksOpenConversions" collection
-   ConversionInfo info;
-   ConversionInfo::match(beamSpot,conversions,ele,info);
    info.addUserVars(ele);
    if ( addUserVarsExtra_ ) { info.addUserVarsExtra(ele); }
    if (debug && info.wpOpen()) { 
@@ -357,28 +544,40 @@ void ElectronMerger::produce(edm::StreamID, edm::Event &evt, edm::EventSetup con
 	       << std::endl;
    }
 
-   ele_out       -> emplace_back(ele);
+   electrons_pt.push_back(p4.pt());
+   electrons.emplace_back(std::move(ele));
   }
 }
+  if(debug_scratch_) scratch.marks.mark("electrons", electrons.size());
+  std::vector<size_t> & order = scratch.order;
   if(sortOutputCollections_){
 
     //sorting increases sligtly the time but improves the code efficiency in the Bcandidate builder
     //easier identification of leading and subleading with smarter loop
-    std::sort( ele_out->begin(), ele_out->end(), [] (pat::Electron e1, pat::Electron e2) -> bool {return e1.pt() > e2.pt();}
-             );
+    decreasing_order(electrons_pt, order);
+  } else {
+    order.resize(electrons.size());
+    std::iota(order.begin(), order.end(), 0);
   }
+  ele_out->reserve(electrons.size());
+  for(size_t iEle : order) ele_out->emplace_back(std::move(electrons[iEle]));
 
-  // build transient track collection
+  // transient track collection, the tracks are built on demand: here only
+  // for the IP of the low pT electrons, then by the builders
+  trans_ele_out->reserve(ele_out->size());
   for(auto &ele : *ele_out){
-    float regErrorRatio = std::abs(ele.corrections().combinedP4Error/ele.p()/ele.gsfTrack()->qoverpModeError()*ele.gsfTrack()->qoverpMode());
-    const reco::TransientTrack eleTT = use_regression_for_p4_ ?
-      theB.buildfromReg(ele.gsfTrack(), math::XYZVector(ele.corrections().combinedP4), regErrorRatio) : theB.buildfromGSF( ele.gsfTrack() );
-    trans_ele_out -> emplace_back(eleTT);
+    const reco::GsfTrackRef gsfTrk = ele.gsfTrack();
+    if(use_regression_for_p4_) {
+      float regErrorRatio = std::abs(ele.corrections().combinedP4Error/ele.p()/gsfTrk->qoverpModeError()*gsfTrk->qoverpMode());
+      trans_ele_out -> emplace_back(&theB, gsfTrk, math::XYZVector(ele.corrections().combinedP4), regErrorRatio);
+    } else {
+      trans_ele_out -> emplace_back(&theB, gsfTrk);
+    }
 
     if(ele.userInt("isPF")) continue;
     //compute IP for electrons: need transient track
     //from PhysicsTools/PatAlgos/plugins/LeptonUpdater.cc
-    const reco::GsfTrackRef gsfTrk = ele.gsfTrack();
+    const reco::TransientTrack & eleTT = trans_ele_out->back().get();
     // PVDZ
     ele.setDB(gsfTrk->dz(PV.position()), std::hypot(gsfTrk->dzError(), PV.zError()), pat::Electron::PVDZ);
 
@@ -400,5 +599,9 @@ void ElectronMerger::produce(edm::StreamID, edm::Event &evt, edm::EventSetup con
   evt.put(std::move(trans_ele_out),"SelectedTransientElectrons");
 }
 
+typedef ElectronMergerT<pat::Electron> ElectronMerger;
+typedef ElectronMergerT<bph::ElectronOverlay> ElectronOverlayMerger;
+
 #include "FWCore/Framework/interface/MakerMacros.h"
 DEFINE_FWK_MODULE(ElectronMerger);
+DEFINE_FWK_MODULE(ElectronOverlayMerger);
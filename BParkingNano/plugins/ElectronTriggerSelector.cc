@@ -28,8 +28,8 @@
 #include "MagneticField/Engine/interface/MagneticField.h"
 #include "MagneticField/Records/interface/IdealMagneticFieldRecord.h"
 
-#include <TLorentzVector.h>
 #include "helper.h"
+#include "ScratchBuffers.h"
 
 using namespace std;
 
@@ -47,6 +47,7 @@ public:
 private:
 
     virtual void produce(edm::Event&, const edm::EventSetup&);
+    void endStream() override;
     void print(edm::Event&,
 	       edm::Handle<edm::TriggerResults>&,
 	       edm::Handle<std::vector<pat::TriggerObjectStandAlone>>&);
@@ -68,6 +69,17 @@ private:
     const double absEtaMax_;      //max eta ""
     std::vector<std::string> HLTPaths_;
     std::vector<std::string> L1Seeds_;
+
+    // per-event scratch, see ScratchBuffers.h
+    const bool debug_scratch_;
+    ScratchMarks scratch_marks_;
+    unsigned int stream_ = 0;
+    std::vector<int> electronIsTrigger_, loose_id_;
+    std::vector<float> electronDR_, electronDPT_;
+    ScratchTable<int> fires_;       // [electron][path]
+    ScratchTable<float> matcher_, DR_, DPT_;
+    std::vector<int> sds_;          // per L1 seed
+    std::vector<float> temp_dr_, temp_dpt_, temp_pt_; // per trigger object match
 };
 
 
@@ -84,7 +96,8 @@ ElectronTriggerSelector::ElectronTriggerSelector(const edm::ParameterSet &iConfi
   ptMin_(iConfig.getParameter<double>("ptMin")),
   absEtaMax_(iConfig.getParameter<double>("absEtaMax")), 
   HLTPaths_(iConfig.getParameter<std::vector<std::string>>("HLTPaths")),
-  L1Seeds_(iConfig.getParameter<std::vector<std::string>>("L1seeds"))
+  L1Seeds_(iConfig.getParameter<std::vector<std::string>>("L1seeds")),
+  debug_scratch_(scratch_debug(iConfig))
 {
   // produce 2 collections: trgElectrons (tags) and SelectedElectrons (probes & tags if survive preselection cuts)
     produces<pat::ElectronCollection>("trgElectrons"); 
@@ -197,19 +210,23 @@ void ElectronTriggerSelector::produce(edm::Event& iEvent, const edm::EventSetup&
     edm::Handle<std::vector<pat::Electron>> electrons;
     iEvent.getByToken(electronSrc_, electrons);
 
-    std::vector<int> electronIsTrigger(electrons->size(), 0);
-    std::vector<float> electronDR(electrons->size(),-1.);
-    std::vector<float> electronDPT(electrons->size(),10000.);
-    std::vector<int> loose_id(electrons->size(),0);
-
-    std::vector<int> matched_reco_flag(electrons->size(),-1);
-    std::vector<int> matched_trg_index(electrons->size(),-1);
-    std::vector<float> matched_dr(electrons->size(),-1.);
-    std::vector<float> matched_dpt(electrons->size(),-10000.);
-    std::vector<std::vector<int>> fires;
-    std::vector<std::vector<float>> matcher; 
-    std::vector<std::vector<float>> DR;
-    std::vector<std::vector<float>> DPT;    
+    std::vector<int> & electronIsTrigger = electronIsTrigger_;
+    std::vector<float> & electronDR = electronDR_;
+    std::vector<float> & electronDPT = electronDPT_;
+    std::vector<int> & loose_id = loose_id_;
+    electronIsTrigger.assign(electrons->size(), 0);
+    electronDR.assign(electrons->size(),-1.);
+    electronDPT.assign(electrons->size(),10000.);
+    loose_id.assign(electrons->size(),0);
+
+    ScratchTable<int> & fires = fires_;
+    ScratchTable<float> & matcher = matcher_;
+    ScratchTable<float> & DR = DR_;
+    ScratchTable<float> & DPT = DPT_;
+    fires.assign(electrons->size(), HLTPaths_.size(), 0);
+    matcher.assign(electrons->size(), HLTPaths_.size(), 1000.);
+    DR.assign(electrons->size(), HLTPaths_.size(), 1000.);
+    DPT.assign(electrons->size(), HLTPaths_.size(), 1000.);
 
     int nele = 0;
     int mele = 0;
@@ -246,11 +263,13 @@ void ElectronTriggerSelector::produce(edm::Event& iEvent, const edm::EventSetup&
 		    << " Phi=" << electron.phi()
 		    << " NtriggerObjectMatches=" << electron.triggerObjectMatches().size()
 		    << std::endl;
-        std::vector<int> frs(HLTPaths_.size(),0); //path fires for each reco electron
-        std::vector<int> sds(L1Seeds_.size(),0);// L1 Seeds for each L1 electron
-        std::vector<float> temp_matched_to(HLTPaths_.size(),1000.);
-        std::vector<float> temp_DR(HLTPaths_.size(),1000.);
-        std::vector<float> temp_DPT(HLTPaths_.size(),1000.);
+        unsigned int iEle(&electron - &(electrons->at(0)));
+        int * frs = fires[iEle]; //path fires for each reco electron
+        std::vector<int> & sds = sds_;
+        sds.assign(L1Seeds_.size(),0);// L1 Seeds for each L1 electron
+        float * temp_matched_to = matcher[iEle];
+        float * temp_DR = DR[iEle];
+        float * temp_DPT = DPT[iEle];
         int ipath=-1;
         int iseed=-1;
 
@@ -286,9 +305,12 @@ void ElectronTriggerSelector::produce(edm::Event& iEvent, const edm::EventSetup&
             ipath++;
             // the following vectors are used in order to find the minimum DR between a reco electron and all the HLT objects that is matched with it so as a reco electron will be matched with only one HLT object every time so as there is a one-to-one correspondance between the two collection. DPt_rel is not used to create this one-to-one correspondance but only to create a few plots, debugging and be sure thateverything is working fine.
 	    // RB: deltaR match determined for trigger (eta,phi) and electron SuperCluster (eta,phi) positions ...
-            std::vector<float> temp_dr(electron.triggerObjectMatches().size(),1000.);
-            std::vector<float> temp_dpt(electron.triggerObjectMatches().size(),1000.);
-            std::vector<float> temp_pt(electron.triggerObjectMatches().size(),1000.);
+            std::vector<float> & temp_dr = temp_dr_;
+            std::vector<float> & temp_dpt = temp_dpt_;
+            std::vector<float> & temp_pt = temp_pt_;
+            temp_dr.assign(electron.triggerObjectMatches().size(),1000.);
+            temp_dpt.assign(electron.triggerObjectMatches().size(),1000.);
+            temp_pt.assign(electron.triggerObjectMatches().size(),1000.);
             char cstr[ (path+"*").size() + 1];
 	    strcpy( cstr, (path+"*").c_str() );       
 	    if(debug>1) 
@@ -347,11 +369,9 @@ void ElectronTriggerSelector::produce(edm::Event& iEvent, const edm::EventSetup&
                 temp_matched_to[ipath]=temp_pt[position];
                 }
             }
-        //and now since we have found the minimum DR we save a few variables for plots       
-        fires.push_back(frs);//This is used in order to see if a reco electron fired a Trigger (1) or not (0).
-        matcher.push_back(temp_matched_to); //This is used in order to see if a reco electron is matched with a HLT object. PT of the reco electron is saved in this vector. 
-        DR.push_back(temp_DR);
-        DPT.push_back(temp_DPT);
+        //and now since we have found the minimum DR we have saved a few variables for plots
+        //fires: used in order to see if a reco electron fired a Trigger (1) or not (0).
+        //matcher: used in order to see if a reco electron is matched with a HLT object. PT of the reco electron is saved in this vector.
 
     }
 
@@ -408,8 +428,8 @@ void ElectronTriggerSelector::produce(edm::Event& iEvent, const edm::EventSetup&
         }
         if(filterElectron_ && SkipElectron) continue;
 
-        const reco::TransientTrack electronTT((*(electron.bestTrack())),&bField); // need this?
-        if(!electronTT.isValid()) continue; // need this?
+        // a transient track is valid iff it has a track; it is only built if the electron enters a fit
+        if(electron.bestTrack() == nullptr) continue;
 
         electrons_out->emplace_back(electron);
         electrons_out->back().addUserInt("isTriggering", electronIsTrigger[iEle]);
@@ -419,7 +439,7 @@ void ElectronTriggerSelector::produce(edm::Event& iEvent, const edm::EventSetup&
         electrons_out->back().addUserInt("skipElectron",SkipElectron);
 
         for(unsigned int i=0; i<HLTPaths_.size(); i++){electrons_out->back().addUserInt(HLTPaths_[i],fires[iEle][i]);}
-        trans_electrons_out->emplace_back(electronTT);
+        trans_electrons_out->emplace_back(electron.bestTrack(), &bField);
 
 
     }
@@ -430,11 +450,21 @@ void ElectronTriggerSelector::produce(edm::Event& iEvent, const edm::EventSetup&
       std::cout << "Number of SelectedTransientElectrons=" <<trans_electrons_out->size() << endl;
     }
 
+    if(debug_scratch_) {
+        scratch_marks_.mark("electrons", electrons->size());
+        scratch_marks_.mark("fires", fires.size());
+        stream_ = iEvent.streamID().value();
+    }
+
     iEvent.put(std::move(trgelectrons_out),    "trgElectrons"); 
     iEvent.put(std::move(electrons_out),       "SelectedElectrons");
     iEvent.put(std::move(trans_electrons_out), "SelectedTransientElectrons");
 }
 
 
+void ElectronTriggerSelector::endStream() {
+    if(debug_scratch_) scratch_marks_.report(moduleDescription().moduleLabel(), stream_);
+}
+
 
 DEFINE_FWK_MODULE(ElectronTriggerSelector);
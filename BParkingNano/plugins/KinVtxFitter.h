@@ -46,6 +46,15 @@ public:
       );
   }
 
+  // Cartesian momentum and mass of the fitted daughter, without the polar
+  // conversion of daughter_p4
+  GlobalVector daughter_momentum(size_t i) const {
+    return fitted_children_.at(i)->currentState().globalMomentum();
+  }
+  double daughter_mass(size_t i) const {
+    return fitted_children_.at(i)->currentState().mass();
+  }
+
   const KinematicState fitted_candidate() const {
     return fitted_state_;
   }
@@ -0,0 +1,68 @@
+#ifndef PhysicsTools_BParkingNano_Kinematics
+#define PhysicsTools_BParkingNano_Kinematics
+
+#include <cmath>
+#include <cstddef>
+
+// Plain four-momentum arithmetic for the per-candidate code: Cartesian
+// components only, no ROOT object and no polar <-> Cartesian round trip.
+// Everything is templated on the precision (float or double).
+namespace kin {
+
+  // rounded masses of the anti-D0 veto, kept as in the original analysis
+  // code; the particle masses are in helper.h
+  constexpr double ANTI_D0_K_MASS = 0.493;
+  constexpr double ANTI_D0_PI_MASS = 0.139;
+
+  template<typename T>
+  struct P4 {
+    T px, py, pz, e;
+
+    constexpr P4 operator+(const P4 &other) const {
+      return {px + other.px, py + other.py, pz + other.pz, e + other.e};
+    }
+    constexpr P4 & operator+=(const P4 &other) {
+      px += other.px; py += other.py; pz += other.pz; e += other.e;
+      return *this;
+    }
+    constexpr T p2() const { return px*px + py*py + pz*pz; }
+    constexpr T m2() const { return e*e - p2(); }
+    // negative for a space-like four-momentum, as TLorentzVector::M()
+    T mass() const {
+      const T mm = m2();
+      return mm < 0 ? -std::sqrt(-mm) : std::sqrt(mm);
+    }
+    T pt() const { return std::sqrt(px*px + py*py); }
+
+    // any three-vector with x(), y(), z(): GlobalVector, math::XYZVector...
+    template<typename V>
+    static P4 from_momentum(const V &p, T m) { return from_momentum(T(p.x()), T(p.y()), T(p.z()), m); }
+    static P4 from_momentum(T px, T py, T pz, T m) {
+      return {px, py, pz, std::sqrt(px*px + py*py + pz*pz + m*m)};
+    }
+    // any Lorentz vector, keeping its momentum and replacing its mass
+    template<typename L>
+    static P4 with_mass(const L &p4, T m) { return from_momentum(T(p4.px()), T(p4.py()), T(p4.pz()), m); }
+    // any Lorentz vector, as it is
+    template<typename L>
+    static P4 from(const L &p4) { return {T(p4.px()), T(p4.py()), T(p4.pz()), T(p4.energy())}; }
+  };
+
+  // invariant mass of two momenta under the mass hypotheses m1, m2
+  template<typename T>
+  inline T pair_mass(T px1, T py1, T pz1, T m1, T px2, T py2, T pz2, T m2) {
+    return (P4<T>::from_momentum(px1, py1, pz1, m1) + P4<T>::from_momentum(px2, py2, pz2, m2)).mass();
+  }
+
+  // Batched mass hypothesis: energies of n momenta under the mass m. Called
+  // once per hypothesis, it gives the energies of all the tracks as K and
+  // as pi, e.g., for the pair masses of both K pi assignments
+  template<typename T>
+  inline void energies(size_t n, const T *px, const T *py, const T *pz, T m, T *e) {
+    const T m2 = m*m;
+    for(size_t i = 0; i < n; ++i) e[i] = std::sqrt(px[i]*px[i] + py[i]*py[i] + pz[i]*pz[i] + m2);
+  }
+
+}
+
+#endif
@@ -21,82 +21,230 @@
 #include "helper.h"
 #include <limits>
 #include <algorithm>
+#include <iterator>
+#include <functional>
 #include "KinVtxFitter.h"
+#include "NBodyBuilder.h"
+#include "CompositeFactory.h"
+#include "UserKey.h"
+#include "Kinematics.h"
+#include "WorkingPoints.h"
 
 
 
 
-class KstarBuilder : public edm::global::EDProducer<> {
+template<typename Composite>
+class KstarBuilderT : public edm::global::EDProducer<> {
 
   
 public:
 
-  typedef std::vector<reco::TransientTrack> TransientTrackCollection;
+  typedef bph::LazyTransientTrackCollection TransientTrackCollection;
+  typedef std::vector<Composite> CompositeCollection;
   
-  explicit KstarBuilder(const edm::ParameterSet &cfg):
+  explicit KstarBuilderT(const edm::ParameterSet &cfg):
     trk1_selection_{cfg.getParameter<std::string>("trk1Selection")},
     trk2_selection_{cfg.getParameter<std::string>("trk2Selection")},
     pre_vtx_selection_{cfg.getParameter<std::string>("preVtxSelection")},
     post_vtx_selection_{cfg.getParameter<std::string>("postVtxSelection")},
-    pfcands_{consumes<pat::CompositeCandidateCollection>( cfg.getParameter<edm::InputTag>("pfcands") )},
-    ttracks_{consumes<TransientTrackCollection>( cfg.getParameter<edm::InputTag>("transientTracks") )} {
+    working_points_{working_points(cfg)},
+    wp_trk1_selection_{working_points_, "trk1Selection"},
+    wp_trk2_selection_{working_points_, "trk2Selection"},
+    wp_pre_vtx_selection_{working_points_, "preVtxSelection"},
+    wp_post_vtx_selection_{working_points_, "postVtxSelection"},
+    pfcands_{consumes<CompositeCollection>( cfg.getParameter<edm::InputTag>("pfcands") )},
+    ttracks_{consumes<TransientTrackCollection>( cfg.getParameter<edm::InputTag>("transientTracks") )},
+    seeded_{cfg.existsAs<edm::InputTag>("dileptons")},
+    seed_max_dz_{seeded_ ? cfg.getParameter<double>("seedMaxDz") : 0.},
+    seed_max_dr_{seeded_ ? cfg.getParameter<double>("seedMaxDR") : 0.},
+    pair_pt_min_{cfg.getParameter<double>("pairPtMin")},
+    pair_mass_min_{cfg.getParameter<double>("pairMassMin")},
+    pair_mass_max_{cfg.getParameter<double>("pairMassMax")},
+    factory_{bph::CompactSchema(
+        {"trk_deltaR", "barMass", "sv_chi2", "sv_ndof", "sv_prob",
+         "fitted_mass", "fitted_pt", "fitted_eta", "fitted_phi", "fitted_barMass"},
+        {"trk1_idx", "trk2_idx", "wp_mask"},
+        {"trk1", "trk2"})} {
+
+      // lepton-seeded mode (optional): only tracks close to a dilepton vertex are paired
+      if ( seeded_ ) {
+        dileptons_ = consumes<CompositeCollection>( cfg.getParameter<edm::InputTag>("dileptons") );
+        dileptons_kinVtxs_ = consumes<std::vector<KinVtxFitter> >( cfg.getParameter<edm::InputTag>("dileptonKinVtxs") );
+      }
 
       //output
-       produces<pat::CompositeCandidateCollection>();
+       produces<CompositeCollection>();
+       // indices of the dileptons each K* is compatible with, seeded mode only
+       if ( seeded_ ) produces<std::vector<std::vector<int> > >("compatibleDileptons");
 
     }
 
-  ~KstarBuilder() override {}
+  ~KstarBuilderT() override {}
   
   void produce(edm::StreamID, edm::Event&, const edm::EventSetup&) const override;
 
   static void fillDescriptions(edm::ConfigurationDescriptions &descriptions) {}
   
 private:
-  const StringCutObjectSelector<pat::CompositeCandidate> trk1_selection_; // cuts on leading cand
-  const StringCutObjectSelector<pat::CompositeCandidate> trk2_selection_; // sub-leading cand
-  const StringCutObjectSelector<pat::CompositeCandidate> pre_vtx_selection_; // cut on the di-lepton before the SV fit
-  const StringCutObjectSelector<pat::CompositeCandidate> post_vtx_selection_; // cut on the di-lepton after the SV fit
-  const edm::EDGetTokenT<pat::CompositeCandidateCollection> pfcands_; //input PF cands this is sorted in pT in previous step
+  const StringCutObjectSelector<Composite> trk1_selection_; // cuts on leading cand
+  const StringCutObjectSelector<Composite> trk2_selection_; // sub-leading cand
+  const StringCutObjectSelector<Composite> pre_vtx_selection_; // cut on the di-lepton before the SV fit
+  const StringCutObjectSelector<Composite> post_vtx_selection_; // cut on the di-lepton after the SV fit
+  const std::vector<edm::ParameterSet> working_points_; // see WorkingPoints.h
+  const WorkingPointCut<Composite> wp_trk1_selection_;
+  const WorkingPointCut<Composite> wp_trk2_selection_;
+  const WorkingPointCut<Composite> wp_pre_vtx_selection_;
+  const WorkingPointCut<Composite> wp_post_vtx_selection_;
+  const edm::EDGetTokenT<CompositeCollection> pfcands_; //input PF cands this is sorted in pT in previous step
   const edm::EDGetTokenT<TransientTrackCollection> ttracks_; //input TTracks of PF cands
+
+  // lepton-seeded mode
+  const bool seeded_;
+  const double seed_max_dz_; // between the track vz and the dilepton vertex
+  const double seed_max_dr_; // between the track and the dilepton direction
+  edm::EDGetTokenT<CompositeCollection> dileptons_;
+  edm::EDGetTokenT<std::vector<KinVtxFitter> > dileptons_kinVtxs_;
+
+  // loose bounds applied before building the pairs, they must not be
+  // tighter than preVtxSelection
+  const double pair_pt_min_;   // on the scalar pT sum of the two tracks
+  const double pair_mass_min_; // on the pair mass, either hypothesis
+  const double pair_mass_max_;
+
+  const CompositeFactory<Composite> factory_;
+  const UserKey ll_l1_{"l1"};
+  const UserKey ll_l2_{"l2"};
 };
 
 
-void KstarBuilder::produce(edm::StreamID, edm::Event &evt, edm::EventSetup const &) const {
+template<typename Composite>
+void KstarBuilderT<Composite>::produce(edm::StreamID, edm::Event &evt, edm::EventSetup const &) const {
 
   //inputs  
-  edm::Handle<pat::CompositeCandidateCollection> pfcands;
+  edm::Handle<CompositeCollection> pfcands;
   evt.getByToken(pfcands_, pfcands);  
   edm::Handle<TransientTrackCollection> ttracks;
   evt.getByToken(ttracks_, ttracks);
  
 
-  // output
-  std::unique_ptr<pat::CompositeCandidateCollection> kstar_out(new pat::CompositeCandidateCollection());
+  // track preselections, evaluated once per track
+  std::vector<char> trk1_sel, trk2_sel;
+  trk1_sel.reserve(pfcands->size());
+  trk2_sel.reserve(pfcands->size());
+  for(const auto & trk : *pfcands) {
+    trk1_sel.push_back(trk1_selection_(trk));
+    trk2_sel.push_back(trk2_selection_(trk));
+  }
+  // working points failed by each track as leading and sub-leading one
+  const size_t n_wps = working_points_.size();
+  std::vector<uint32_t> trk1_wp_failed, trk2_wp_failed;
+  if ( n_wps > 0 ) {
+    trk1_wp_failed.reserve(pfcands->size());
+    trk2_wp_failed.reserve(pfcands->size());
+    for(size_t trk_idx = 0; trk_idx < pfcands->size(); ++trk_idx) {
+      trk1_wp_failed.push_back(wp_trk1_selection_.failed(pfcands->at(trk_idx), trk1_sel[trk_idx]));
+      trk2_wp_failed.push_back(wp_trk2_selection_.failed(pfcands->at(trk_idx), trk2_sel[trk_idx]));
+    }
+  }
 
-  
+  // seeded mode: dileptons each track is close to, in increasing order.
+  // Tracks close to none of them are dropped before the pairing
+  std::vector<std::vector<int> > trk_lls;
+  if ( seeded_ ) {
+    edm::Handle<CompositeCollection> dileptons;
+    evt.getByToken(dileptons_, dileptons);
+    edm::Handle<std::vector<KinVtxFitter> > dileptons_kinVtxs;
+    evt.getByToken(dileptons_kinVtxs_, dileptons_kinVtxs);
 
-  // main loop
-  for(size_t trk1_idx = 0; trk1_idx < pfcands->size(); ++trk1_idx ){
+    // dilepton vertex z, from the fit when it converged
+    std::vector<double> ll_vz;
+    ll_vz.reserve(dileptons->size());
+    for(size_t ll_idx = 0; ll_idx < dileptons->size(); ++ll_idx) {
+      const KinVtxFitter & kinVtx = dileptons_kinVtxs->at(ll_idx);
+      const Composite & ll = dileptons->at(ll_idx);
+      ll_vz.push_back( kinVtx.success() ? kinVtx.fitted_vtx().z() :
+                       0.5*(ll_l1_.userCand(ll)->vz() + ll_l2_.userCand(ll)->vz()) );
+    }
 
-    edm::Ptr<pat::CompositeCandidate> trk1_ptr( pfcands, trk1_idx );
-    if(!trk1_selection_(*trk1_ptr)) continue; 
-    
-    for(size_t trk2_idx = trk1_idx + 1; trk2_idx < pfcands->size(); ++trk2_idx) {
+    trk_lls.resize(pfcands->size());
+    for(size_t trk_idx = 0; trk_idx < pfcands->size(); ++trk_idx) {
+      if ( !trk1_sel[trk_idx] && !trk2_sel[trk_idx] ) continue;
+      const Composite & trk = pfcands->at(trk_idx);
+      for(size_t ll_idx = 0; ll_idx < dileptons->size(); ++ll_idx) {
+        if ( fabs(trk.vz() - ll_vz[ll_idx]) > seed_max_dz_ ) continue;
+        if ( reco::deltaR(trk, dileptons->at(ll_idx)) > seed_max_dr_ ) continue;
+        trk_lls[trk_idx].push_back(ll_idx);
+      }
+      if ( trk_lls[trk_idx].empty() ) trk1_sel[trk_idx] = trk2_sel[trk_idx] = false;
+    }
+  }
+
+  struct KstarOutput {
+    CompositeCollection cands;
+    std::vector<std::vector<int> > compatible_lls;
+    std::vector<int> pair_lls; // scratch, reused by all the pairs
+  };
+
+  // Cartesian components and energies under both mass hypotheses, to check
+  // the pair masses before building any candidate and to build them
+  const size_t n_trks = pfcands->size();
+  std::vector<double> px(n_trks), py(n_trks), pz(n_trks), pt(n_trks), e_k(n_trks), e_pi(n_trks);
+  // opposite-charge partners: indices of the positive and negative tracks,
+  // in increasing order
+  std::vector<size_t> positive, negative;
+  for(size_t trk_idx = 0; trk_idx < n_trks; ++trk_idx) {
+    const Composite & trk = pfcands->at(trk_idx);
+    px[trk_idx] = trk.px();
+    py[trk_idx] = trk.py();
+    pz[trk_idx] = trk.pz();
+    pt[trk_idx] = trk.pt();
+    if ( !trk2_sel[trk_idx] ) continue;
+    if ( trk.charge() > 0 ) positive.push_back(trk_idx);
+    else if ( trk.charge() < 0 ) negative.push_back(trk_idx);
+  }
+  // the pT bound stops the scan of the partners only if they come in
+  // decreasing pT, as the packed candidates do; otherwise it just skips
+  const bool pt_sorted = std::is_sorted(pt.begin(), pt.end(), std::greater<double>());
+  kin::energies<double>(n_trks, px.data(), py.data(), pz.data(), K_MASS, e_k.data());
+  kin::energies<double>(n_trks, px.data(), py.data(), pz.data(), PI_MASS, e_pi.data());
+  typedef kin::P4<double> P4;
+  auto as_k  = [&](size_t trk_idx) { return P4{px[trk_idx], py[trk_idx], pz[trk_idx], e_k[trk_idx]}; };
+  auto as_pi = [&](size_t trk_idx) { return P4{px[trk_idx], py[trk_idx], pz[trk_idx], e_pi[trk_idx]}; };
+
+  // true if trk1 as K and trk2 as pi, or the reverse, can be in the mass window
+  auto in_mass_window = [&](size_t trk1_idx, size_t trk2_idx) {
+    const double px12 = px[trk1_idx] + px[trk2_idx];
+    const double py12 = py[trk1_idx] + py[trk2_idx];
+    const double pz12 = pz[trk1_idx] + pz[trk2_idx];
+    const double p2 = px12*px12 + py12*py12 + pz12*pz12;
+    const double e = e_k[trk1_idx] + e_pi[trk2_idx];
+    const double bar_e = e_pi[trk1_idx] + e_k[trk2_idx];
+    const double min2 = pair_mass_min_*pair_mass_min_, max2 = pair_mass_max_*pair_mass_max_;
+    const double m2 = e*e - p2, bar_m2 = bar_e*bar_e - p2;
+    return (m2 >= min2 && m2 <= max2) || (bar_m2 >= min2 && bar_m2 <= max2);
+  };
+
+  auto build = [&](size_t trk1_idx, size_t trk2_idx, KstarOutput &out) {
+     edm::Ptr<Composite> trk1_ptr( pfcands, trk1_idx );
+     edm::Ptr<Composite> trk2_ptr( pfcands, trk2_idx );
 
-     edm::Ptr<pat::CompositeCandidate> trk2_ptr( pfcands, trk2_idx );
-     if (trk1_ptr->charge() == trk2_ptr->charge()) continue; 
-     if(!trk2_selection_(*trk2_ptr)) continue;
+     // seeded mode: both tracks have to be close to the same dilepton.
+     // Only the pairs that are kept get their own copy of the list
+     std::vector<int> & compatible_lls = out.pair_lls;
+     if ( seeded_ ) {
+       compatible_lls.clear();
+       std::set_intersection(trk_lls[trk1_idx].begin(), trk_lls[trk1_idx].end(),
+                             trk_lls[trk2_idx].begin(), trk_lls[trk2_idx].end(),
+                             std::back_inserter(compatible_lls));
+       if ( compatible_lls.empty() ) return;
+     }
           
      // create a K* candidate; add first quantities that can be used for pre fit selection
-     pat::CompositeCandidate kstar_cand;
-     auto trk1_p4=trk1_ptr->polarP4();
-     auto trk2_p4=trk2_ptr->polarP4();
-     trk1_p4.SetM(K_MASS);
-     trk2_p4.SetM(PI_MASS);
+     Composite kstar_cand = factory_.make();
+     const P4 kstar_p4 = as_k(trk1_idx) + as_pi(trk2_idx);
 
      //adding stuff for pre fit selection
-     kstar_cand.setP4(trk1_p4 + trk2_p4);
+     kstar_cand.setP4(math::XYZTLorentzVector(kstar_p4.px, kstar_p4.py, kstar_p4.pz, kstar_p4.e));
      kstar_cand.addUserFloat("trk_deltaR", reco::deltaR(*trk1_ptr, *trk2_ptr));
 
      // save indices
@@ -108,19 +256,22 @@ void KstarBuilder::produce(edm::StreamID, edm::Event &evt, edm::EventSetup const
      kstar_cand.addUserCand("trk2", trk2_ptr );
 
      //second mass hypothesis
-     trk1_p4.SetM(PI_MASS);
-     trk2_p4.SetM(K_MASS);
-     kstar_cand.addUserFloat("barMass", (trk1_p4 + trk2_p4).M() );
+     kstar_cand.addUserFloat("barMass", (as_pi(trk1_idx) + as_k(trk2_idx)).mass() );
      
      // selection before fit
-     if( !pre_vtx_selection_(kstar_cand) ) continue;
+     if( !pre_vtx_selection_(kstar_cand) ) return;
+     uint32_t wp_failed = 0;
+     if ( n_wps > 0 ) {
+       wp_failed = trk1_wp_failed[trk1_idx] | trk2_wp_failed[trk2_idx] |
+                   wp_pre_vtx_selection_.failed(kstar_cand, true);
+     }
            
-     KinVtxFitter fitter(
-       {ttracks->at(trk1_idx), ttracks->at(trk2_idx)},
-       { K_MASS, PI_MASS },
-       {K_SIGMA, K_SIGMA} //K and PI sigma equal...
+     KinVtxFitter fitter = nbody::fit<2>(
+       {{&ttracks->at(trk1_idx).get(), &ttracks->at(trk2_idx).get()}},
+       {{K_MASS, PI_MASS}},
+       {{K_SIGMA, K_SIGMA}} //K and PI sigma equal...
         );
-      if ( !fitter.success() ) continue;           
+      if ( !fitter.success() ) return;           
 
       // save quantities after fit
       kstar_cand.addUserFloat("sv_chi2", fitter.chi2());
@@ -132,21 +283,51 @@ void KstarBuilder::produce(edm::StreamID, edm::Event &evt, edm::EventSetup const
       kstar_cand.addUserFloat("fitted_phi", fitter.fitted_candidate().globalMomentum().phi() );
 
       // second mass hypothesis
-      auto fitted_trk1= fitter.daughter_p4(0);
-      auto fitted_trk2= fitter.daughter_p4(1);
-      fitted_trk1.SetM(PI_MASS);
-      fitted_trk2.SetM(K_MASS);
-      kstar_cand.addUserFloat("fitted_barMass", (fitted_trk1+fitted_trk2).M() );
+      const P4 fitted_bar_p4 = P4::from_momentum(fitter.daughter_momentum(0), PI_MASS) +
+                               P4::from_momentum(fitter.daughter_momentum(1), K_MASS);
+      kstar_cand.addUserFloat("fitted_barMass", fitted_bar_p4.mass() );
                     
       // after fit selection
-      if( !post_vtx_selection_(kstar_cand) ) continue;
-      kstar_out->emplace_back(kstar_cand);
+      if( !post_vtx_selection_(kstar_cand) ) return;
+      if ( n_wps > 0 ) {
+        wp_failed |= wp_post_vtx_selection_.failed(kstar_cand, true);
+        kstar_cand.addUserInt("wp_mask", working_point_mask(n_wps, wp_failed));
       }
+      out.cands.emplace_back(kstar_cand);
+      if ( seeded_ ) out.compatible_lls.push_back(compatible_lls);
+    };
+
+  // main loop: each leading track is only paired with the following tracks of
+  // opposite charge that, together with it, can pass the pT bound
+  KstarOutput out;
+  for(size_t trk1_idx = 0; trk1_idx < n_trks; ++trk1_idx) {
+    if ( !trk1_sel[trk1_idx] ) continue;
+    const std::vector<size_t> & partners = (pfcands->at(trk1_idx).charge() > 0) ? negative : positive;
+    for(auto it = std::upper_bound(partners.begin(), partners.end(), trk1_idx); it != partners.end(); ++it) {
+      const size_t trk2_idx = *it;
+      if ( pt[trk1_idx] + pt[trk2_idx] < pair_pt_min_ ) {
+        // sorted in pT: no later partner can reach the pair pT either
+        if ( pt_sorted ) break;
+        continue;
+      }
+      if ( !in_mass_window(trk1_idx, trk2_idx) ) continue;
+      build(trk1_idx, trk2_idx, out);
+    }
   }
+
+  // output
+  std::unique_ptr<CompositeCollection> kstar_out(new CompositeCollection(std::move(out.cands)));
+  std::unique_ptr<std::vector<std::vector<int> > > compatible_out(
+    new std::vector<std::vector<int> >(std::move(out.compatible_lls)));
   
   evt.put(std::move(kstar_out));
+  if ( seeded_ ) evt.put(std::move(compatible_out), "compatibleDileptons");
 }
 
+typedef KstarBuilderT<pat::CompositeCandidate> KstarBuilder;
+typedef KstarBuilderT<bph::CompactCompositeCandidate> CompactKstarBuilder;
+
 #include "FWCore/Framework/interface/MakerMacros.h"
 DEFINE_FWK_MODULE(KstarBuilder);
+DEFINE_FWK_MODULE(CompactKstarBuilder);
 
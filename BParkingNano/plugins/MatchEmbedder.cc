@@ -82,10 +82,18 @@ typedef MatchEmbedder<pat::Muon> MuonMatchEmbedder;
 #include "DataFormats/PatCandidates/interface/Electron.h"
 typedef MatchEmbedder<pat::Electron> ElectronMatchEmbedder;
 
+#include "PhysicsTools/BParkingNano/interface/ElectronOverlay.h"
+typedef MatchEmbedder<bph::ElectronOverlay> ElectronOverlayMatchEmbedder;
+
 #include "DataFormats/PatCandidates/interface/CompositeCandidate.h"
 typedef MatchEmbedder<pat::CompositeCandidate> CompositeCandidateMatchEmbedder;
 
+#include "PhysicsTools/BParkingNano/interface/CompactCompositeCandidate.h"
+typedef MatchEmbedder<bph::CompactCompositeCandidate> CompactCandidateMatchEmbedder;
+
 #include "FWCore/Framework/interface/MakerMacros.h"
 DEFINE_FWK_MODULE(MuonMatchEmbedder);
 DEFINE_FWK_MODULE(ElectronMatchEmbedder);
+DEFINE_FWK_MODULE(ElectronOverlayMatchEmbedder);
 DEFINE_FWK_MODULE(CompositeCandidateMatchEmbedder);
+DEFINE_FWK_MODULE(CompactCandidateMatchEmbedder);
@@ -28,8 +28,8 @@
 #include "MagneticField/Engine/interface/MagneticField.h"
 #include "MagneticField/Records/interface/IdealMagneticFieldRecord.h"
 
-#include <TLorentzVector.h>
 #include "helper.h"
+#include "ScratchBuffers.h"
 
 using namespace std;
 
@@ -47,6 +47,7 @@ public:
 private:
 
     virtual void produce(edm::Event&, const edm::EventSetup&);
+    void endStream() override;
 
     const edm::ESGetToken<MagneticField, IdealMagneticFieldRecord> bFieldToken_;
     edm::EDGetTokenT<std::vector<pat::Muon>> muonSrc_;
@@ -66,6 +67,16 @@ private:
     const bool softMuonsOnly_;    //cuts muons without soft ID
     std::vector<std::string> HLTPaths_;
 //    std::vector<std::string> L1Seeds_;
+
+    // per-event scratch, see ScratchBuffers.h
+    const bool debug_scratch_;
+    ScratchMarks scratch_marks_;
+    unsigned int stream_ = 0;
+    std::vector<int> muonIsTrigger_, loose_id_;
+    std::vector<float> muonDR_, muonDPT_;
+    ScratchTable<int> fires_;       // [muon][path]
+    ScratchTable<float> matcher_, DR_, DPT_;
+    std::vector<float> temp_dr_, temp_dpt_, temp_pt_; // per trigger object match
 };
 
 
@@ -82,8 +93,9 @@ MuonTriggerSelector::MuonTriggerSelector(const edm::ParameterSet &iConfig):
   ptMin_(iConfig.getParameter<double>("ptMin")),
   absEtaMax_(iConfig.getParameter<double>("absEtaMax")), 
   softMuonsOnly_(iConfig.getParameter<bool>("softMuonsOnly")),   /////////Comma
-  HLTPaths_(iConfig.getParameter<std::vector<std::string>>("HLTPaths"))//,   //////////Comma
+  HLTPaths_(iConfig.getParameter<std::vector<std::string>>("HLTPaths")),   //////////Comma
 //  L1Seeds_(iConfig.getParameter<std::vector<std::string>>("L1seeds"))
+  debug_scratch_(scratch_debug(iConfig))
 {
   // produce 2 collections: trgMuons (tags) and SelectedMuons (probes & tags if survive preselection cuts)
     produces<pat::MuonCollection>("trgMuons"); 
@@ -118,28 +130,33 @@ void MuonTriggerSelector::produce(edm::Event& iEvent, const edm::EventSetup& iSe
     edm::Handle<std::vector<pat::Muon>> muons;
     iEvent.getByToken(muonSrc_, muons);
 
-    std::vector<int> muonIsTrigger(muons->size(), 0);
-    std::vector<float> muonDR(muons->size(),-1.);
-    std::vector<float> muonDPT(muons->size(),10000.);
-    std::vector<int> loose_id(muons->size(),0);
-
-    std::vector<int> matched_reco_flag(muons->size(),-1);
-    std::vector<int> matched_trg_index(muons->size(),-1);
-    std::vector<float> matched_dr(muons->size(),-1.);
-    std::vector<float> matched_dpt(muons->size(),-10000.);
-    std::vector<std::vector<int>> fires;
-    std::vector<std::vector<float>> matcher; 
-    std::vector<std::vector<float>> DR;
-    std::vector<std::vector<float>> DPT;    
+    std::vector<int> & muonIsTrigger = muonIsTrigger_;
+    std::vector<float> & muonDR = muonDR_;
+    std::vector<float> & muonDPT = muonDPT_;
+    std::vector<int> & loose_id = loose_id_;
+    muonIsTrigger.assign(muons->size(), 0);
+    muonDR.assign(muons->size(),-1.);
+    muonDPT.assign(muons->size(),10000.);
+    loose_id.assign(muons->size(),0);
+
+    ScratchTable<int> & fires = fires_;
+    ScratchTable<float> & matcher = matcher_;
+    ScratchTable<float> & DR = DR_;
+    ScratchTable<float> & DPT = DPT_;
+    fires.assign(muons->size(), HLTPaths_.size(), 0);
+    matcher.assign(muons->size(), HLTPaths_.size(), 1000.);
+    DR.assign(muons->size(), HLTPaths_.size(), 1000.);
+    DPT.assign(muons->size(), HLTPaths_.size(), 1000.);
     if(debug)std::cout<<std::endl;
     for(const pat::Muon &muon : *muons){
         if(debug)std::cout <<"Muon Pt="<< muon.pt() << " Eta=" << muon.eta() << " Phi=" << muon.phi()  <<endl;
+        unsigned int iMuo(&muon -&(muons->at(0)));
 
-        std::vector<int> frs(HLTPaths_.size(),0); //path fires for each reco muon
+        int * frs = fires[iMuo]; //path fires for each reco muon
 //        std::vector<int> sds(L1Seeds_.size(),0);// L1 Seeds for each L1 muon
-        std::vector<float> temp_matched_to(HLTPaths_.size(),1000.);
-        std::vector<float> temp_DR(HLTPaths_.size(),1000.);
-        std::vector<float> temp_DPT(HLTPaths_.size(),1000.);
+        float * temp_matched_to = matcher[iMuo];
+        float * temp_DR = DR[iMuo];
+        float * temp_DPT = DPT[iMuo];
         int ipath=-1;
 /*        int iseed=-1;
         for (const std::string seed: L1Seeds_){
@@ -158,9 +175,12 @@ void MuonTriggerSelector::produce(edm::Event& iEvent, const edm::EventSetup& iSe
         for (const std::string& path: HLTPaths_){
             ipath++;
             // the following vectors are used in order to find the minimum DR between a reco muon and all the HLT objects that is matched with it so as a reco muon will be matched with only one HLT object every time so as there is a one-to-one correspondance between the two collection. DPt_rel is not used to create this one-to-one correspondance but only to create a few plots, debugging and be sure thateverything is working fine. 
-            std::vector<float> temp_dr(muon.triggerObjectMatches().size(),1000.);
-            std::vector<float> temp_dpt(muon.triggerObjectMatches().size(),1000.);
-            std::vector<float> temp_pt(muon.triggerObjectMatches().size(),1000.);
+            std::vector<float> & temp_dr = temp_dr_;
+            std::vector<float> & temp_dpt = temp_dpt_;
+            std::vector<float> & temp_pt = temp_pt_;
+            temp_dr.assign(muon.triggerObjectMatches().size(),1000.);
+            temp_dpt.assign(muon.triggerObjectMatches().size(),1000.);
+            temp_pt.assign(muon.triggerObjectMatches().size(),1000.);
             char cstr[ (path+"*").size() + 1];
             strcpy( cstr, (path+"*").c_str() );       
             //Here we find all the HLT objects from each HLT path each time that are matched with the reco muon.
@@ -188,11 +208,9 @@ void MuonTriggerSelector::produce(edm::Event& iEvent, const edm::EventSetup& iSe
                 temp_matched_to[ipath]=temp_pt[position];
                 }
             }
-        //and now since we have found the minimum DR we save a few variables for plots       
-        fires.push_back(frs);//This is used in order to see if a reco muon fired a Trigger (1) or not (0).
-        matcher.push_back(temp_matched_to); //This is used in order to see if a reco muon is matched with a HLT object. PT of the reco muon is saved in this vector. 
-        DR.push_back(temp_DR);
-        DPT.push_back(temp_DPT);
+        //and now since we have found the minimum DR we have saved a few variables for plots
+        //fires: used in order to see if a reco muon fired a Trigger (1) or not (0).
+        //matcher: used in order to see if a reco muon is matched with a HLT object. PT of the reco muon is saved in this vector.
 
     }
     //now, check for different reco muons that are matched to the same HLTObject.
@@ -246,8 +264,8 @@ void MuonTriggerSelector::produce(edm::Event& iEvent, const edm::EventSetup& iSe
         }
         if(filterMuon_ && SkipMuon) continue;
 
-        const reco::TransientTrack muonTT((*(muon.bestTrack())),&bField); //sara:check,why not using inner track for muons? GM: What is this and why do we need this???
-        if(!muonTT.isValid()) continue; // GM: and why do we skip this muon if muonTT is invalid? This seems to have no effect so I kept it.
+        // a transient track is valid iff it has a track; it is only built if the muon enters a fit
+        if(muon.bestTrack() == nullptr) continue; //sara:check,why not using inner track for muons?
 
         muons_out->emplace_back(muon);
         muons_out->back().addUserInt("isTriggering", muonIsTrigger[iMuo]);
@@ -257,7 +275,7 @@ void MuonTriggerSelector::produce(edm::Event& iEvent, const edm::EventSetup& iSe
         muons_out->back().addUserInt("skipMuon",SkipMuon);
 
         for(unsigned int i=0; i<HLTPaths_.size(); i++){muons_out->back().addUserInt(HLTPaths_[i],fires[iMuo][i]);}
-        trans_muons_out->emplace_back(muonTT);
+        trans_muons_out->emplace_back(muon.bestTrack(), &bField);
 
 
     }
@@ -265,11 +283,21 @@ void MuonTriggerSelector::produce(edm::Event& iEvent, const edm::EventSetup& iSe
  
 
 
+    if(debug_scratch_) {
+        scratch_marks_.mark("muons", muons->size());
+        scratch_marks_.mark("fires", fires.size());
+        stream_ = iEvent.streamID().value();
+    }
+
     iEvent.put(std::move(trgmuons_out),    "trgMuons"); 
     iEvent.put(std::move(muons_out),       "SelectedMuons");
     iEvent.put(std::move(trans_muons_out), "SelectedTransientMuons");
 }
 
 
+void MuonTriggerSelector::endStream() {
+    if(debug_scratch_) scratch_marks_.report(moduleDescription().moduleLabel(), stream_);
+}
+
 
 DEFINE_FWK_MODULE(MuonTriggerSelector);
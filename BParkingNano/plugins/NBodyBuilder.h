@@ -0,0 +1,198 @@
+#ifndef PhysicsTools_BParkingNano_NBodyBuilder
+#define PhysicsTools_BParkingNano_NBodyBuilder
+
+#include "DataFormats/Math/interface/deltaR.h"
+#include "DataFormats/PatCandidates/interface/PackedCandidate.h"
+#include "TrackingTools/TransientTrack/interface/TransientTrack.h"
+#include "KinVtxFitter.h"
+#include "OrderedParallelFor.h"
+#include "PhysicsTools/BParkingNano/interface/DeltaR2.h"
+
+#include <array>
+#include <vector>
+#include <cstddef>
+
+// Common engine of the candidate builders (di-leptons, K*, B -> K ll,
+// B -> K* ll, ...). A decay is described by its N daughter slots; the engine
+// runs the combinatorics over them, fits the selected combinations for a
+// given mass hypothesis and provides the fitted daughter kinematics and the
+// track isolation cones. The builders only fill their own variables.
+namespace nbody {
+
+  // One daughter of the decay, drawn from an input collection
+  struct Slot {
+    size_t size = 0;                           // candidates in the input collection
+    const std::vector<char> *accept = nullptr; // per-candidate preselection, all if null
+    int after = -1;                            // earlier slot filled from the same collection:
+                                               // only larger indices are taken here
+    int within = -1;                           // earlier slot restricting this one, with
+    const std::vector<std::vector<int> > *compatible = nullptr; // per candidate of that slot, the
+                                               // only indices taken here, in increasing order
+  };
+
+  template<size_t N> using Indices = std::array<size_t, N>;
+
+  template<size_t N>
+  class Combinatorics {
+  public:
+    explicit Combinatorics(const std::array<Slot, N> & slots): slots_(slots) {}
+
+    // Calls visit(indices, buffer) for every accepted combination, see
+    // ordered_parallel_for: out ends up the same whether or not the loop ran
+    // in parallel, in which case the index of the first slot selects the buffer
+    template<typename Buffer, typename Visit>
+    void run(bool parallel, Buffer & out, Visit && visit) const {
+      ordered_parallel_for(
+        slots_[0].size, parallel, out,
+        [&](size_t first, Buffer & buffer) {
+          if(!accepted(0, first)) return;
+          Indices<N> idx{};
+          idx[0] = first;
+          descend<1>(idx, buffer, visit);
+        }
+        );
+    }
+
+  private:
+    bool accepted(size_t slot, size_t i) const {
+      return slots_[slot].accept == nullptr || (*slots_[slot].accept)[i];
+    }
+
+    template<size_t D, typename Buffer, typename Visit>
+    void descend(Indices<N> & idx, Buffer & buffer, Visit & visit) const {
+      if constexpr (D == N) {
+        visit(static_cast<const Indices<N> &>(idx), buffer);
+      } else {
+        const Slot & slot = slots_[D];
+        size_t begin = (slot.after < 0) ? 0 : idx[slot.after] + 1;
+        if(slot.compatible != nullptr) {
+          for(int i : (*slot.compatible)[idx[slot.within]]) {
+            if(size_t(i) < begin || !accepted(D, i)) continue;
+            idx[D] = i;
+            descend<D + 1>(idx, buffer, visit);
+          }
+          return;
+        }
+        for(size_t i = begin; i < slot.size; ++i) {
+          if(!accepted(D, i)) continue;
+          idx[D] = i;
+          descend<D + 1>(idx, buffer, visit);
+        }
+      }
+    }
+
+    const std::array<Slot, N> slots_;
+  };
+
+  // kinematic vertex fit of the daughters under the given mass hypothesis
+  template<size_t N>
+  inline KinVtxFitter fit(const std::array<const reco::TransientTrack *, N> & ttracks,
+                          const std::array<double, N> & masses,
+                          const std::array<float, N> & sigmas) {
+    std::vector<reco::TransientTrack> tracks;
+    tracks.reserve(N);
+    for(const auto * ttrack : ttracks) tracks.push_back(*ttrack);
+    return KinVtxFitter(
+      tracks,
+      std::vector<double>(masses.begin(), masses.end()),
+      std::vector<float>(sigmas.begin(), sigmas.end())
+      );
+  }
+
+  // fitted daughter kinematics, rounded to float as they are stored
+  template<size_t N>
+  struct FittedDaughters {
+    std::array<float, N> pt, eta, phi;
+
+    explicit FittedDaughters(const KinVtxFitter & fitter) {
+      for(size_t i = 0; i < N; ++i) {
+        auto p4 = fitter.daughter_p4(i);
+        pt[i]  = p4.pt();
+        eta[i] = p4.eta();
+        phi[i] = p4.phi();
+      }
+    }
+  };
+
+  // scalar sum of the track pt in cones of 0.3 and 0.4 around M axes,
+  // plus the number of tracks within 0.4
+  template<size_t M>
+  struct ConeIsolation {
+    std::array<float, M> eta, phi;
+    std::array<float, M> iso03{}, iso04{};
+    std::array<int, M> n_isotrk{};
+
+    ConeIsolation(const std::array<float, M> & axes_eta, const std::array<float, M> & axes_phi):
+      eta(axes_eta), phi(axes_phi) {}
+
+    void add(double trk_pt, double trk_eta, double trk_phi) {
+      for(size_t m = 0; m < M; ++m) {
+        float dr = reco::deltaR(eta[m], phi[m], trk_eta, trk_phi);
+        if(dr < 0.4) {
+          iso04[m] += trk_pt;
+          n_isotrk[m]++;
+          if(dr < 0.3) iso03[m] += trk_pt;
+        }
+      }
+    }
+
+    // adds the tracks i of eta/phi/pt with skip[i] false, one axis at a time
+    // over the whole array; dr2 is a buffer of n
+    void add(size_t n, const float *trk_eta, const float *trk_phi, const double *trk_pt,
+             const char *skip, float *dr2) {
+      for(size_t m = 0; m < M; ++m) {
+        kin::deltaR2(eta[m], phi[m], trk_eta, trk_phi, n, dr2);
+        for(size_t i = 0; i < n; ++i) {
+          if(skip[i] || dr2[i] >= 0.16f) continue;
+          iso04[m] += trk_pt[i];
+          n_isotrk[m]++;
+          if(dr2[i] < 0.09f) iso03[m] += trk_pt[i];
+        }
+      }
+    }
+  };
+
+  // per-task buffers of the isolation over the whole track arrays
+  struct ConeBuffers {
+    std::vector<char> skip;
+    std::vector<float> dr2;
+
+    void resize(size_t n) { skip.assign(n, 0); dr2.resize(n); }
+  };
+
+  // packed + lost tracks passing the isolation selection, flattened once per
+  // event; key is the index in the packed + lost track list
+  struct IsoTracks {
+    std::vector<unsigned int> key;
+    std::vector<double> pt;
+    std::vector<float> eta, phi; // float for the deltaR2 kernel
+
+    size_t size() const { return key.size(); }
+    void clear() { key.clear(); pt.clear(); eta.clear(); phi.clear(); }
+
+    // replaces the content, keeping the capacity of the arrays
+    template<typename Selector>
+    void fill(const pat::PackedCandidateCollection & tracks,
+              const pat::PackedCandidateCollection & lost_tracks,
+              const Selector & selection) {
+      clear();
+      const unsigned int nTracks = tracks.size();
+      const unsigned int totalTracks = nTracks + lost_tracks.size();
+      key.reserve(totalTracks);
+      pt.reserve(totalTracks);
+      eta.reserve(totalTracks);
+      phi.reserve(totalTracks);
+      for(unsigned int iTrk = 0; iTrk < totalTracks; ++iTrk) {
+        const pat::PackedCandidate & trk = (iTrk < nTracks) ? tracks[iTrk] : lost_tracks[iTrk-nTracks];
+        if(!selection(trk)) continue;
+        key.push_back(iTrk);
+        pt.push_back(trk.pt());
+        eta.push_back(trk.eta());
+        phi.push_back(trk.phi());
+      }
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef PhysicsTools_BParkingNano_OrderedParallelFor
+#define PhysicsTools_BParkingNano_OrderedParallelFor
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
+#include <vector>
+#include <cstddef>
+#include <utility>
+
+// Runs body(i, buffer) for every i in [0, n) and leaves in out what the plain
+// loop writing everything to out gives. Serially, that is what runs. In
+// parallel, the indices are split across TBB tasks and each index owns its
+// own buffer; the buffers are then appended to out in index order with
+// Buffer::append(Buffer &&), independently of how the tasks were scheduled.
+template<typename Buffer, typename Body>
+inline void ordered_parallel_for(size_t n, bool parallel, Buffer & out, Body && body) {
+  if(parallel && n > 1) {
+    std::vector<Buffer> buffers(n);
+    tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, n),
+      [&](const tbb::blocked_range<size_t> & range) {
+        for(size_t i = range.begin(); i != range.end(); ++i) body(i, buffers[i]);
+      }
+      );
+    for(auto & buffer : buffers) out.append(std::move(buffer));
+  } else {
+    for(size_t i = 0; i < n; ++i) body(i, out);
+  }
+}
+
+#endif
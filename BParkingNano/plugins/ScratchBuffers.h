@@ -0,0 +1,64 @@
+#ifndef PhysicsTools_BParkingNano_ScratchBuffers
+#define PhysicsTools_BParkingNano_ScratchBuffers
+
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+#include "FWCore/ParameterSet/interface/ParameterSet.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Per-event bookkeeping of the producers lives in scratch buffers owned by
+// the stream (edm::StreamCache for the global modules, plain members for the
+// stream ones): they are cleared at each event but never freed, so once they
+// have grown to the largest event seen, no more heap allocation is needed.
+
+// Modules configured with 'debugScratch = True' record the largest size of
+// each of their buffers and report them at the end of the stream
+inline bool scratch_debug(const edm::ParameterSet &cfg) {
+  return cfg.existsAs<bool>("debugScratch") && cfg.getParameter<bool>("debugScratch");
+}
+
+// High-water marks of the scratch buffers of one stream
+class ScratchMarks {
+public:
+  void mark(const std::string &name, size_t size) {
+    auto found = std::find_if(marks_.begin(), marks_.end(), [&name](const std::pair<std::string, size_t> &mark) {
+        return mark.first == name;
+      });
+    if(found == marks_.end()) marks_.emplace_back(name, size);
+    else found->second = std::max(found->second, size);
+  }
+
+  void report(const std::string &module, unsigned int stream) const {
+    edm::LogVerbatim log("ScratchBuffers");
+    log << module << ", stream " << stream << ", scratch high-water marks:";
+    for(const auto & mark : marks_) log << "\n  " << mark.first << ": " << mark.second;
+  }
+
+private:
+  std::vector<std::pair<std::string, size_t> > marks_;
+};
+
+// rows x cols table stored in one buffer, e.g. per-object and per-path flags;
+// table[row][col] reads and writes as a nested vector would
+template<typename T>
+class ScratchTable {
+public:
+  void assign(size_t rows, size_t cols, const T &value) {
+    rows_ = rows;
+    cols_ = cols;
+    data_.assign(rows * cols, value);
+  }
+  T * operator[](size_t row) { return data_.data() + row * cols_; }
+  const T * operator[](size_t row) const { return data_.data() + row * cols_; }
+  size_t rows() const { return rows_; }
+  size_t size() const { return data_.size(); }
+
+private:
+  size_t rows_ = 0, cols_ = 0;
+  std::vector<T> data_;
+};
+
+#endif
@@ -3,10 +3,18 @@
 #include "DataFormats/PatCandidates/interface/CompositeCandidate.h"
 typedef SimpleFlatTableProducer<pat::CompositeCandidate> SimpleCompositeCandidateFlatTableProducer;
 
+#include "PhysicsTools/BParkingNano/interface/CompactCompositeCandidate.h"
+typedef SimpleFlatTableProducer<bph::CompactCompositeCandidate> SimpleCompactCandidateFlatTableProducer;
+
+#include "PhysicsTools/BParkingNano/interface/ElectronOverlay.h"
+typedef SimpleFlatTableProducer<bph::ElectronOverlay> SimpleElectronOverlayFlatTableProducer;
+
 //not really useful in the end because lowptgsf tracks come with BDT taht is not part of GsfTracks
 #include "DataFormats/GsfTrackReco/interface/GsfTrack.h"
 typedef SimpleFlatTableProducer<reco::GsfTrack> SimpleGsfTrackFlatTableProducer;
 
 #include "FWCore/Framework/interface/MakerMacros.h"
 DEFINE_FWK_MODULE(SimpleCompositeCandidateFlatTableProducer);
+DEFINE_FWK_MODULE(SimpleCompactCandidateFlatTableProducer);
+DEFINE_FWK_MODULE(SimpleElectronOverlayFlatTableProducer);
 DEFINE_FWK_MODULE(SimpleGsfTrackFlatTableProducer);
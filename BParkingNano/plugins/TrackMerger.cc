@@ -28,22 +28,49 @@
 #include "DataFormats/Common/interface/AssociationVector.h"
 
 #include "helper.h"
+#include "CompositeFactory.h"
+#include "ScratchBuffers.h"
 
-class TrackMerger : public edm::global::EDProducer<> {
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+  // flags of the muons sharing a source with a track
+  enum MuonMatch { MATCHED = 1, LOOSE = 2, SOFT = 4, MEDIUM = 8 };
+}
+
+// per-stream scratch, see ScratchBuffers.h
+template<typename Composite>
+struct TrackMergerScratch {
+  std::vector< std::pair<Composite,reco::TransientTrack> > vectrk_ttrk;
+  // pT of the selected tracks, sorted as a permutation before the output
+  std::vector<double> pt;
+  std::vector<size_t> order;
+  // (ProductID, key) of the packed candidates of the leptons, filled once
+  // per event: muon sources with their MuonMatch flags, PF electron sources,
+  // low pT electron packed candidates and lost tracks
+  std::unordered_map<ProductKey, int, ProductKeyHash> muon_sources;
+  std::unordered_set<ProductKey, ProductKeyHash> ele_sources, lowpt_packed, lowpt_lost;
+  ScratchMarks marks;
+};
+
+template<typename Composite>
+class TrackMergerT : public edm::global::EDProducer<edm::StreamCache<TrackMergerScratch<Composite> > > {
 
 
 public:
+  typedef std::vector<Composite> CompositeCollection;
 
   //would it be useful to give this a bit more standard structure?
-  explicit TrackMerger(const edm::ParameterSet &cfg):
-    bFieldToken_(esConsumes<MagneticField, IdealMagneticFieldRecord>()),
-    beamSpotSrc_(consumes<reco::BeamSpot>(cfg.getParameter<edm::InputTag>("beamSpot"))),
-    tracksToken_(consumes<pat::PackedCandidateCollection>(cfg.getParameter<edm::InputTag>("tracks"))),
-    lostTracksToken_(consumes<pat::PackedCandidateCollection>(cfg.getParameter<edm::InputTag>("lostTracks"))),
-    trgLeptonToken_(consumes<edm::View<reco::Candidate> >(cfg.getParameter<edm::InputTag>("trgLepton"))),
-    muonToken_(consumes<pat::MuonCollection>(cfg.getParameter<edm::InputTag>("muons"))),
-    eleToken_(consumes<pat::ElectronCollection>(cfg.getParameter<edm::InputTag>("pfElectrons"))),
-    vertexToken_(consumes<reco::VertexCollection> (cfg.getParameter<edm::InputTag>( "vertices" ))), 
+  explicit TrackMergerT(const edm::ParameterSet &cfg):
+    bFieldToken_(this->template esConsumes<MagneticField, IdealMagneticFieldRecord>()),
+    beamSpotSrc_(this->template consumes<reco::BeamSpot>(cfg.getParameter<edm::InputTag>("beamSpot"))),
+    tracksToken_(this->template consumes<pat::PackedCandidateCollection>(cfg.getParameter<edm::InputTag>("tracks"))),
+    lostTracksToken_(this->template consumes<pat::PackedCandidateCollection>(cfg.getParameter<edm::InputTag>("lostTracks"))),
+    trgLeptonToken_(this->template consumes<edm::View<reco::Candidate> >(cfg.getParameter<edm::InputTag>("trgLepton"))),
+    muonToken_(this->template consumes<pat::MuonCollection>(cfg.getParameter<edm::InputTag>("muons"))),
+    eleToken_(this->template consumes<pat::ElectronCollection>(cfg.getParameter<edm::InputTag>("pfElectrons"))),
+    vertexToken_(this->template consumes<reco::VertexCollection> (cfg.getParameter<edm::InputTag>( "vertices" ))), 
     lowptele_(),
     lowpteleTag_(cfg.getParameter<edm::InputTag>("lowPtElectrons")),
     trkPtCut_(cfg.getParameter<double>("trkPtCut")),
@@ -53,18 +80,30 @@ public:
     dcaSig_(cfg.getParameter<double>("dcaSig")),
     trkNormChiMin_(cfg.getParameter<int>("trkNormChiMin")),
     trkNormChiMax_(cfg.getParameter<int>("trkNormChiMax")),
-    filterTrack_(cfg.getParameter<bool>("filterTrack"))
+    filterTrack_(cfg.getParameter<bool>("filterTrack")),
+    factory_{bph::CompactSchema(
+        {"dxy", "dxyS", "dz", "dzS", "DCASig", "dzTrg"},
+        {"isPacked", "isLostTrk", "isMatchedToMuon", "isMatchedToLooseMuon", "isMatchedToSoftMuon",
+         "isMatchedToMediumMuon", "isMatchedToEle", "isMatchedToLowPtEle", "nValidHits", "keyPacked", "skipTrack"},
+        {"cand"})},
+    debug_scratch_{scratch_debug(cfg)}
 {
   if ( !lowpteleTag_.label().empty() ) {
-    lowptele_ = consumes<pat::ElectronCollection>(cfg.getParameter<edm::InputTag>("lowPtElectrons"));
+    lowptele_ = this->template consumes<pat::ElectronCollection>(cfg.getParameter<edm::InputTag>("lowPtElectrons"));
   }
-    produces<pat::CompositeCandidateCollection>("SelectedTracks");  
-    produces<TransientTrackCollection>("SelectedTransientTracks");  
+    this->template produces<CompositeCollection>("SelectedTracks");  
+    this->template produces<TransientTrackCollection>("SelectedTransientTracks");  
 }
 
-  ~TrackMerger() override {}
+  ~TrackMergerT() override {}
 
+  std::unique_ptr<TrackMergerScratch<Composite> > beginStream(edm::StreamID) const override {
+    return std::make_unique<TrackMergerScratch<Composite> >();
+  }
   void produce(edm::StreamID, edm::Event&, const edm::EventSetup&) const override;
+  void endStream(edm::StreamID sid) const override {
+    if(debug_scratch_) this->streamCache(sid)->marks.report(this->moduleDescription().moduleLabel(), sid.value());
+  }
 
   static void fillDescriptions(edm::ConfigurationDescriptions &descriptions) {}
   
@@ -90,6 +129,8 @@ private:
   const int trkNormChiMin_;
   const int trkNormChiMax_;
   const bool filterTrack_;
+  const CompositeFactory<Composite> factory_;
+  const bool debug_scratch_;
 };
 
 
@@ -97,7 +138,8 @@ private:
 
 
 
-void TrackMerger::produce(edm::StreamID, edm::Event &evt, edm::EventSetup const &stp) const {
+template<typename Composite>
+void TrackMergerT<Composite>::produce(edm::StreamID sid, edm::Event &evt, edm::EventSetup const &stp) const {
 
   //input
   edm::Handle<reco::BeamSpot> beamSpotHandle;
@@ -129,11 +171,60 @@ void TrackMerger::produce(edm::StreamID, edm::Event &evt, edm::EventSetup const
   unsigned int nTracks = tracks->size();
   unsigned int totalTracks = nTracks + lostTracks->size();
 
-  //ok this was CompositeCandidateCollection 
-  std::unique_ptr<pat::CompositeCandidateCollection> tracks_out      (new pat::CompositeCandidateCollection);
+  // index the leptons by the packed candidates they come from, so that each
+  // track is matched with a few lookups. Only the packed candidates can be
+  // sources of muons and PF electrons
+  TrackMergerScratch<Composite> & scratch = *this->streamCache(sid);
+  auto & muon_sources = scratch.muon_sources;
+  auto & ele_sources = scratch.ele_sources;
+  auto & lowpt_packed = scratch.lowpt_packed;
+  auto & lowpt_lost = scratch.lowpt_lost;
+  muon_sources.clear();
+  ele_sources.clear();
+  lowpt_packed.clear();
+  lowpt_lost.clear();
+
+  for (const pat::Muon &imutmp : *muons) {
+    int flags = 0;
+    for (unsigned int i = 0; i < imutmp.numberOfSourceCandidatePtrs(); ++i) {
+      const edm::Ptr<reco::Candidate> & source = imutmp.sourceCandidatePtr(i);
+      if (! (source.isNonnull() && source.isAvailable()) || source.id() != tracks.id()) continue;
+      if (flags == 0) {
+        flags = MATCHED;
+        if (imutmp.isLooseMuon())    flags |= LOOSE;
+        if (imutmp.isSoftMuon(PV))   flags |= SOFT;
+        if (imutmp.isMediumMuon())   flags |= MEDIUM;
+      }
+      muon_sources[ProductKey(source.id(), source.key())] |= flags;
+    }
+  }
+
+  for (const pat::Electron &ietmp : *pfele) {
+    for (unsigned int i = 0; i < ietmp.numberOfSourceCandidatePtrs(); ++i) {
+      const edm::Ptr<reco::Candidate> & source = ietmp.sourceCandidatePtr(i);
+      if (! (source.isNonnull() && source.isAvailable()) || source.id() != tracks.id()) continue;
+      ele_sources.emplace(source.id(), source.key());
+    }
+  }
+
+  if ( !lowpteleTag_.label().empty() ) {
+    for ( auto const& ele : *lowptele ) {
+      const edm::Ptr<pat::PackedCandidate>* packed = ele.hasUserData("ele2packed") ?
+        ele.userData<edm::Ptr<pat::PackedCandidate> >("ele2packed") : NULL;
+      const edm::Ptr<pat::PackedCandidate>* lost = ele.hasUserData("ele2lost") ?
+        ele.userData<edm::Ptr<pat::PackedCandidate> >("ele2lost") : NULL;
+      if ( packed != NULL && packed->isNonnull() ) lowpt_packed.emplace(packed->id(), packed->key());
+      if ( lost != NULL && lost->isNonnull() ) lowpt_lost.emplace(lost->id(), lost->key());
+    }
+  }
+
+  std::unique_ptr<CompositeCollection>               tracks_out      (new CompositeCollection);
   std::unique_ptr<TransientTrackCollection>          trans_tracks_out(new TransientTrackCollection);
 
-   std::vector< std::pair<pat::CompositeCandidate,reco::TransientTrack> > vectrk_ttrk; 
+   std::vector< std::pair<Composite,reco::TransientTrack> > & vectrk_ttrk = scratch.vectrk_ttrk;
+   vectrk_ttrk.clear();
+   std::vector<double> & vectrk_pt = scratch.pt;
+   vectrk_pt.clear();
   //try topreserve same logic avoiding the copy of the full collection
   /*
   //correct logic but a bit convoluted -> changing to smthn simpler
@@ -176,7 +267,7 @@ void TrackMerger::produce(edm::StreamID, edm::Event &evt, edm::EventSetup const
 
     // high purity requirment applied only in packedCands
     if( iTrk < nTracks && !trk.trackHighPurity()) continue;
-    const reco::TransientTrack trackTT( (*trk.bestTrack()) , &bField);
+    reco::TransientTrack trackTT( (*trk.bestTrack()) , &bField);
     //distance closest approach in x,y wrt beam spot
     std::pair<double,double> DCA = computeDCA(trackTT, beamSpot);
     float DCABS = DCA.first;
@@ -184,66 +275,19 @@ void TrackMerger::produce(edm::StreamID, edm::Event &evt, edm::EventSetup const
     float DCASig = (DCABSErr != 0 && float(DCABSErr) == DCABSErr) ? fabs(DCABS/DCABSErr) : -1;
     if (DCASig >  dcaSig_  && dcaSig_ >0) continue;
 
-    // clean tracks wrt to all muons
-    int matchedToMuon       = 0;
-    int matchedToLooseMuon  = 0;
-    int matchedToSoftMuon   = 0;
-    int matchedToMediumMuon = 0;
-    for (const pat::Muon &imutmp : *muons) {
-        for (unsigned int i = 0; i < imutmp.numberOfSourceCandidatePtrs(); ++i) {
-            if (! ((imutmp.sourceCandidatePtr(i)).isNonnull() && 
-                   (imutmp.sourceCandidatePtr(i)).isAvailable())
-               )   continue;
-            
-            const edm::Ptr<reco::Candidate> & source = imutmp.sourceCandidatePtr(i);
-            if (source.id() == tracks.id() && source.key() == iTrk){
-                matchedToMuon =1;
-                if (imutmp.isLooseMuon())    matchedToLooseMuon  = 1;
-                if (imutmp.isSoftMuon(PV))   matchedToSoftMuon   = 1;
-                if (imutmp.isMediumMuon())   matchedToMediumMuon = 1;
-                break;
-            }
-        }
-    }
-
-    // clean tracks wrt to all pf electrons
-    int matchedToEle        = 0;
-    for (const pat::Electron &ietmp : *pfele) {
-        for (unsigned int i = 0; i < ietmp.numberOfSourceCandidatePtrs(); ++i) {
-            
-            if (! ((ietmp.sourceCandidatePtr(i)).isNonnull() && 
-                   (ietmp.sourceCandidatePtr(i)).isAvailable())
-               )   continue;
-            const edm::Ptr<reco::Candidate> & source = ietmp.sourceCandidatePtr(i);
-            if (source.id() == tracks.id() && source.key() == iTrk){
-                matchedToEle =1;
-                break;
-            }        
-        }
-
-    }
-
-    // clean tracks wrt to all low pT electrons
-    edm::Ptr<pat::PackedCandidate> track;
-    if ( iTrk < nTracks ) { track = edm::Ptr<pat::PackedCandidate>(tracks,iTrk); }
-    else { track = edm::Ptr<pat::PackedCandidate>(lostTracks,iTrk-nTracks); }
-    int matchedToLowPtEle = 0;
-    if ( !lowpteleTag_.label().empty() ) {
-      for ( auto const& ele : *lowptele ) {
-	reco::GsfTrackRef gsf = ele.gsfTrack();
-	if ( iTrk < nTracks ) {
-	  const edm::Ptr<pat::PackedCandidate>* packed = ele.hasUserData("ele2packed") ?
-	    ele.userData<edm::Ptr<pat::PackedCandidate> >("ele2packed") : NULL;
-	  if ( packed != NULL && track == *packed ) { matchedToLowPtEle = 1; break; }
-	} else {
-	  const edm::Ptr<pat::PackedCandidate>* lost = ele.hasUserData("ele2lost") ?
-	    ele.userData<edm::Ptr<pat::PackedCandidate> >("ele2lost") : NULL;
-	  if ( lost != NULL && track == *lost ) { matchedToLowPtEle = 1; break; }
-	}
-      }
-    }
-
-    pat::CompositeCandidate pcand;
+    // clean tracks wrt to all muons, pf and low pT electrons
+    const ProductKey track = ( iTrk < nTracks ) ? ProductKey(tracks.id(), iTrk) :
+                                                  ProductKey(lostTracks.id(), iTrk-nTracks);
+    const auto muon = muon_sources.find(track);
+    const int muon_flags = muon != muon_sources.end() ? muon->second : 0;
+    int matchedToMuon       = (muon_flags & MATCHED) != 0;
+    int matchedToLooseMuon  = (muon_flags & LOOSE) != 0;
+    int matchedToSoftMuon   = (muon_flags & SOFT) != 0;
+    int matchedToMediumMuon = (muon_flags & MEDIUM) != 0;
+    int matchedToEle        = ele_sources.count(track);
+    int matchedToLowPtEle   = (( iTrk < nTracks ) ? lowpt_packed : lowpt_lost).count(track);
+
+    Composite pcand = factory_.make();
     pcand.setP4(trk.p4());
     pcand.setCharge(trk.charge());
     pcand.setVertex(trk.vertex());
@@ -272,19 +316,28 @@ void TrackMerger::produce(edm::StreamID, edm::Event &evt, edm::EventSetup const
       pcand.addUserCand( "cand", edm::Ptr<pat::PackedCandidate> ( lostTracks, iTrk-nTracks ));   
  
   //in order to avoid revoking the sxpensive ttrack builder many times and still have everything sorted, we add them to vector of pairs
-   vectrk_ttrk.emplace_back( std::make_pair(pcand,trackTT ) );   
+   vectrk_pt.push_back(pcand.pt());
+   vectrk_ttrk.emplace_back(std::move(pcand), std::move(trackTT));
   }
 
-  // sort to be uniform with leptons
-  std::sort( vectrk_ttrk.begin(), vectrk_ttrk.end(), 
-             [] ( auto & trk1, auto & trk2) -> 
-                  bool {return (trk1.first).pt() > (trk2.first).pt();} 
-           );
+  if(debug_scratch_) {
+    scratch.marks.mark("vectrk_ttrk", vectrk_ttrk.size());
+    scratch.marks.mark("muon_sources", muon_sources.size());
+    scratch.marks.mark("ele_sources", ele_sources.size());
+    scratch.marks.mark("lowpt_electrons", lowpt_packed.size() + lowpt_lost.size());
+  }
+
+  // sort to be uniform with leptons: only the pT keys are sorted, each track
+  // is then moved once to the output
+  std::vector<size_t> & order = scratch.order;
+  decreasing_order(vectrk_pt, order);
 
   // finnaly save ttrks and trks to the correct _out vectors
-  for ( auto & trk: vectrk_ttrk){
-    tracks_out -> emplace_back( trk.first);
-    trans_tracks_out -> emplace_back(trk.second);
+  tracks_out -> reserve(order.size());
+  trans_tracks_out -> reserve(order.size());
+  for ( size_t iSel : order){
+    tracks_out -> emplace_back(std::move(vectrk_ttrk[iSel].first));
+    trans_tracks_out -> emplace_back(std::move(vectrk_ttrk[iSel].second));
   }
 
   evt.put(std::move(tracks_out),       "SelectedTracks");
@@ -292,5 +345,9 @@ void TrackMerger::produce(edm::StreamID, edm::Event &evt, edm::EventSetup const
 }
 
 
+typedef TrackMergerT<pat::CompositeCandidate> TrackMerger;
+typedef TrackMergerT<bph::CompactCompositeCandidate> CompactTrackMerger;
+
 //define this as a plug-in
 DEFINE_FWK_MODULE(TrackMerger);
+DEFINE_FWK_MODULE(CompactTrackMerger);
@@ -0,0 +1,97 @@
+#ifndef PhysicsTools_BParkingNano_UserKey
+#define PhysicsTools_BParkingNano_UserKey
+
+#include "DataFormats/PatCandidates/interface/Electron.h"
+#include "PhysicsTools/BParkingNano/interface/CompactCompositeCandidate.h"
+
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+// Name of a user data entry or electron ID, resolved to its slot on first
+// use and cached for the following objects. Meant to be a (const) member of
+// the module, built from the name once, and used in the per-object loops:
+//   const UserKey l1_idx_{"l1_idx"};
+//   int l1_idx = l1_idx_.userInt(*ll_ptr);
+// Compact candidates are read by slot, the slot being cached per schema.
+// pat objects have no slot access to their user data and go through the
+// usual lookup. Electron IDs are cached as their position in the ID list,
+// which is the same for all the electrons of a collection, and checked by
+// name before use. The cache is thread safe: a stale or concurrent value
+// only costs a new resolution.
+class UserKey {
+public:
+  static constexpr int NONE = -1;
+
+  explicit UserKey(std::string name): name_{std::move(name)} {}
+  // the copy resolves again
+  UserKey(const UserKey &other): name_{other.name_} {}
+  UserKey & operator=(const UserKey &) = delete;
+
+  const std::string & name() const { return name_; }
+
+  template<typename T> float userFloat(const T &obj) const { return obj.userFloat(name_); }
+  template<typename T> int32_t userInt(const T &obj) const { return obj.userInt(name_); }
+  template<typename T> reco::CandidatePtr userCand(const T &obj) const { return obj.userCand(name_); }
+
+  float userFloat(const bph::CompactCompositeCandidate &cand) const {
+    const int slot = compactSlot(cand, FLOAT);
+    return slot != NONE ? cand.userFloatAt(slot) : cand.userFloat(name_);
+  }
+  int32_t userInt(const bph::CompactCompositeCandidate &cand) const {
+    const int slot = compactSlot(cand, INT);
+    return slot != NONE ? cand.userIntAt(slot) : cand.userInt(name_);
+  }
+  reco::CandidatePtr userCand(const bph::CompactCompositeCandidate &cand) const {
+    const int slot = compactSlot(cand, CAND);
+    return slot != NONE ? cand.userCandAt(slot) : cand.userCand(name_);
+  }
+
+  // position of the ID in ele.electronIDs(), NONE if not available
+  int electronIDIndex(const pat::Electron &ele) const {
+    const std::vector<pat::Electron::IdPair> & ids = ele.electronIDs();
+    int index = id_index_.load(std::memory_order_relaxed);
+    if(index != NONE && size_t(index) < ids.size() && ids[index].first == name_) return index;
+    auto found = std::find_if(ids.begin(), ids.end(),
+                              [this](const pat::Electron::IdPair &id) { return id.first == name_; });
+    if(found == ids.end()) return NONE;
+    index = found - ids.begin();
+    id_index_.store(index, std::memory_order_relaxed);
+    return index;
+  }
+  bool isElectronIDAvailable(const pat::Electron &ele) const { return electronIDIndex(ele) != NONE; }
+  // throws as pat::Electron::electronID if the ID is not available
+  float electronID(const pat::Electron &ele) const {
+    const int index = electronIDIndex(ele);
+    return index != NONE ? ele.electronIDs()[index].second : ele.electronID(name_);
+  }
+  float electronID(const pat::Electron &ele, float missing) const {
+    const int index = electronIDIndex(ele);
+    return index != NONE ? ele.electronIDs()[index].second : missing;
+  }
+
+private:
+  enum Kind { FLOAT = 1, INT = 2, CAND = 3 };
+  // cache: schema id (32 bits), kind (2 bits), slot + 1 (30 bits)
+  static constexpr uint64_t SLOT_MASK = (uint64_t(1) << 30) - 1;
+
+  int compactSlot(const bph::CompactCompositeCandidate &cand, Kind kind) const {
+    const uint64_t tag = (uint64_t(cand.schemaId()) << 32) | (uint64_t(kind) << 30);
+    const uint64_t cached = compact_slot_.load(std::memory_order_relaxed);
+    if((cached & ~SLOT_MASK) == tag) return int(cached & SLOT_MASK) - 1;
+    int slot = NONE;
+    if(const bph::CompactSchema * schema = cand.schema()) {
+      slot = kind == FLOAT ? schema->floatIndex(name_) :
+             kind == INT   ? schema->intIndex(name_) : schema->candIndex(name_);
+    }
+    compact_slot_.store(tag | uint64_t(slot + 1), std::memory_order_relaxed);
+    return slot;
+  }
+
+  const std::string name_;
+  mutable std::atomic<uint64_t> compact_slot_{0};
+  mutable std::atomic<int> id_index_{NONE};
+};
+
+#endif
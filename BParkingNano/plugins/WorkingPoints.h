@@ -0,0 +1,77 @@
+#ifndef PhysicsTools_BParkingNano_WorkingPoints
+#define PhysicsTools_BParkingNano_WorkingPoints
+
+#include "FWCore/ParameterSet/interface/ParameterSet.h"
+#include "FWCore/Utilities/interface/Exception.h"
+#include "CommonTools/Utils/interface/StringCutObjectSelector.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Named working points evaluated on top of the main selections of a builder,
+// so that one production serves several cut tunings:
+//   workingPoints = cms.VPSet(
+//     cms.PSet(name = cms.string('tight'), postVtxSelection = cms.string('...')),
+//     ...
+//   )
+// The main selections drive the combinatorics and the filtering, hence must
+// be the loosest. Each candidate gets the int 'wp_mask', with bit i set if
+// it passes working point i. A working point sets any of the cuts of the
+// builder; for the others the main cut applies.
+
+inline std::vector<edm::ParameterSet> working_points(const edm::ParameterSet &cfg) {
+  static const size_t MAX_WORKING_POINTS = 31; // bits of the int user data
+  std::vector<edm::ParameterSet> wps;
+  if(cfg.existsAs<std::vector<edm::ParameterSet> >("workingPoints"))
+    wps = cfg.getParameter<std::vector<edm::ParameterSet> >("workingPoints");
+  if(wps.size() > MAX_WORKING_POINTS)
+    throw cms::Exception("Configuration") << wps.size() << " working points configured, at most "
+                                          << MAX_WORKING_POINTS << " are supported";
+  return wps;
+}
+
+// One cut of the working points, e.g. their 'postVtxSelection'
+template<typename T>
+class WorkingPointCut {
+public:
+  WorkingPointCut(const std::vector<edm::ParameterSet> &wps, const std::string &name) {
+    for(size_t i = 0; i < wps.size(); ++i) {
+      const uint32_t bit = uint32_t(1) << i;
+      if(wps[i].existsAs<std::string>(name))
+        cuts_.emplace_back(bit, StringCutObjectSelector<T>(wps[i].getParameter<std::string>(name)));
+      else
+        main_bits_ |= bit;
+    }
+  }
+
+  // bits of the working points that obj fails; main_passed is the result of
+  // the main cut, used by the working points without their own
+  uint32_t failed(const T &obj, bool main_passed) const {
+    uint32_t bits = main_passed ? 0 : main_bits_;
+    for(const auto & cut : cuts_) {
+      if(!cut.second(obj)) bits |= cut.first;
+    }
+    return bits;
+  }
+
+private:
+  std::vector<std::pair<uint32_t, StringCutObjectSelector<T> > > cuts_;
+  uint32_t main_bits_ = 0;
+};
+
+// column documentation: which bit is which working point
+inline std::string working_points_doc(const std::vector<edm::ParameterSet> &wps) {
+  std::string doc = "Working points passed, bit";
+  for(size_t i = 0; i < wps.size(); ++i)
+    doc += (i ? ", " : " ") + std::to_string(i) + ": " + wps[i].getParameter<std::string>("name");
+  return doc;
+}
+
+// all the working points, minus the failed ones
+inline int32_t working_point_mask(size_t n_wps, uint32_t failed) {
+  return int32_t(((uint32_t(1) << n_wps) - 1) & ~failed);
+}
+
+#endif
@@ -9,6 +9,7 @@
 #include "DataFormats/GeometryCommonDetAlgo/interface/GlobalError.h"
 #include "DataFormats/Provenance/interface/ProductID.h"
 #include "TrackingTools/TransientTrack/interface/TransientTrack.h"
+#include "PhysicsTools/BParkingNano/interface/LazyTransientTrack.h"
 #include "DataFormats/GeometryVector/interface/PV3DBase.h"
 #include "Math/LorentzVector.h"
 
@@ -18,12 +19,35 @@
 #include "TrackingTools/IPTools/interface/IPTools.h"
 #include "TVector3.h"
 
+#include <array>
 #include <vector>
 #include <algorithm>
 #include <limits>
 #include <memory>
+#include <functional>
+#include <numeric>
+#include <utility>
+
+// transient tracks of the selected objects, built on demand by the builders
+typedef bph::LazyTransientTrackCollection TransientTrackCollection;
+
+// Indices of the keys by decreasing value, equal keys in input order: the
+// objects can then be moved once, in order, to the output collection
+inline void decreasing_order(const std::vector<double> &keys, std::vector<size_t> &order) {
+  order.resize(keys.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&keys](size_t i, size_t j) { return keys[i] > keys[j]; });
+}
 
-typedef std::vector<reco::TransientTrack> TransientTrackCollection;
+// (ProductID, key) of an edm::Ref or edm::Ptr, to index objects by what they
+// point to in hash maps
+typedef std::pair<edm::ProductID, size_t> ProductKey;
+struct ProductKeyHash {
+  size_t operator()(const ProductKey &product_key) const {
+    const uint64_t id = (uint64_t(product_key.first.processIndex()) << 16) | product_key.first.productIndex();
+    return std::hash<uint64_t>()((id << 32) ^ uint64_t(product_key.second));
+  }
+};
 
 constexpr float K_MASS = 0.493677;
 constexpr float PI_MASS = 0.139571;
@@ -46,6 +70,36 @@ inline std::pair<float, float> min_max_dr(const std::vector< edm::Ptr<reco::Cand
   return std::make_pair(min_dr, max_dr);
 }
 
+// same as above, for a fixed number of candidates: no allocation
+template<size_t N>
+inline std::pair<float, float> min_max_dr(const std::array<const reco::Candidate *, N> & cands) {
+  float min_dr = std::numeric_limits<float>::max();
+  float max_dr = 0.;
+  for(size_t i = 0; i < N; ++i) {
+    for(size_t j = i+1; j < N; ++j) {
+      float dr = reco::deltaR(*cands[i], *cands[j]);
+      min_dr = std::min(min_dr, dr);
+      max_dr = std::max(max_dr, dr);
+    }
+  }
+  return std::make_pair(min_dr, max_dr);
+}
+
+// same as above, from (eta, phi) pairs already extracted from the candidates
+template<size_t N>
+inline std::pair<float, float> min_max_dr(const std::array<std::pair<double, double>, N> & eta_phi) {
+  float min_dr = std::numeric_limits<float>::max();
+  float max_dr = 0.;
+  for(size_t i = 0; i < N; ++i) {
+    for(size_t j = i+1; j < N; ++j) {
+      float dr = reco::deltaR(eta_phi[i].first, eta_phi[i].second, eta_phi[j].first, eta_phi[j].second);
+      min_dr = std::min(min_dr, dr);
+      max_dr = std::max(max_dr, dr);
+    }
+  }
+  return std::make_pair(min_dr, max_dr);
+}
+
 template<typename FITTER, typename LORENTZ_VEC>
 inline double cos_theta_2D(const FITTER& fitter, const reco::BeamSpot &bs, const LORENTZ_VEC& p4) {
   if(!fitter.success()) return -2;
@@ -119,6 +173,20 @@ inline bool track_to_lepton_match(edm::Ptr<reco::Candidate> l_ptr, edm::ProductI
 }
 
 
+// keys of the lepton source candidates stored in the collection iso_tracks_id,
+// i.e. the tracks that track_to_lepton_match would flag for this lepton
+inline std::vector<unsigned int> lepton_source_keys(const reco::Candidate & lep, edm::ProductIndex iso_tracks_id)
+{
+  std::vector<unsigned int> keys;
+  for (unsigned int i = 0; i < lep.numberOfSourceCandidatePtrs(); ++i) {
+    const edm::Ptr<reco::Candidate> & source = lep.sourceCandidatePtr(i);
+    if (! (source.isNonnull() && source.isAvailable())) continue;
+    if (source.id().id() == iso_tracks_id) keys.push_back(source.key());
+  }
+  return keys;
+}
+
+
 inline std::pair<bool, Measurement1D> absoluteImpactParameter(const TrajectoryStateOnSurface& tsos,
                                                               RefCountedKinematicVertex vertex,
                                                               VertexDistance& distanceComputer){
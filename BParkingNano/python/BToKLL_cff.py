@@ -17,9 +17,10 @@ electronPairsForKee = cms.EDProducer(
 )
 
 BToKee = cms.EDProducer(
-    'BToKLLBuilder',
+    'BToKEEBuilder',
     dileptons = cms.InputTag('electronPairsForKee', 'SelectedDiLeptons'),
     dileptonKinVtxs = cms.InputTag('electronPairsForKee', 'SelectedDiLeptonKinVtxs'),
+    leptons = electronPairsForKee.src,
     leptonTransientTracks = electronPairsForKee.transientTracksSrc,
     kaons = cms.InputTag('tracksBPark', 'SelectedTracks'),
     kaonsTransientTracks = cms.InputTag('tracksBPark', 'SelectedTransientTracks'),
@@ -33,6 +34,8 @@ BToKee = cms.EDProducer(
     isotrkDCACut = cms.double(1.0),
     isotrkDCATightCut = cms.double(0.1),
     drIso_cleaning = cms.double(0.03),
+    # process the kaons in concurrent TBB tasks, output order is unchanged
+    parallelCombinatorics = cms.bool(False),
     filterBySelection = cms.bool(True),
     preVtxSelection = cms.string(
         'pt > 1.75 && userFloat("min_dr") > 0.03 '
@@ -43,6 +46,18 @@ BToKee = cms.EDProducer(
     )
 )
 
+# optional in-producer scoring (see plugins/CandidateScorer.h): the
+# candidates of an event are scored in one batch, get the 'score' user
+# float, and the ones below threshold are dropped, e.g.
+# BToKee.scoring = cms.PSet(
+#     graphPath = cms.FileInPath('PhysicsTools/BParkingNano/data/BToKee_score.pb'),
+#     inputName = cms.string('input'),
+#     outputName = cms.string('output'),
+#     features = cms.vstring('userFloat("fitted_pt")', 'userFloat("sv_prob")', ...),
+#     threshold = cms.double(0.),
+# )
+# BToKeeTable.variables.score = ufloat('score')
+
 muonPairsForKmumu = cms.EDProducer(
     'DiMuonBuilder',
     src = cms.InputTag('muonTrgSelector', 'SelectedMuons'),
@@ -56,9 +71,10 @@ muonPairsForKmumu = cms.EDProducer(
 )
 
 BToKmumu = cms.EDProducer(
-    'BToKLLBuilder',
+    'BToKMuMuBuilder',
     dileptons = cms.InputTag('muonPairsForKmumu', 'SelectedDiLeptons'),
     dileptonKinVtxs = cms.InputTag('muonPairsForKmumu', 'SelectedDiLeptonKinVtxs'),
+    leptons = muonPairsForKmumu.src,
     leptonTransientTracks = muonPairsForKmumu.transientTracksSrc,
     kaons = BToKee.kaons,
     kaonsTransientTracks = BToKee.kaonsTransientTracks,
@@ -72,6 +88,7 @@ BToKmumu = cms.EDProducer(
     isotrkDCACut = BToKee.isotrkDCACut,
     isotrkDCATightCut = BToKee.isotrkDCATightCut,
     drIso_cleaning = BToKee.drIso_cleaning,
+    parallelCombinatorics = BToKee.parallelCombinatorics,
     # This in principle can be different between electrons and muons
     filterBySelection = cms.bool(True),
     preVtxSelection = cms.string(
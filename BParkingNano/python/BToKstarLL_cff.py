@@ -37,12 +37,27 @@ KstarToKPi = cms.EDProducer(
         ' &&  pt()>2.0 && ( (mass() < 1.042 && mass() > 0.742)'
         ' || (userFloat("barMass") < 1.042 && userFloat("barMass") > 0.742) ) '
         ),
+        # loose bounds checked before building the pairs,
+        # they must not be tighter than preVtxSelection
+        pairPtMin = cms.double(2.0),
+        pairMassMin = cms.double(0.7),
+        pairMassMax = cms.double(1.1),
         postVtxSelection = cms.string('userFloat("sv_prob") > 1.e-5'
         ' && (  (userFloat("fitted_mass")<1.042 && userFloat("fitted_mass")>0.742)'
         ' || (userFloat("fitted_barMass")<1.042 && userFloat("fitted_barMass")>0.742)  )'
 )
 )
 
+# lepton-seeded K*: only tracks within seedMaxDz and seedMaxDR of a dilepton
+# vertex are paired; the indices of the compatible dileptons of each K* are
+# stored in the 'compatibleDileptons' product
+KstarToKPiSeededMuMu = KstarToKPi.clone(
+    dileptons = cms.InputTag('muonPairsForKstarMuMu', 'SelectedDiLeptons'),
+    dileptonKinVtxs = cms.InputTag('muonPairsForKstarMuMu', 'SelectedDiLeptonKinVtxs'),
+    seedMaxDz = cms.double(1.0),
+    seedMaxDR = cms.double(1.5),
+)
+
 
 
 ########################### B-> K* ll ##########################
@@ -55,6 +70,8 @@ BToKstarMuMu = cms.EDProducer(
     tracks = cms.InputTag("packedPFCandidates"),
     lostTracks = cms.InputTag("lostTracks"),
     isoTracksSelection = cms.string('pt > 0.7 && abs(eta)<2.5'),
+    # process the K* in concurrent TBB tasks, output order is unchanged
+    parallelCombinatorics = cms.bool(False),
     
     beamSpot = cms.InputTag("offlineBeamSpot"),
     preVtxSelection = cms.string(
@@ -79,6 +96,7 @@ BToKstarEE = cms.EDProducer(
     tracks = cms.InputTag("packedPFCandidates"),
     lostTracks = cms.InputTag("lostTracks"),
     isoTracksSelection = BToKstarMuMu.isoTracksSelection,
+    parallelCombinatorics = BToKstarMuMu.parallelCombinatorics,
     
     beamSpot = cms.InputTag("offlineBeamSpot"),
     preVtxSelection = cms.string(
@@ -218,6 +236,12 @@ CountBToKstarMuMu = CountBToKstarEE.clone(
 
 KstarToKPiSequence = cms.Sequence(  KstarToKPi  )
 
+# B -> K* mumu from the lepton-seeded K*, each paired only with its
+# compatible dileptons; see nanoAOD_customizeBToKstarMuMuSeeded
+BToKstarMuMuSeededSequence = cms.Sequence(
+    (muonPairsForKstarMuMu * KstarToKPiSeededMuMu * BToKstarMuMu)
+)
+
 BToKstarMuMuSequence = cms.Sequence(
     (muonPairsForKstarMuMu *BToKstarMuMu )
 )
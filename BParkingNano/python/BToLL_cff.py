@@ -0,0 +1,47 @@
+import FWCore.ParameterSet.Config as cms
+from PhysicsTools.BParkingNano.common_cff import *
+from PhysicsTools.BParkingNano.BToKLL_cff import *
+from PhysicsTools.BParkingNano.BToKstarLL_cff import *
+
+# parameters of the single-channel modules taken by BToLL: shared by all the
+# channels, and per channel. The optional ones (tableName, tableDoc,
+# compatibleDileptons) are taken only where the module has them
+_sharedParameters = [
+    'kaons', 'kaonsTransientTracks', 'kaonSelection', 'isoTracksDCASelection',
+    'beamSpot', 'offlinePrimaryVertexSrc', 'tracks', 'lostTracks', 'parallelCombinatorics',
+]
+_kllParameters = [
+    'dileptons', 'dileptonKinVtxs', 'leptons', 'leptonTransientTracks',
+    'isoTracksSelection', 'isotrkDCACut', 'isotrkDCATightCut', 'drIso_cleaning',
+    'filterBySelection', 'preVtxSelection', 'postVtxSelection', 'tableName', 'tableDoc',
+]
+_kstarllParameters = [
+    'dileptons', 'leptonTransientTracks', 'kstars', 'kstarsTransientTracks',
+    'isoTracksSelection', 'preVtxSelection', 'postVtxSelection', 'compatibleDileptons',
+]
+_channelParameters = {
+    'Kee'       : _kllParameters,
+    'Kmumu'     : _kllParameters,
+    'KstarEE'   : _kstarllParameters,
+    'KstarMuMu' : _kstarllParameters,
+}
+
+# the parameters of BToLL taken from a single-channel module, the shared
+# ones when no channel is given
+def bToLLParameters(module, channel = None):
+    names = _sharedParameters if channel is None else _channelParameters[channel]
+    return dict((name, getattr(module, name)) for name in names if hasattr(module, name))
+
+# All the B -> (K, K*) ll channels in a single module: kaons, isolation
+# tracks and beam spot are prepared once per event instead of once per
+# channel. The channel settings are the ones of the single-channel modules;
+# the kaon selections are shared, so they must be the same for Kee and Kmumu.
+# nanoAOD_customizeBToLL takes them again from the modules of the process
+BToLL = cms.EDProducer(
+    'BToLLMultiChannelBuilder',
+    Kee       = cms.PSet(**bToLLParameters(BToKee, 'Kee')),
+    Kmumu     = cms.PSet(**bToLLParameters(BToKmumu, 'Kmumu')),
+    KstarEE   = cms.PSet(**bToLLParameters(BToKstarEE, 'KstarEE')),
+    KstarMuMu = cms.PSet(**bToLLParameters(BToKstarMuMu, 'KstarMuMu')),
+    **bToLLParameters(BToKee)
+)
@@ -10,3 +10,13 @@ def uint(expr, doc = ''):
 
 def ubool(expr, precision = -1, doc = ''):
   return Var('userInt("%s") == 1' % expr, bool, doc = doc)
+
+def addWorkingPoints(builder, table, wps):
+  '''Configures the working points of a builder (see plugins/WorkingPoints.h),
+  wps being a list of cms.PSet with a name and the cuts they change, and adds
+  their bitmask to the table of the builder, if any'''
+  builder.workingPoints = cms.VPSet(*wps)
+  if table is not None:
+    doc = 'Working points passed, bit' + ','.join(
+      ' %d: %s' % (i, wp.name.value()) for i, wp in enumerate(wps))
+    table.variables.wp_mask = uint('wp_mask', doc = doc)
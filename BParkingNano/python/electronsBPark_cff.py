@@ -9,45 +9,76 @@ from PhysicsTools.BParkingNano.mvaElectronID_BParkRetrain_cff \
     import mvaEleID_BParkRetrain_producer_config
 mvaConfigsForEleProducer.append( mvaEleID_Fall17_noIso_V2_producer_config )
 mvaConfigsForEleProducer.append( mvaEleID_BParkRetrain_producer_config )
+
+# Preselection of electronsForAnalysis, shared with the MVA value maps that
+# are evaluated only for the electrons that can pass it: both modules hold
+# this same PSet, to be changed here (or through the modules, before the
+# customizations that replace them)
+electronPreselection = cms.PSet(
+  trgLepton = cms.InputTag('muonTrgSelector:trgMuons'),
+  pf_ptMin = cms.double(1.),
+  ptMin = cms.double(0.5),
+  etaMax = cms.double(2.5),
+  dzForCleaning_wrtTrgLepton = cms.double(1.),
+  filterEle = cms.bool(True),
+  # the MVA value maps cut on the pT of the input electrons, the merger on
+  # the regressed one if it runs the PF regression (gsfRegressionConfig):
+  # the merger then requires the cut to be disabled here
+  mvaPtCut = cms.bool(True),
+)
+
+# the electrons failing the preselection get -999
 electronMVAValueMapProducer = cms.EDProducer(
-    'ElectronMVAValueMapProducer',
+    'BParkElectronMVAValueMapProducer',
     src = cms.InputTag('slimmedElectrons'),#,processName=cms.InputTag.skipCurrentProcess()),
     mvaConfigurations = mvaConfigsForEleProducer,
+    preselection = electronPreselection,
 )
 
 #Everything can be done here, in one loop and save time :)
 electronsForAnalysis = cms.EDProducer(
   'ElectronMerger',
-  trgLepton = cms.InputTag('muonTrgSelector:trgMuons'),
+  preselection = electronPreselection,
   lowptSrc = cms.InputTag('slimmedLowPtElectrons'), # Only used if saveLowPtE == True
   pfSrc    = cms.InputTag('slimmedElectrons'),
   pfmvaId = cms.InputTag("electronMVAValueMapProducer:ElectronMVAEstimatorRun2BParkRetrainRawValues"),
   pfmvaId_Run2 = cms.InputTag("electronMVAValueMapProducer:ElectronMVAEstimatorRun2Fall17NoIsoV2RawValues"),
   #pfmvaId_Run3 = cms.InputTag("electronMVAValueMapProducer:ElectronMVAEstimatorRun2RunIIIWinter22NoIsoV1RawValues"),
   vertexCollection = cms.InputTag("offlineSlimmedPrimaryVertices"),
-  ## cleaning wrt trigger lepton [-1 == no cut]
+  ## cleaning wrt trigger lepton [-1 == no cut], dz in the preselection
   drForCleaning_wrtTrgLepton = cms.double(0.03),
-  dzForCleaning_wrtTrgLepton = cms.double(1.),
   ## cleaning between pfEle and lowPtGsf
   drForCleaning = cms.double(0.03),
   dzForCleaning = cms.double(0.5), ##keep tighter dZ to check overlap of pfEle with lowPt (?)
   ## true = flag and clean; false = only flag
   flagAndclean = cms.bool(False),
-  pf_ptMin = cms.double(1.),
-  ptMin = cms.double(0.5),
-  etaMax = cms.double(2.5),
   bdtMin = cms.double(-2.5), #@@ was -2.5, this cut can be used to deactivate low pT e if set to >12
   useRegressionModeForP4 = cms.bool(False),
   useGsfModeForP4 = cms.bool(False),
   sortOutputCollections = cms.bool(True),
   saveLowPtE = cms.bool(True),
-  filterEle = cms.bool(True),
     # conversions
     conversions = cms.InputTag('gsfTracksOpenConversions:gsfTracksOpenConversions'),
     beamSpot = cms.InputTag("offlineBeamSpot"),
     addUserVarsExtra = cms.bool(False),
 )
 
+# The merger can also run the energy regression and read the low pT seeding
+# and ID values from value maps, in the same pass as the selection, instead
+# of chaining ElectronRegresser and PATLowPtElectronSeedingEmbedder, each
+# storing a full copy of the electrons. The PSets are the ones these modules
+# take, e.g.:
+# electronsForAnalysis.gsfRegressionConfig = cms.PSet(modifierName = cms.string('...'), ...)
+# electronPreselection.mvaPtCut = False # with the PF regression, see above
+# electronsForAnalysis.lowPtRegressionConfig = cms.PSet(modifierName = cms.string('...'), ...)
+# electronsForAnalysis.lowPtSeeding = cms.PSet(
+#   ptbiasedSeeding = cms.InputTag('lowPtGsfElectronSeedValueMaps', 'ptbiased'),
+#   unbiasedSeeding = cms.InputTag('lowPtGsfElectronSeedValueMaps', 'unbiased'),
+#   mvaId = cms.InputTag('lowPtGsfElectronID'),
+#   minBdtUnbiased = cms.double(-10.),
+# )
+# The regression is not available for ElectronOverlayMerger.
+
 #cuts minimun number in B both mu and e, min number of trg, dz electron, dz and dr track, 
 countTrgElectrons = cms.EDFilter("PATCandViewCountFilter",
     minNumber = cms.uint32(1),
@@ -178,20 +209,23 @@ electronBParkTables = cms.Sequence(electronBParkTable)
 
 from PhysicsTools.BParkingNano.modifiers_cff import *
 
-BToKEE_OpenConfig.toModify(electronsForAnalysis,
+BToKEE_OpenConfig.toModify(electronPreselection,
                            pf_ptMin=0.5,
                            ptMin=0.5,
                            etaMax=2.5,
+                           #dzForCleaning_wrtTrgLepton=-1.,
+                           filterEle=False)
+BToKEE_OpenConfig.toModify(electronsForAnalysis,
                            bdtMin=-1.e3,
                            flagAndclean=False,
                            #drForCleaning_wrtTrgLepton=-1.,
-                           #dzForCleaning_wrtTrgLepton=-1.,
                            #drForCleaning=-1.,
                            #dzForCleaning=-1.,
-                           filterEle=False)
+                           )
 
+BToKEE_DiEle.toModify(electronPreselection,
+                      trgLepton = 'electronTrgSelector:trgElectrons')
 BToKEE_DiEle.toModify(electronsForAnalysis,
-                      trgLepton = 'electronTrgSelector:trgElectrons',
                       bdtMin = -100., # Open this up and rely on L/M/T WPs
                       useGsfModeForP4 = True, # Use GSF for PF ele as well
                       saveLowPtE = False, # Don't use low-pT ele
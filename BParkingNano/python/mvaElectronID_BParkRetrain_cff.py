@@ -28,3 +28,14 @@ mvaEleID_BParkRetrain_producer_config = cms.PSet(
     variableDefinition  = cms.string(mvaVariablesFile)
     )
 
+# Same ID, with the forests memory-mapped from the binary files of
+# BParkElectronMVAEstimator instead of parsed from the xml at the start of
+# the job. The binary files are made, and the two compared, with
+#   convertBParkForest <weights>.xml.gz <weights>.bin
+#   convertBParkForest --benchmark <weights>.xml.gz <weights>.bin
+# in a CMSSW area, against the GBRForest of the release; they are not part
+# of the package and must be made again when the xml files change
+mvaEleID_BParkRetrain_binary_producer_config = mvaEleID_BParkRetrain_producer_config.clone(
+    mvaName         = 'BParkElectronMVAEstimator',
+    weightFileNames = [f.replace('.xml.gz', '.bin') for f in mvaWeightFiles],
+    )
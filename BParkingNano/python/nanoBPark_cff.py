@@ -1,4 +1,6 @@
 from __future__ import print_function
+from functools import reduce
+import operator
 import FWCore.ParameterSet.Config as cms
 from PhysicsTools.NanoAOD.common_cff import *
 from PhysicsTools.NanoAOD.globals_cff import *
@@ -20,6 +22,7 @@ from PhysicsTools.BParkingNano.tracksBPark_cff import *
 ## B collections
 from PhysicsTools.BParkingNano.BToKLL_cff import *
 from PhysicsTools.BParkingNano.BToKstarLL_cff import *
+from PhysicsTools.BParkingNano.BToLL_cff import *
 
 
 nanoSequenceOnlyFullSim = cms.Sequence(triggerObjectBParkTables + l1bits)
@@ -64,17 +67,148 @@ def nanoAOD_customizeBToKLL(process):
     process.nanoBKMuMuSequence = cms.Sequence( BToKMuMuSequence + BToKmumuTable )
     return process
 
+# the B -> K ll builders write their tables themselves, skipping the
+# user data and the generic table producers
+def nanoAOD_customizeBToKLLDirectTables(process):
+    process.BToKee.tableName   = BToKeeTable.name
+    process.BToKee.tableDoc    = BToKeeTable.doc
+    process.BToKmumu.tableName = BToKmumuTable.name
+    process.BToKmumu.tableDoc  = BToKmumuTable.doc
+    process.nanoBKeeSequence.remove(process.BToKeeTable)
+    process.nanoBKMuMuSequence.remove(process.BToKmumuTable)
+    return process
+
 #three possibilities for K*LL
 def nanoAOD_customizeBToKstarLL(process):
     process.nanoBKstarLLSequence   = cms.Sequence( KstarToKPiSequence + BToKstarLLSequence + KstarToKPiTable + BToKstarLLTables )
     return process
 
 def nanoAOD_customizeBToKstarEE(process):
-    process.nanoBKstarEESequence   = cms.Sequence( process.nanoBKstarEESequence + BToKstarEESequence + BToKstarEETable + KstarToKPiTable )
+    process.nanoBKstarEESequence   = cms.Sequence( process.nanoBKstarEESequence + KstarToKPiSequence + BToKstarEESequence + BToKstarEETable + KstarToKPiTable )
     return process
 
 def nanoAOD_customizeBToKstarMuMu(process):
-    process.nanoBKstarMuMuSequence = cms.Sequence( BToKstarMuMuSequence + BToKstarMuMuTable + KstarToKPiTable )
+    process.nanoBKstarMuMuSequence = cms.Sequence( KstarToKPiSequence + BToKstarMuMuSequence + BToKstarMuMuTable + KstarToKPiTable )
+    return process
+
+# B -> K* mumu from the lepton-seeded K*: only the tracks close to a dimuon
+# are paired, and each K* only with the dimuons it is close to. Instead of
+# nanoAOD_customizeBToKstarMuMu; KstarToKPiTable then holds the seeded K*
+def nanoAOD_customizeBToKstarMuMuSeeded(process):
+    process.BToKstarMuMu.kstars = cms.InputTag('KstarToKPiSeededMuMu')
+    process.BToKstarMuMu.compatibleDileptons = cms.InputTag('KstarToKPiSeededMuMu', 'compatibleDileptons')
+    process.KstarToKPiTable.src = cms.InputTag('KstarToKPiSeededMuMu')
+    process.nanoBKstarMuMuSequence = cms.Sequence( BToKstarMuMuSeededSequence + BToKstarMuMuTable + KstarToKPiTable )
+    return process
+
+# the given B channels in a single producer sharing the track inputs, to be
+# used instead of the per-channel customizations above, after the electron
+# one. The channel sequences are all replaced by the same one, holding the
+# inputs of every channel, BToLL and the channel tables; the tables and the
+# count filters keep their labels and names and read BToLL instead of the
+# single-channel builders, whose settings BToLL takes
+_bToLLChannels = {
+    # channel      builder         dileptons                  table                count filter
+    'Kee'       : ('BToKee',       'electronPairsForKee',     'BToKeeTable',       'CountBToKee'),
+    'Kmumu'     : ('BToKmumu',     'muonPairsForKmumu',       'BToKmumuTable',     'CountBToKmumu'),
+    'KstarEE'   : ('BToKstarEE',   'electronPairsForKstarEE', 'BToKstarEETable',   'CountBToKstarEE'),
+    'KstarMuMu' : ('BToKstarMuMu', 'muonPairsForKstarMuMu',   'BToKstarMuMuTable', 'CountBToKstarMuMu'),
+}
+def nanoAOD_customizeBToLL(process, channels = ['Kee', 'Kmumu', 'KstarEE', 'KstarMuMu']):
+    kll = [channel for channel in channels if not channel.startswith('Kstar')]
+    parameters = bToLLParameters(getattr(process, _bToLLChannels[kll[0]][0] if kll else 'BToKee'))
+    inputs, tables = [], []
+    if any(channel.endswith('EE') for channel in channels):
+        inputs += [electronsBParkSequence, electronBParkTables]
+    if len(kll) < len(channels):
+        tables += [KstarToKPiTable]
+    for channel in channels:
+        builder, dileptons, table, count = _bToLLChannels[channel]
+        parameters[channel] = cms.PSet(**bToLLParameters(getattr(process, builder), channel))
+        inputs += [getattr(process, dileptons)]
+        # the K* after the dileptons, which seed them in the seeded mode
+        if hasattr(parameters[channel], 'kstars'):
+            kstars = getattr(process, parameters[channel].kstars.getModuleLabel())
+            if kstars not in inputs:
+                inputs += [kstars]
+        # with the direct tables, BToLL writes the table itself
+        if not hasattr(parameters[channel], 'tableName'):
+            getattr(process, table).src = cms.InputTag('BToLL', channel)
+            tables += [getattr(process, table)]
+        getattr(process, count).src = cms.InputTag('BToLL', channel)
+    process.BToLL = cms.EDProducer('BToLLMultiChannelBuilder', **parameters)
+    process.nanoBToLLSequence = cms.Sequence( reduce(operator.add, inputs) * process.BToLL )
+    for table in tables:
+        process.nanoBToLLSequence += table
+    process.nanoBKeeSequence       = cms.Sequence( process.nanoBToLLSequence )
+    process.nanoBKMuMuSequence     = cms.Sequence( process.nanoBToLLSequence )
+    process.nanoBKstarEESequence   = cms.Sequence( process.nanoBToLLSequence )
+    process.nanoBKstarMuMuSequence = cms.Sequence( process.nanoBToLLSequence )
+    return process
+
+# bph::CompactCompositeCandidate instead of pat::CompositeCandidate for the
+# tracks, dileptons, K* and B candidates: the user data keys are stored once
+# per collection instead of once per candidate, and written once per run by
+# compactSchemas. Each builder reads the candidates of the previous step, so
+# the whole chain is switched at once; to be called after the other
+# customizations. The candidates have no daughters, the decay products are
+# user candidates (userCand('l1'), userCand('k'), ...): numberOfDaughters()
+# is 0 and daughter(i) throws, so cuts and tables must not use them
+_compactCandidateModules = {
+    'TrackMerger'                               : 'CompactTrackMerger',
+    'DiElectronBuilder'                         : 'CompactDiElectronBuilder',
+    'DiMuonBuilder'                             : 'CompactDiMuonBuilder',
+    'KstarBuilder'                              : 'CompactKstarBuilder',
+    'BToKEEBuilder'                             : 'CompactBToKEEBuilder',
+    'BToKMuMuBuilder'                           : 'CompactBToKMuMuBuilder',
+    'BToKstarLLBuilder'                         : 'CompactBToKstarLLBuilder',
+    'BToLLMultiChannelBuilder'                  : 'CompactBToLLMultiChannelBuilder',
+    'SimpleCompositeCandidateFlatTableProducer' : 'SimpleCompactCandidateFlatTableProducer',
+    'CompositeCandidateMatchEmbedder'           : 'CompactCandidateMatchEmbedder',
+}
+def nanoAOD_customizeCompactCandidates(process):
+    for label, module in list(process.producers_().items()):
+        if module.type_() in _compactCandidateModules:
+            setattr(process, label, cms.EDProducer(_compactCandidateModules[module.type_()], **module.parameters_()))
+    process.compactSchemas = cms.EDProducer('CompactSchemaProducer',
+        src = cms.InputTag('compactSchemas', '', '@skipCurrentProcess'),
+    )
+    process.nanoSequence += process.compactSchemas
+    return process
+
+# bph::ElectronOverlay instead of pat::Electron for the selected electrons:
+# the merger writes Ptrs to the input electrons plus the quantities it sets
+# (p4, impact parameters, user data) instead of copies of the full electrons.
+# The modules reading the selected electrons are switched with it; to be
+# called after the other customizations, the compact candidates included
+_electronOverlayModules = {
+    'ElectronMerger'                  : 'ElectronOverlayMerger',
+    'ElectronMatchEmbedder'           : 'ElectronOverlayMatchEmbedder',
+    'DiElectronBuilder'               : 'OverlayDiElectronBuilder',
+    'CompactDiElectronBuilder'        : 'CompactOverlayDiElectronBuilder',
+    'BToKEEBuilder'                   : 'OverlayBToKEEBuilder',
+    'CompactBToKEEBuilder'            : 'CompactOverlayBToKEEBuilder',
+    'BToLLMultiChannelBuilder'        : 'OverlayBToLLMultiChannelBuilder',
+    'CompactBToLLMultiChannelBuilder' : 'CompactOverlayBToLLMultiChannelBuilder',
+}
+def nanoAOD_customizeElectronOverlay(process):
+    for label, module in list(process.producers_().items()):
+        if module.type_() in _electronOverlayModules:
+            setattr(process, label, cms.EDProducer(_electronOverlayModules[module.type_()], **module.parameters_()))
+    # the electron table is a generic candidate table, switched by label
+    if hasattr(process, 'electronBParkTable'):
+        process.electronBParkTable = cms.EDProducer('SimpleElectronOverlayFlatTableProducer',
+                                                    **process.electronBParkTable.parameters_())
+    return process
+
+# the retrained PF electron ID from the binary forests, see mvaElectronID_BParkRetrain_cff;
+# opt-in, the .bin files have to be made next to the xml ones first
+def nanoAOD_customizeBinaryElectronMVA(process):
+    from PhysicsTools.BParkingNano.mvaElectronID_BParkRetrain_cff import mvaEleID_BParkRetrain_binary_producer_config
+    configs = process.electronMVAValueMapProducer.mvaConfigurations
+    for i, config in enumerate(configs):
+        if config.mvaTag.value() == mvaEleID_BParkRetrain_binary_producer_config.mvaTag.value():
+            configs[i] = mvaEleID_BParkRetrain_binary_producer_config.clone()
     return process
 
 from FWCore.ParameterSet.MassReplace import massSearchReplaceAnyInputTag
@@ -0,0 +1,211 @@
+#include "PhysicsTools/BParkingNano/interface/CompactCompositeCandidate.h"
+
+#include "FWCore/Utilities/interface/Exception.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+
+using namespace bph;
+
+namespace {
+  // 32 bits FNV-1a over the keys, with a separator between the key lists
+  CompactSchema::Id hash_keys(const std::vector<std::string> *lists[3]) {
+    uint32_t hash = 2166136261u;
+    auto add = [&hash](unsigned char c) { hash ^= c; hash *= 16777619u; };
+    for(size_t i = 0; i < 3; ++i) {
+      for(const auto & key : *lists[i]) {
+        for(char c : key) add(c);
+        add('\0');
+      }
+      add('\1');
+    }
+    return hash == 0 ? 1 : hash; // 0 means no schema
+  }
+
+  struct SchemaRegistry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<const CompactSchema> > schemas;
+    std::unordered_map<CompactSchema::Id, const CompactSchema *> by_id;
+  };
+  SchemaRegistry & registry() {
+    static SchemaRegistry registry_;
+    return registry_;
+  }
+
+  // the extra keys are kept sorted, the values in the same order
+  bool has_extra(const std::vector<std::string> &keys, const std::string &key) {
+    return std::binary_search(keys.begin(), keys.end(), key);
+  }
+
+  template<typename T>
+  const T * find_extra(const std::vector<std::string> &keys, const std::vector<T> &values, const std::string &key) {
+    auto found = std::lower_bound(keys.begin(), keys.end(), key);
+    return (found == keys.end() || *found != key) ? nullptr : &values[found - keys.begin()];
+  }
+
+  template<typename T>
+  void set_extra(std::vector<std::string> &keys, std::vector<T> &values, const std::string &key, const T &value) {
+    auto found = std::lower_bound(keys.begin(), keys.end(), key);
+    const size_t index = found - keys.begin();
+    if(found != keys.end() && *found == key) {
+      values[index] = value;
+    } else {
+      keys.insert(found, key);
+      values.insert(values.begin() + index, value);
+    }
+  }
+
+  [[noreturn]] void throw_missing(const char *type, const std::string &key, CompactSchema::Id id, bool known) {
+    cms::Exception ex("Missing Data");
+    ex << "CompactCompositeCandidate has no " << type << " with key " << key;
+    if(!known) ex << ", its schema " << id << " is not registered in this process";
+    throw ex;
+  }
+}
+
+CompactSchema::CompactSchema(std::vector<std::string> floats, std::vector<std::string> ints, std::vector<std::string> cands):
+  floats_{std::move(floats)}, ints_{std::move(ints)}, cands_{std::move(cands)} {
+  for(size_t i = 0; i < floats_.size(); ++i) float_slots_.emplace(floats_[i], i);
+  for(size_t i = 0; i < ints_.size(); ++i) int_slots_.emplace(ints_[i], i);
+  for(size_t i = 0; i < cands_.size(); ++i) cand_slots_.emplace(cands_[i], i);
+  if(float_slots_.size() != floats_.size() || int_slots_.size() != ints_.size() || cand_slots_.size() != cands_.size()) {
+    throw cms::Exception("Configuration") << "CompactSchema: duplicated key";
+  }
+  const std::vector<std::string> *lists[3] = {&floats_, &ints_, &cands_};
+  id_ = hash_keys(lists);
+}
+
+const CompactSchema & CompactSchema::registerSchema(const CompactSchema &schema) {
+  SchemaRegistry & reg = registry();
+  std::lock_guard<std::mutex> guard(reg.mutex);
+  auto found = reg.by_id.find(schema.id());
+  if(found != reg.by_id.end()) {
+    if(!found->second->sameKeys(schema)) {
+      throw cms::Exception("LogicError") << "CompactSchema: two different schemas share the id " << schema.id();
+    }
+    return *found->second;
+  }
+  reg.schemas.push_back(std::make_unique<const CompactSchema>(schema));
+  reg.by_id.emplace(schema.id(), reg.schemas.back().get());
+  return *reg.schemas.back();
+}
+
+const CompactSchema * CompactSchema::find(Id id) {
+  SchemaRegistry & reg = registry();
+  std::lock_guard<std::mutex> guard(reg.mutex);
+  auto found = reg.by_id.find(id);
+  return found == reg.by_id.end() ? nullptr : found->second;
+}
+
+std::vector<CompactSchema> CompactSchema::registered() {
+  SchemaRegistry & reg = registry();
+  std::lock_guard<std::mutex> guard(reg.mutex);
+  std::vector<CompactSchema> schemas;
+  schemas.reserve(reg.schemas.size());
+  for(const auto & schema : reg.schemas) schemas.push_back(*schema);
+  return schemas;
+}
+
+CompactCompositeCandidate::CompactCompositeCandidate(const CompactSchema &schema):
+  schemaId_{schema.id()},
+  floats_(schema.floatKeys().size(), 0.f),
+  ints_(schema.intKeys().size(), 0),
+  cands_(schema.candKeys().size()),
+  floatsSet_((schema.floatKeys().size() + 63) / 64, 0),
+  intsSet_((schema.intKeys().size() + 63) / 64, 0),
+  schema_{&schema} {}
+
+const reco::Candidate * CompactCompositeCandidate::daughter(size_type i) const {
+  throw cms::Exception("LogicError") << "CompactCompositeCandidate has no daughters, daughter(" << i
+                                     << ") requested: its decay products are user candidates";
+}
+
+reco::Candidate * CompactCompositeCandidate::daughter(size_type i) {
+  return const_cast<reco::Candidate *>(static_cast<const CompactCompositeCandidate *>(this)->daughter(i));
+}
+
+const CompactSchema * CompactCompositeCandidate::findSchema() const {
+  // the lookup takes the registry lock: done once, then cached
+  const CompactSchema * found = CompactSchema::find(schemaId_);
+  if(found) schema_.set(found);
+  return found;
+}
+
+float CompactCompositeCandidate::userFloat(const std::string &key) const {
+  const CompactSchema * s = schema();
+  const int slot = s ? s->floatIndex(key) : CompactSchema::NONE;
+  if(slot != CompactSchema::NONE) return floats_[slot];
+  const float * extra = find_extra(extraFloatKeys_, extraFloats_, key);
+  if(!extra) throw_missing("userFloat", key, schemaId_, s != nullptr);
+  return *extra;
+}
+
+int32_t CompactCompositeCandidate::userInt(const std::string &key) const {
+  const CompactSchema * s = schema();
+  const int slot = s ? s->intIndex(key) : CompactSchema::NONE;
+  if(slot != CompactSchema::NONE) return ints_[slot];
+  const int32_t * extra = find_extra(extraIntKeys_, extraInts_, key);
+  if(!extra) throw_missing("userInt", key, schemaId_, s != nullptr);
+  return *extra;
+}
+
+reco::CandidatePtr CompactCompositeCandidate::userCand(const std::string &key) const {
+  const CompactSchema * s = schema();
+  const int slot = s ? s->candIndex(key) : CompactSchema::NONE;
+  if(slot != CompactSchema::NONE) return cands_[slot];
+  const reco::CandidatePtr * extra = find_extra(extraCandKeys_, extraCands_, key);
+  // same as pat::PATObject: an unknown key gives a null Ptr
+  return extra ? *extra : reco::CandidatePtr();
+}
+
+bool CompactCompositeCandidate::hasUserFloat(const std::string &key) const {
+  const CompactSchema * s = schema();
+  const int slot = s ? s->floatIndex(key) : CompactSchema::NONE;
+  if(slot != CompactSchema::NONE) return isSet(floatsSet_, slot);
+  return has_extra(extraFloatKeys_, key);
+}
+
+bool CompactCompositeCandidate::hasUserInt(const std::string &key) const {
+  const CompactSchema * s = schema();
+  const int slot = s ? s->intIndex(key) : CompactSchema::NONE;
+  if(slot != CompactSchema::NONE) return isSet(intsSet_, slot);
+  return has_extra(extraIntKeys_, key);
+}
+
+bool CompactCompositeCandidate::hasUserCand(const std::string &key) const {
+  const CompactSchema * s = schema();
+  const int slot = s ? s->candIndex(key) : CompactSchema::NONE;
+  // a slot never set holds a null Ptr
+  if(slot != CompactSchema::NONE) return cands_[slot].isNonnull();
+  return has_extra(extraCandKeys_, key);
+}
+
+void CompactCompositeCandidate::addUserFloat(const std::string &key, float value) {
+  const CompactSchema * s = schema();
+  const int slot = s ? s->floatIndex(key) : CompactSchema::NONE;
+  if(slot != CompactSchema::NONE) {
+    floats_[slot] = value;
+    markSet(floatsSet_, slot);
+  } else {
+    set_extra(extraFloatKeys_, extraFloats_, key, value);
+  }
+}
+
+void CompactCompositeCandidate::addUserInt(const std::string &key, int32_t value) {
+  const CompactSchema * s = schema();
+  const int slot = s ? s->intIndex(key) : CompactSchema::NONE;
+  if(slot != CompactSchema::NONE) {
+    ints_[slot] = value;
+    markSet(intsSet_, slot);
+  } else {
+    set_extra(extraIntKeys_, extraInts_, key, value);
+  }
+}
+
+void CompactCompositeCandidate::addUserCand(const std::string &key, const reco::CandidatePtr &value) {
+  const CompactSchema * s = schema();
+  const int slot = s ? s->candIndex(key) : CompactSchema::NONE;
+  if(slot != CompactSchema::NONE) cands_[slot] = value;
+  else set_extra(extraCandKeys_, extraCands_, key, value);
+}
@@ -0,0 +1,108 @@
+#include "PhysicsTools/BParkingNano/interface/DeltaR2.h"
+
+#include "DataFormats/Math/interface/deltaR.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BPH_DELTAR2_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+  void deltaR2_scalar(float eta, float phi, const float *etas, const float *phis, size_t n, float *dr2) {
+    for(size_t i = 0; i < n; ++i) dr2[i] = reco::deltaR2(eta, phi, etas[i], phis[i]);
+  }
+
+#ifdef BPH_DELTAR2_X86
+  // dphi is brought back to [-pi, pi] as in reco::reduceRange, by removing
+  // the nearest multiple of 2 pi
+
+  __attribute__((target("avx2")))
+  void deltaR2_avx2(float eta, float phi, const float *etas, const float *phis, size_t n, float *dr2) {
+    const __m256 v_eta = _mm256_set1_ps(eta);
+    const __m256 v_phi = _mm256_set1_ps(phi);
+    const __m256 o2pi = _mm256_set1_ps(float(1. / (2. * M_PI)));
+    const __m256 twopi = _mm256_set1_ps(float(2. * M_PI));
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+      const __m256 deta = _mm256_sub_ps(_mm256_loadu_ps(etas + i), v_eta);
+      __m256 dphi = _mm256_sub_ps(_mm256_loadu_ps(phis + i), v_phi);
+      const __m256 turns = _mm256_round_ps(_mm256_mul_ps(dphi, o2pi), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+      dphi = _mm256_sub_ps(dphi, _mm256_mul_ps(turns, twopi));
+      _mm256_storeu_ps(dr2 + i, _mm256_add_ps(_mm256_mul_ps(deta, deta), _mm256_mul_ps(dphi, dphi)));
+    }
+    deltaR2_scalar(eta, phi, etas + i, phis + i, n - i, dr2 + i);
+  }
+
+  __attribute__((target("avx512f")))
+  void deltaR2_avx512(float eta, float phi, const float *etas, const float *phis, size_t n, float *dr2) {
+    const __m512 v_eta = _mm512_set1_ps(eta);
+    const __m512 v_phi = _mm512_set1_ps(phi);
+    const __m512 o2pi = _mm512_set1_ps(float(1. / (2. * M_PI)));
+    const __m512 twopi = _mm512_set1_ps(float(2. * M_PI));
+    for(size_t i = 0; i < n; i += 16) {
+      // the tail is done with masked loads and stores
+      const __mmask16 mask = n - i >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+      const __m512 deta = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, etas + i), v_eta);
+      __m512 dphi = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, phis + i), v_phi);
+      const __m512 turns = _mm512_maskz_roundscale_ps(__mmask16(0xFFFF), _mm512_mul_ps(dphi, o2pi),
+                                                      _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+      dphi = _mm512_sub_ps(dphi, _mm512_mul_ps(turns, twopi));
+      _mm512_mask_storeu_ps(dr2 + i, mask, _mm512_add_ps(_mm512_mul_ps(deta, deta), _mm512_mul_ps(dphi, dphi)));
+    }
+  }
+#endif
+
+  typedef void (*Kernel)(float, float, const float *, const float *, size_t, float *);
+
+  struct Dispatch {
+    Kernel kernel;
+    const char * isa;
+  };
+
+  // supported by the CPU, in order of preference
+  std::vector<Dispatch> supported() {
+    std::vector<Dispatch> kernels;
+#ifdef BPH_DELTAR2_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")) kernels.push_back({deltaR2_avx512, "avx512"});
+    if(__builtin_cpu_supports("avx2")) kernels.push_back({deltaR2_avx2, "avx2"});
+#endif
+    kernels.push_back({deltaR2_scalar, "scalar"});
+    return kernels;
+  }
+
+  const std::vector<Dispatch> & kernels() {
+    static const std::vector<Dispatch> all = supported();
+    return all;
+  }
+
+  const Dispatch & dispatch() {
+    static const Dispatch & selected = kernels().front();
+    return selected;
+  }
+
+}
+
+namespace kin {
+
+  void deltaR2(float eta, float phi, const float *etas, const float *phis, size_t n, float *dr2) {
+    dispatch().kernel(eta, phi, etas, phis, n, dr2);
+  }
+
+  const char * deltaR2_isa() { return dispatch().isa; }
+
+  bool deltaR2_with(const char *isa, float eta, float phi, const float *etas, const float *phis, size_t n, float *dr2) {
+    for(const Dispatch & candidate : kernels()) {
+      if(std::strcmp(candidate.isa, isa) != 0) continue;
+      candidate.kernel(eta, phi, etas, phis, n, dr2);
+      return true;
+    }
+    return false;
+  }
+
+}
@@ -0,0 +1,16 @@
+#include "PhysicsTools/BParkingNano/interface/ElectronOverlay.h"
+
+using namespace bph;
+
+ElectronOverlay::ElectronOverlay(const CompactSchema &schema, const edm::Ptr<pat::Electron> &electron):
+  CompactCompositeCandidate(schema),
+  electron_{electron} {
+  setP4(electron->p4());
+  setCharge(electron->charge());
+  setVertex(electron->vertex());
+  setPdgId(electron->pdgId());
+  for(int type = 0; type < pat::Electron::IpTypeSize; ++type) {
+    ip_[type] = electron->dB(IPTYPE(type));
+    eip_[type] = electron->edB(IPTYPE(type));
+  }
+}
@@ -0,0 +1,82 @@
+#include "PhysicsTools/BParkingNano/interface/FlatForest.h"
+#include "FWCore/Utilities/interface/Exception.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace bph;
+
+FlatForest::Layout::Layout(const Header &header) {
+  names = padded(sizeof(Header));
+  roots = names + padded(header.namesSize);
+  nodes = roots + padded(sizeof(int32_t) * header.nTrees);
+  leaves = nodes + padded(sizeof(Node) * header.nNodes);
+  size = leaves + sizeof(double) * header.nLeaves;
+}
+
+FlatForest::FlatForest(const std::string &path) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if(fd < 0)
+    throw cms::Exception("FlatForest") << "cannot open " << path << ": " << std::strerror(errno);
+  struct stat info;
+  if(::fstat(fd, &info) == 0 && size_t(info.st_size) >= sizeof(Header)) {
+    size_ = info.st_size;
+    map_ = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  ::close(fd);
+  if(map_ == nullptr || map_ == MAP_FAILED) {
+    map_ = nullptr;
+    throw cms::Exception("FlatForest") << "cannot map " << path;
+  }
+
+  const char * data = static_cast<const char *>(map_);
+  header_ = reinterpret_cast<const Header *>(data);
+  const Layout layout(*header_);
+  if(std::memcmp(header_->magic, MAGIC, sizeof(MAGIC)) != 0 || header_->version != VERSION ||
+     layout.size != size_) {
+    ::munmap(map_, size_);
+    map_ = nullptr;
+    throw cms::Exception("FlatForest") << path << " is not a forest of version " << VERSION;
+  }
+  roots_ = reinterpret_cast<const int32_t *>(data + layout.roots);
+  nodes_ = reinterpret_cast<const Node *>(data + layout.nodes);
+  leaves_ = reinterpret_cast<const double *>(data + layout.leaves);
+
+  // response() follows the indices unchecked: a corrupted file must not
+  // send it out of the blocks
+  auto invalid = [&](const char *what, uint32_t index) {
+    ::munmap(map_, size_);
+    map_ = nullptr;
+    return cms::Exception("FlatForest") << path << ": invalid " << what << " " << index;
+  };
+  // a node is followed by its subtree: the node children come after it,
+  // which also excludes cycles
+  auto valid_child = [&](int32_t child, int64_t parent) {
+    return child >= 0 ? child > parent && uint32_t(child) < header_->nNodes : uint32_t(~child) < header_->nLeaves;
+  };
+  for(uint32_t tree = 0; tree < header_->nTrees; ++tree) {
+    if(!valid_child(roots_[tree], -1)) throw invalid("root of tree", tree);
+  }
+  for(uint32_t index = 0; index < header_->nNodes; ++index) {
+    const Node & node = nodes_[index];
+    if(node.variable >= header_->nVariables || !valid_child(node.left, index) || !valid_child(node.right, index))
+      throw invalid("node", index);
+  }
+
+  const char * name = data + layout.names;
+  const char * names_end = name + header_->namesSize;
+  for(uint32_t i = 0; i < header_->nVariables; ++i) {
+    const char * end = static_cast<const char *>(std::memchr(name, '\0', names_end - name));
+    if(end == nullptr) throw invalid("name of variable", i);
+    variables_.emplace_back(name, end);
+    name = end + 1;
+  }
+}
+
+FlatForest::~FlatForest() {
+  if(map_ != nullptr) ::munmap(map_, size_);
+}
@@ -0,0 +1,23 @@
+#include "PhysicsTools/BParkingNano/interface/LazyTransientTrack.h"
+#include "TrackingTools/TransientTrack/interface/TransientTrackBuilder.h"
+
+#include <memory>
+
+using namespace bph;
+
+const reco::TransientTrack & LazyTransientTrack::get() const {
+  if(prebuilt_) return built_;
+  if(!cache_.isSet()) {
+    std::unique_ptr<reco::TransientTrack> ttrack;
+    if(builder_ != nullptr)
+      ttrack = std::make_unique<reco::TransientTrack>(regression_ ?
+                                                      builder_->buildfromReg(gsf_, momentum_, error_ratio_) :
+                                                      builder_->buildfromGSF(gsf_));
+    else if(track_ != nullptr)
+      ttrack = std::make_unique<reco::TransientTrack>(*track_, field_);
+    else
+      ttrack = std::make_unique<reco::TransientTrack>(); // invalid
+    cache_.set(std::move(ttrack));
+  }
+  return *cache_.load();
+}
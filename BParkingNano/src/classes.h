@@ -4,6 +4,9 @@
 #include "DataFormats/Common/interface/Wrapper.h"
 #include "TrackingTools/TransientTrack/interface/TransientTrack.h"
 #include "PhysicsTools/BParkingNano/plugins/KinVtxFitter.h"
+#include "PhysicsTools/BParkingNano/interface/CompactCompositeCandidate.h"
+#include "PhysicsTools/BParkingNano/interface/ElectronOverlay.h"
+#include "PhysicsTools/BParkingNano/interface/LazyTransientTrack.h"
 #include <vector>
 
 
@@ -12,6 +15,14 @@ namespace {
       std::vector<reco::TransientTrack> ttv;
       edm::Wrapper<std::vector<reco::TransientTrack> > wttv; 
       edm::Wrapper<std::vector<KinVtxFitter> > wkv;
+      bph::CompactSchemaCollection csc;
+      edm::Wrapper<bph::CompactSchemaCollection> wcsc;
+      bph::CompactCompositeCandidateCollection ccc;
+      edm::Wrapper<bph::CompactCompositeCandidateCollection> wccc;
+      bph::ElectronOverlayCollection eoc;
+      edm::Wrapper<bph::ElectronOverlayCollection> weoc;
+      bph::LazyTransientTrackCollection lttc;
+      edm::Wrapper<bph::LazyTransientTrackCollection> wlttc;
   };
 }
 
@@ -38,6 +38,11 @@ options.register('lhcRun', 3,
     VarParsing.varType.int,
     "LHC Run 2 or 3 (default)"
 )
+options.register('multiChannelBToLL', False,
+    VarParsing.multiplicity.singleton,
+    VarParsing.varType.bool,
+    "Build all the B channels in a single module"
+)
 
 options.setDefault('maxEvents', 1000)
 options.setDefault('tag', '124X')
@@ -141,6 +146,8 @@ process.NANOAODoutput = cms.OutputModule("NanoAODOutputModule",
     outputCommands = cms.untracked.vstring(
       'drop *',
       "keep nanoaodFlatTable_*Table_*_*",     # event data
+      "keep nanoaodFlatTable_BToK*_*_*",      # tables written by the B builders
+      "keep nanoaodFlatTable_BToLL_*_*",      # tables written by the multi-channel B builder
       "keep nanoaodUniqueString_nanoMetadata_*_*",   # basic metadata
     )
 
@@ -158,29 +165,35 @@ if options.lhcRun == 2:
     process = nanoAOD_customizeMuonTriggerBPark(process)
     process = nanoAOD_customizeElectronFilteredBPark(process)
     process = nanoAOD_customizeTrackFilteredBPark(process)
-    process = nanoAOD_customizeBToKLL(process)
-    process = nanoAOD_customizeBToKstarEE(process)
-    process = nanoAOD_customizeBToKstarMuMu(process)
+    if options.multiChannelBToLL:
+        process = nanoAOD_customizeBToLL(process, ['Kee', 'Kmumu'])
+    else:
+        process = nanoAOD_customizeBToKLL(process)
+        process = nanoAOD_customizeBToKstarEE(process)
+        process = nanoAOD_customizeBToKstarMuMu(process)
 elif options.lhcRun == 3:
     from PhysicsTools.BParkingNano.electronsTrigger_cff import *
     process = nanoAOD_customizeDiEle(process)
     process = nanoAOD_customizeElectronFilteredBPark(process)
     process = nanoAOD_customizeTriggerBitsBPark(process)
     process = nanoAOD_customizeTrackFilteredBPark(process)
-    process = nanoAOD_customizeBToKLL(process)
+    if options.multiChannelBToLL:
+        process = nanoAOD_customizeBToLL(process, ['Kee'])
+    else:
+        process = nanoAOD_customizeBToKLL(process)
 
 # Path and EndPath definitions
 if options.lhcRun == 2:
-    process.nanoAOD_KMuMu_step = cms.Path(process.nanoSequence + process.nanoTracksSequence + process.nanoBKMuMuSequence + CountBToKmumu )
-    process.nanoAOD_Kee_step   = cms.Path(process.nanoSequence + process.nanoTracksSequence + process.nanoBKeeSequence   + CountBToKee   )
-    process.nanoAOD_KstarMuMu_step = cms.Path(process.nanoSequence + process.nanoTracksSequence + process.KstarToKPiSequence + process.nanoBKstarMuMuSequence + CountBToKstarMuMu )
-    process.nanoAOD_KstarEE_step  = cms.Path(process.nanoSequence + process.nanoTracksSequence + process.KstarToKPiSequence + process.nanoBKstarEESequence + CountBToKstarEE  )
+    process.nanoAOD_KMuMu_step = cms.Path(process.nanoSequence + process.nanoTracksSequence + process.nanoBKMuMuSequence + process.CountBToKmumu )
+    process.nanoAOD_Kee_step   = cms.Path(process.nanoSequence + process.nanoTracksSequence + process.nanoBKeeSequence   + process.CountBToKee   )
+    process.nanoAOD_KstarMuMu_step = cms.Path(process.nanoSequence + process.nanoTracksSequence + process.nanoBKstarMuMuSequence + process.CountBToKstarMuMu )
+    process.nanoAOD_KstarEE_step  = cms.Path(process.nanoSequence + process.nanoTracksSequence + process.nanoBKstarEESequence + process.CountBToKstarEE  )
 elif options.lhcRun == 3:
     process.nanoAOD_DiEle_step = cms.Path(process.nanoSequence
                                           +process.nanoDiEleSequence
                                           +process.nanoTracksSequence
                                           +process.nanoBKeeSequence
-                                          +CountBToKee)
+                                          +process.CountBToKee)
 
 # customisation of the process.
 if options.isMC:
@@ -246,3 +259,13 @@ process.NANOAODoutput.fakeNameForCrab=cms.untracked.bool(True)
 process.load("TrackingTools/TransientTrack/TransientTrackBuilder_cfi")
 from Configuration.StandardSequences.earlyDeleteSettings_cff import customiseEarlyDelete
 process = customiseEarlyDelete(process)
+
+# the transient tracks are built on demand and only read by the builders
+process.options.canDeleteEarly.extend([
+    'bphLazyTransientTracks_%s_%s_%s.' % (label, instance, process.name_()) for label, instance in [
+        ('muonTrgSelector', 'SelectedTransientMuons'),
+        ('electronTrgSelector', 'SelectedTransientElectrons'),
+        ('electronsForAnalysis', 'SelectedTransientElectrons'),
+        ('tracksBPark', 'SelectedTransientTracks'),
+    ]
+])
@@ -0,0 +1,77 @@
+// Matches GSF tracks to conversions through ConversionIndex, with a track
+// shared by two conversions: it leads the first one and trails the second.
+// The matched track gets the quantities of the last conversion and both the
+// lead and trail flags; the other tracks only those of their conversion.
+
+#include "DataFormats/Common/interface/TestHandle.h"
+#include "DataFormats/EgammaCandidates/interface/Conversion.h"
+#include "DataFormats/GsfTrackReco/interface/GsfTrack.h"
+#include "DataFormats/GsfTrackReco/interface/GsfTrackFwd.h"
+#include "DataFormats/VertexReco/interface/Vertex.h"
+
+// ConversionInfo is built into the plugin library, which cannot be linked
+#include "PhysicsTools/BParkingNano/plugins/ConversionInfo.cc"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+  int failures = 0;
+
+  void check(bool ok, const std::string &what) {
+    if(ok) return;
+    ++failures;
+    std::cerr << "failed: " << what << std::endl;
+  }
+
+  reco::GsfTrack track(double pt) {
+    return reco::GsfTrack(1., 1., reco::TrackBase::Point(0., 0., 0.), reco::TrackBase::Vector(pt, 0., 1.), -1,
+                          reco::TrackBase::CovarianceMatrix());
+  }
+
+  reco::Conversion conversion(const reco::GsfTrackRef &trk1, const reco::GsfTrackRef &trk2) {
+    std::vector<edm::RefToBase<reco::Track> > tracks{edm::RefToBase<reco::Track>(trk1),
+                                                     edm::RefToBase<reco::Track>(trk2)};
+    return reco::Conversion(reco::CaloClusterPtrVector(), tracks, reco::Vertex());
+  }
+
+}
+
+int main() {
+  // shared (pt 10) leads the first conversion, with pt 5, and trails the second one, with pt 20
+  std::vector<reco::GsfTrack> tracks{track(10.), track(5.), track(20.), track(7.)};
+  edm::TestHandle<reco::GsfTrackCollection> handle(&tracks, edm::ProductID(1, 1));
+  const reco::GsfTrackRef shared(handle, 0), soft(handle, 1), hard(handle, 2), alone(handle, 3);
+
+  ConversionIndex index;
+  const reco::BeamSpot beamSpot;
+  index.clear();
+  index.add(conversion(shared, soft), beamSpot);
+  index.add(conversion(hard, shared), beamSpot);
+  check(index.size() == 2, "two conversions indexed");
+
+  ConversionInfo info;
+  check(index.match(shared, info), "shared track matched");
+  check(info.matched_lead.isNonnull() && info.matched_lead.key() == shared.key(), "shared track is a lead track");
+  check(info.matched_trail.isNonnull() && info.matched_trail.key() == shared.key(), "shared track is a trail track");
+  check(info.ilead == 0 && info.itrail == 1, "shared track has the quantities of the last conversion");
+
+  check(index.match(soft, info), "trail track of the first conversion matched");
+  check(info.matched_lead.isNull() && info.matched_trail.isNonnull(), "trail track of the first conversion flags");
+  check(info.ilead == 0 && info.itrail == 1, "trail track of the first conversion quantities");
+
+  check(index.match(hard, info), "lead track of the second conversion matched");
+  check(info.matched_lead.isNonnull() && info.matched_trail.isNull(), "lead track of the second conversion flags");
+
+  check(!index.match(alone, info), "track without conversion not matched");
+  check(!info.matched && info.matched_lead.isNull() && info.matched_trail.isNull() && info.ilead == -1,
+        "track without conversion gets the defaults");
+
+  if(failures > 0) {
+    std::cerr << failures << " failed checks" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,78 @@
+// Compares kin::deltaR2, with each instruction set the CPU supports, to
+// reco::deltaR2 on random axes and on pairs across the phi = +-pi boundary.
+// The sizes go through the vector widths to check the tails as well.
+
+#include "DataFormats/Math/interface/deltaR.h"
+#include "PhysicsTools/BParkingNano/interface/DeltaR2.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+
+  int failures = 0;
+
+  void compare(const char *isa, float eta, float phi, const std::vector<float> &etas, const std::vector<float> &phis) {
+    const size_t n = etas.size();
+    std::vector<float> dr2(n, -1.f);
+    if(!kin::deltaR2_with(isa, eta, phi, etas.data(), phis.data(), n, dr2.data())) return;
+    for(size_t i = 0; i < n; ++i) {
+      const float expected = reco::deltaR2(eta, phi, etas[i], phis[i]);
+      if(std::abs(dr2[i] - expected) <= 1e-5f * std::max(1.f, expected)) continue;
+      if(++failures <= 10)
+        std::cerr << isa << ": deltaR2(" << eta << ", " << phi << ", " << etas[i] << ", " << phis[i] << ") = "
+                  << dr2[i] << ", expected " << expected << std::endl;
+    }
+  }
+
+}
+
+int main() {
+  const char * isas[] = {"avx512", "avx2", "scalar"};
+  std::cout << "deltaR2 runs with " << kin::deltaR2_isa() << std::endl;
+
+  std::mt19937 rng(12345);
+  std::uniform_real_distribution<float> eta_dist(-2.5, 2.5);
+  std::uniform_real_distribution<float> phi_dist(-M_PI, M_PI);
+  std::uniform_real_distribution<float> edge_dist(0., 0.05);
+  for(size_t n = 0; n <= 40; ++n) {
+    for(int trial = 0; trial < 20; ++trial) {
+      std::vector<float> etas(n), phis(n);
+      for(size_t i = 0; i < n; ++i) {
+        etas[i] = eta_dist(rng);
+        phis[i] = phi_dist(rng);
+      }
+      const float eta = eta_dist(rng), phi = phi_dist(rng);
+      for(const char * isa : isas) compare(isa, eta, phi, etas, phis);
+
+      // axis and inputs on both sides of +-pi, where dphi wraps
+      for(size_t i = 0; i < n; ++i) phis[i] = (i % 2 ? -1 : 1) * (float(M_PI) - edge_dist(rng));
+      for(const char * isa : isas) {
+        compare(isa, eta, float(M_PI) - edge_dist(rng), etas, phis);
+        compare(isa, eta, -float(M_PI) + edge_dist(rng), etas, phis);
+        compare(isa, eta, float(M_PI), etas, phis);
+        compare(isa, eta, -float(M_PI), etas, phis);
+      }
+    }
+  }
+
+  bool picked_supported = false;
+  for(const char * isa : isas) {
+    const bool supported = kin::deltaR2_with(isa, 0, 0, nullptr, nullptr, 0, nullptr);
+    picked_supported |= supported && std::strcmp(isa, kin::deltaR2_isa()) == 0;
+    std::cout << isa << (supported ? ": tested" : ": not supported by this CPU") << std::endl;
+  }
+  if(!picked_supported || !kin::deltaR2_with("scalar", 0, 0, nullptr, nullptr, 0, nullptr)) {
+    std::cerr << "deltaR2 picked " << kin::deltaR2_isa() << ", not among the supported instruction sets" << std::endl;
+    return 1;
+  }
+  if(failures > 0) {
+    std::cerr << failures << " differences from reco::deltaR2" << std::endl;
+    return 1;
+  }
+  return 0;
+}